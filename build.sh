@@ -1,8 +1,24 @@
 #! /usr/bin/env bash
 
+# Usage: build.sh [test|bench [case]...]
+# Without arguments builds the server. `test` builds and runs the tests,
+# `bench` builds the benchmarks with optimizations and runs them, both with
+# the selected cases only and from bin/.
+
 mkdir bin 2> /dev/null
 mkdir data 2> /dev/null
 
+if [ "$1" == "test" ]; then
+	shift
+	gcc src/test.cpp -g -lm -lrt -pthread -o bin/dorf_test || exit 1
+	cd bin && exec ./dorf_test "$@"
+fi
+
+if [ "$1" == "bench" ]; then
+	shift
+	gcc src/bench.cpp -O2 -g -lm -lrt -pthread -o bin/dorf_bench || exit 1
+	cd bin && exec ./dorf_bench "$@"
+fi
+
 gcc src/build.cpp -g -lm -lrt -pthread -o bin/dorfbook
 cp -r data bin
-
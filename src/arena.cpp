@@ -0,0 +1,203 @@
+
+// Memory arenas allocate by bumping a pointer inside large chunks and free
+// everything at once. Arenas are recycled through a free list per thread
+// (with a shared list for threads that release more than they acquire), so
+// a request normally doesn't touch malloc at all.
+
+#define ARENA_CHUNK_SIZE KB(16)
+#define ARENA_ALIGNMENT 16
+
+// Maximum number of arenas kept on the free list of one thread
+#define ARENA_LOCAL_FREE_MAX 16
+
+// Maximum number of arenas kept on the shared free list
+#define ARENA_SHARED_FREE_MAX 256
+
+struct Arena_Chunk
+{
+	Arena_Chunk *prev;
+	size_t size;
+	size_t used;
+};
+
+struct Memory_Arena
+{
+	Arena_Chunk *chunk;
+
+	// The chunk the arena itself lives in, kept when the arena is cleared
+	Arena_Chunk *base_chunk;
+	size_t base_used;
+
+	Memory_Arena *next_free;
+};
+
+struct Arena_Pool
+{
+	os_mutex lock;
+	Memory_Arena *shared_free;
+	U32 shared_free_count;
+
+	os_atomic_uint32 local_hits;
+	os_atomic_uint32 shared_hits;
+	os_atomic_uint32 misses;
+};
+
+Arena_Pool arena_pool;
+
+os_thread_local Memory_Arena *arena_local_free;
+os_thread_local U32 arena_local_free_count;
+
+inline size_t arena_align(size_t size)
+{
+	return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+Arena_Chunk *arena_chunk_new(size_t min_size)
+{
+	size_t size = max(min_size, (size_t)ARENA_CHUNK_SIZE);
+	Arena_Chunk *chunk = (Arena_Chunk*)malloc(arena_align(sizeof(Arena_Chunk)) + size);
+	chunk->prev = 0;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+inline char *arena_chunk_data(Arena_Chunk *chunk)
+{
+	return (char*)chunk + arena_align(sizeof(Arena_Chunk));
+}
+
+void *arena_push(Memory_Arena *arena, size_t size)
+{
+	size = arena_align(size);
+	Arena_Chunk *chunk = arena->chunk;
+	if (chunk->size - chunk->used < size) {
+		Arena_Chunk *new_chunk = arena_chunk_new(size);
+		new_chunk->prev = chunk;
+		arena->chunk = chunk = new_chunk;
+	}
+
+	void *result = arena_chunk_data(chunk) + chunk->used;
+	chunk->used += size;
+	return result;
+}
+
+char *arena_push_string(Memory_Arena *arena, const char *string, int length)
+{
+	char *result = (char*)arena_push(arena, length + 1);
+	memcpy(result, string, length);
+	result[length] = '\0';
+	return result;
+}
+
+Memory_Arena *arena_create()
+{
+	Arena_Chunk *chunk = arena_chunk_new(ARENA_CHUNK_SIZE);
+	Memory_Arena *arena = (Memory_Arena*)arena_chunk_data(chunk);
+	chunk->used = arena_align(sizeof(Memory_Arena));
+
+	arena->chunk = chunk;
+	arena->base_chunk = chunk;
+	arena->base_used = chunk->used;
+	arena->next_free = 0;
+	return arena;
+}
+
+// Frees everything allocated from the arena, keeping only the first chunk.
+void arena_clear(Memory_Arena *arena)
+{
+	Arena_Chunk *chunk = arena->chunk;
+	while (chunk != arena->base_chunk) {
+		Arena_Chunk *prev = chunk->prev;
+		free(chunk);
+		chunk = prev;
+	}
+	arena->chunk = arena->base_chunk;
+	arena->chunk->used = arena->base_used;
+}
+
+void arena_destroy(Memory_Arena *arena)
+{
+	arena_clear(arena);
+	free(arena->base_chunk);
+}
+
+void arena_pool_init()
+{
+	os_mutex_init(&arena_pool.lock);
+}
+
+// Returns an empty arena, recycled if possible.
+Memory_Arena *arena_acquire()
+{
+	Memory_Arena *arena = arena_local_free;
+	if (arena) {
+		arena_local_free = arena->next_free;
+		arena_local_free_count--;
+		os_atomic_increment(&arena_pool.local_hits);
+		return arena;
+	}
+
+	os_mutex_lock(&arena_pool.lock);
+	arena = arena_pool.shared_free;
+	if (arena) {
+		arena_pool.shared_free = arena->next_free;
+		arena_pool.shared_free_count--;
+	}
+	os_mutex_unlock(&arena_pool.lock);
+
+	if (arena) {
+		os_atomic_increment(&arena_pool.shared_hits);
+		return arena;
+	}
+
+	os_atomic_increment(&arena_pool.misses);
+	return arena_create();
+}
+
+void arena_release(Memory_Arena *arena)
+{
+	arena_clear(arena);
+
+	if (arena_local_free_count < ARENA_LOCAL_FREE_MAX) {
+		arena->next_free = arena_local_free;
+		arena_local_free = arena;
+		arena_local_free_count++;
+		return;
+	}
+
+	os_mutex_lock(&arena_pool.lock);
+	bool kept = arena_pool.shared_free_count < ARENA_SHARED_FREE_MAX;
+	if (kept) {
+		arena->next_free = arena_pool.shared_free;
+		arena_pool.shared_free = arena;
+		arena_pool.shared_free_count++;
+	}
+	os_mutex_unlock(&arena_pool.lock);
+
+	if (!kept)
+		arena_destroy(arena);
+}
+
+// Hands the free list of a thread that is about to exit back to the shared
+// list, so short-lived threads don't leak the arenas they recycled.
+void arena_thread_exit()
+{
+	while (arena_local_free) {
+		Memory_Arena *arena = arena_local_free;
+		arena_local_free = arena->next_free;
+		arena_local_free_count--;
+
+		os_mutex_lock(&arena_pool.lock);
+		bool kept = arena_pool.shared_free_count < ARENA_SHARED_FREE_MAX;
+		if (kept) {
+			arena->next_free = arena_pool.shared_free;
+			arena_pool.shared_free = arena;
+			arena_pool.shared_free_count++;
+		}
+		os_mutex_unlock(&arena_pool.lock);
+
+		if (!kept)
+			arena_destroy(arena);
+	}
+}
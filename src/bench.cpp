@@ -0,0 +1,688 @@
+// Microbenchmarks of the hot paths, built and run by `./build.sh bench`.
+// Every case runs a fixed number of iterations and reports the time per
+// iteration. Arguments select the cases whose names contain any of them.
+
+#define DORF_NO_MAIN
+#include "build.cpp"
+
+struct Bench
+{
+	U64 iterations;
+	os_timer_mark begin;
+	os_timer_mark end;
+	bool stopped;
+};
+
+// Restarts the clock, for cases that set up their data first
+inline void bench_start(Bench *bench)
+{
+	bench->begin = os_get_timer();
+}
+
+// Stops the clock, for cases that clean up afterwards
+inline void bench_stop(Bench *bench)
+{
+	bench->end = os_get_timer();
+	bench->stopped = true;
+}
+
+// Results are added here so the compiler can't drop the measured work
+volatile U64 bench_sink;
+
+typedef void Bench_Func(Bench *bench);
+
+struct Bench_Case
+{
+	const char *name;
+	Bench_Func *func;
+	U64 iterations;
+};
+
+// -- Arenas
+
+// Sizes allocated per request by a typical page render
+U32 bench_alloc_sizes[] = { 48, 256, 4096, 96, 1024, 32, 12000, 64 };
+
+void bench_arena_recycle(Bench *bench)
+{
+	for (U64 i = 0; i < bench->iterations; i++) {
+		Memory_Arena *arena = arena_acquire();
+		for (U32 j = 0; j < Count(bench_alloc_sizes); j++) {
+			char *data = (char*)arena_push(arena, bench_alloc_sizes[j]);
+			data[0] = (char)j;
+			bench_sink += (U64)data[0];
+		}
+		arena_release(arena);
+	}
+}
+
+void bench_arena_malloc(Bench *bench)
+{
+	void *blocks[Count(bench_alloc_sizes)];
+	for (U64 i = 0; i < bench->iterations; i++) {
+		for (U32 j = 0; j < Count(bench_alloc_sizes); j++) {
+			char *data = (char*)malloc(bench_alloc_sizes[j]);
+			data[0] = (char)j;
+			bench_sink += (U64)data[0];
+			blocks[j] = data;
+		}
+		for (U32 j = 0; j < Count(bench_alloc_sizes); j++)
+			free(blocks[j]);
+	}
+}
+
+// -- Request parsing
+
+const char bench_request[] =
+	"GET /entities/17/feed?at=1200 HTTP/1.1\r\n"
+	"Host: localhost:3500\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Connection: keep-alive\r\n"
+	"Cookie: session=0123456789abcdef0123456789abcdef\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"If-None-Match: \"0000d02f-00000000000004b0\"\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+void bench_parse(Bench *bench, HTTP_Scan_Func scan)
+{
+	HTTP_Scan_Func previous = http_scan;
+	http_scan = scan;
+
+	// The parser writes into the buffer, so every iteration copies the
+	// request in first like a receive would
+	char buffer[sizeof(bench_request)];
+	int size = (int)sizeof(bench_request) - 1;
+	for (U64 i = 0; i < bench->iterations; i++) {
+		memcpy(buffer, bench_request, size);
+		HTTP_Request request;
+		if (http_parse_request(buffer, size, &request) == HTTP_Parse_Ok)
+			bench_sink += (U64)request.length;
+	}
+
+	bench_stop(bench);
+	http_scan = previous;
+}
+
+// The parse before the in-place parser, kept as the baseline: every line is
+// copied out of the buffer by `buffer_read_line` and the request line is
+// split with sscanf. Reads from memory here instead of the socket. It skips
+// the headers without looking at them, which the in-place parser doesn't.
+struct Bench_Legacy_Buffer
+{
+	const char *data;
+	int size;
+	int pos;
+};
+
+int bench_legacy_read_line(Bench_Legacy_Buffer *buffer, char *line, int length)
+{
+	const char *block = buffer->data + buffer->pos;
+	int block_length = min(length, buffer->size - buffer->pos);
+	if (block_length <= 0) return -3;
+
+	char *end = (char*)memchr(block, '\r', block_length);
+	int in_length = end ? (int)(end - block) : block_length;
+
+	// Check for buffer overflow and null-byte injection
+	if (in_length > length - 1) return -1;
+	if (memchr(block, '\0', in_length)) return -4;
+
+	memcpy(line, block, in_length);
+	buffer->pos += in_length;
+	if (!end) return -1;
+
+	if (buffer->size - buffer->pos < 2 || memcmp(buffer->data + buffer->pos, "\r\n", 2))
+		return -2;
+	buffer->pos += 2;
+	line[in_length] = '\0';
+	return in_length;
+}
+
+void bench_parse_legacy(Bench *bench)
+{
+	for (U64 i = 0; i < bench->iterations; i++) {
+		Bench_Legacy_Buffer buffer = { bench_request, (int)sizeof(bench_request) - 1, 0 };
+		char line[256];
+		if (bench_legacy_read_line(&buffer, line, sizeof(line)) < 0)
+			continue;
+
+		char method[64];
+		char path[2048];
+		char http_version[32];
+		if (sscanf(line, "%s %s %s\r\n", method, path, http_version) == EOF)
+			continue;
+		while (strlen(line)) {
+			if (bench_legacy_read_line(&buffer, line, sizeof(line)) < 0)
+				break;
+		}
+		bench_sink += (U64)buffer.pos + (U64)path[1];
+	}
+}
+
+void bench_parse_scalar(Bench *bench)
+{
+	bench_parse(bench, http_scan_scalar);
+}
+
+#if ARCH_SSE2
+
+void bench_parse_sse2(Bench *bench)
+{
+	bench_parse(bench, http_scan_sse2);
+}
+
+void bench_parse_avx2(Bench *bench)
+{
+	if (!os_cpu_has_avx2()) {
+		bench->iterations = 0;
+		return;
+	}
+	bench_parse(bench, http_scan_avx2);
+}
+
+#endif
+
+// -- Routing
+
+// Mix of the pages a client browses, including ones that don't match
+const char *bench_paths[] = {
+	"/dwarves", "/entities/17", "/entities/17/feed", "/entities/2048/avatar.svg",
+	"/locations/3", "/feed", "/static/style.css", "/favicon.ico", "/stats",
+	"/entities/17x", "/nothing/here",
+};
+
+void bench_route(Bench *bench)
+{
+	for (U64 i = 0; i < bench->iterations; i++) {
+		Route_Match match;
+		route_match(bench_paths[i % Count(bench_paths)], &match);
+		bench_sink += (U64)match.kind;
+	}
+}
+
+// -- Formatting
+
+// Rows like the ones of the dwarf list, rendered with the `out_*` functions
+// or with snprintf as pages were before. Every iteration renders 64 rows
+// into a new output.
+const char *bench_names[] = { "Urist McMiner", "Kogan Ironfist", "Zon Tunnelsmith" };
+
+void bench_format_direct(Bench *bench)
+{
+	for (U64 i = 0; i < bench->iterations; i++) {
+		Memory_Arena *arena = arena_acquire();
+		Output out;
+		out_init(&out, arena);
+		for (U32 row = 0; row < 64; row++) {
+			U64 id = i * 64 + row;
+			out_literal(&out, "<tr><td><a href=\"/entities/");
+			out_u64(&out, id);
+			out_literal(&out, "\">");
+			out_html(&out, bench_names[row % Count(bench_names)]);
+			out_literal(&out, "</a></td><td>");
+			out_fixed(&out, (double)id * 0.37, 2);
+			out_literal(&out, "</td></tr>");
+		}
+		bench_sink += (U64)out.length;
+		arena_release(arena);
+	}
+}
+
+void bench_format_snprintf(Bench *bench)
+{
+	for (U64 i = 0; i < bench->iterations; i++) {
+		Memory_Arena *arena = arena_acquire();
+		Output out;
+		out_init(&out, arena);
+		for (U32 row = 0; row < 64; row++) {
+			U64 id = i * 64 + row;
+			char *dest = out_reserve(&out, 256);
+			int length = snprintf(dest, 256,
+				"<tr><td><a href=\"/entities/%llu\">%s</a></td><td>%.2f</td></tr>",
+				(unsigned long long)id, bench_names[row % Count(bench_names)],
+				(double)id * 0.37);
+			out_commit(&out, length);
+		}
+		bench_sink += (U64)out.length;
+		arena_release(arena);
+	}
+}
+
+// The same with 128 more routes, which share prefixes, capture ids and end
+// in wildcards. Matching walks the path through the trie, so the same paths
+// should cost about the same as with the small table, and longer paths more
+// only for their length.
+const char *bench_route_sections[] = {
+	"/api/v1", "/api/v2", "/api/v3", "/admin", "/admin/audit", "/internal",
+	"/public", "/partners",
+};
+
+const char *bench_route_resources[] = {
+	"accounts", "accessories", "actions", "activity", "admins", "alerts",
+	"albums", "apps", "articles", "assets", "audits", "avatars", "badges",
+	"banners", "billing", "blocks",
+};
+
+#define BENCH_ROUTE_COUNT (Count(bench_route_sections) * Count(bench_route_resources))
+
+Route_Node bench_saved_route_nodes[ROUTE_MAX_NODES];
+U32 bench_saved_route_node_count;
+char bench_route_paths[BENCH_ROUTE_COUNT][96];
+
+// Adds the routes on top of the server ones, which `bench_routes_restore`
+// brings back. Each gets its own kind and a path that matches it.
+void bench_routes_add()
+{
+	memcpy(bench_saved_route_nodes, route_nodes, sizeof(route_nodes));
+	bench_saved_route_node_count = route_node_count;
+
+	for (U32 i = 0; i < BENCH_ROUTE_COUNT; i++) {
+		const char *section = bench_route_sections[i / Count(bench_route_resources)];
+		const char *resource = bench_route_resources[i % Count(bench_route_resources)];
+		char *path = bench_route_paths[i];
+		size_t size = sizeof(bench_route_paths[i]);
+		char pattern[96];
+		switch (i % 4) {
+		case 0:
+			snprintf(pattern, sizeof(pattern), "%s/%s", section, resource);
+			snprintf(path, size, "%s/%s", section, resource);
+			break;
+		case 1:
+			snprintf(pattern, sizeof(pattern), "%s/%s/:id", section, resource);
+			snprintf(path, size, "%s/%s/%u", section, resource, i * 7919);
+			break;
+		case 2:
+			snprintf(pattern, sizeof(pattern), "%s/%s/:id/items/:item", section, resource);
+			snprintf(path, size, "%s/%s/%u/items/%u", section, resource, i, i * 31);
+			break;
+		default:
+			snprintf(pattern, sizeof(pattern), "%s/%s/files/*", section, resource);
+			snprintf(path, size, "%s/%s/files/docs/%u.txt", section, resource, i);
+			break;
+		}
+		route_add(pattern, (Route_Kind)(Route_Stats + 1 + i));
+	}
+}
+
+void bench_routes_restore()
+{
+	memcpy(route_nodes, bench_saved_route_nodes, sizeof(route_nodes));
+	route_node_count = bench_saved_route_node_count;
+}
+
+void bench_route_large_table(Bench *bench)
+{
+	bench_routes_add();
+	bench_start(bench);
+	bench_route(bench);
+	bench_stop(bench);
+	bench_routes_restore();
+}
+
+void bench_route_large_paths(Bench *bench)
+{
+	bench_routes_add();
+	bench_start(bench);
+	U32 misses = 0;
+	for (U64 i = 0; i < bench->iterations; i++) {
+		U32 route = (U32)(i % BENCH_ROUTE_COUNT);
+		Route_Match match;
+		misses += route_match(bench_route_paths[route], &match)
+			!= (Route_Kind)(Route_Stats + 1 + route);
+	}
+	bench_stop(bench);
+	bench_routes_restore();
+
+	bench_sink += misses;
+	if (misses > 0)
+		printf("%u paths matched the wrong route\n", misses);
+}
+
+// -- Random numbers
+
+void bench_next64(Bench *bench)
+{
+	Random_Series series = series_from_seed32(1);
+	U64 sum = 0;
+	for (U64 i = 0; i < bench->iterations; i++)
+		sum += next64(&series);
+	bench_sink += sum;
+}
+
+void bench_series_from_key(Bench *bench)
+{
+	for (U64 i = 0; i < bench->iterations; i++) {
+		Random_Series series = series_from_key(0xD02F, i, 7);
+		bench_sink += series.state.lo;
+	}
+}
+
+// Fills of 4096 numbers, the batch size of a tick chunk
+void bench_random_fill(Bench *bench, Random_Fill_Func fill)
+{
+	static U32 numbers[4096];
+	for (U64 i = 0; i < bench->iterations; i++) {
+		fill(0xD02F, i * 1024, 0, numbers, Count(numbers));
+		bench_sink += numbers[i % Count(numbers)];
+	}
+}
+
+void bench_random_fill_scalar(Bench *bench)
+{
+	bench_random_fill(bench, random_fill_scalar);
+}
+
+#if ARCH_SSE2
+
+void bench_random_fill_avx2(Bench *bench)
+{
+	if (!os_cpu_has_avx2()) {
+		bench->iterations = 0;
+		return;
+	}
+	bench_random_fill(bench, random_fill_avx2);
+}
+
+#endif
+
+// -- Worlds
+
+// Generates a world without a post log, so ticking doesn't touch files
+World *bench_world(int dwarf_count)
+{
+	Name_Table *names = (Name_Table*)malloc(sizeof(Name_Table));
+	name_table_init(names);
+	World *world = (World*)malloc(sizeof(World));
+	world_init(world, names);
+	generate_world(world, dwarf_count, 0xD02F);
+	return world;
+}
+
+World_Instance *bench_world_instance(int dwarf_count)
+{
+	World_Instance *instance = (World_Instance*)calloc(1, sizeof(World_Instance));
+	instance->world = bench_world(dwarf_count);
+	world_publish(instance);
+	return instance;
+}
+
+// What a request handler pays to read the world
+void bench_snapshot_acquire(Bench *bench)
+{
+	World_Instance *instance = bench_world_instance(1000);
+	bench_start(bench);
+	for (U64 i = 0; i < bench->iterations; i++) {
+		World_Snapshot *snapshot = world_acquire(instance);
+		bench_sink += snapshot->world.tick;
+		world_release(snapshot);
+	}
+}
+
+// What the simulation thread pays to publish after a tick
+void bench_snapshot_publish(Bench *bench)
+{
+	World_Instance *instance = bench_world_instance(100000);
+	bench_start(bench);
+	for (U64 i = 0; i < bench->iterations; i++)
+		world_publish(instance);
+}
+
+// Readers rendering entity pages while the simulation ticks and publishes
+// as fast as it can, the case the snapshots are for. Every reader does a
+// share of the iterations, the time per iteration is the wall time of all
+// reads, so it goes down as readers are added.
+#define BENCH_READER_COUNT 4
+
+struct Bench_Readers
+{
+	World_Instance *instance;
+	U64 reads_per_reader;
+	os_atomic_uint32 stop;
+	os_atomic_uint32 publish_count;
+	os_atomic_uint32 rendered_bytes;
+	os_semaphore done;
+};
+
+OS_THREAD_ENTRY(thread_bench_publisher, readers_ptr)
+{
+	Bench_Readers *readers = (Bench_Readers*)readers_ptr;
+	World_Instance *instance = readers->instance;
+	while (os_atomic_add(&readers->stop, 0) == 0) {
+		world_tick(instance->world, 0);
+		world_publish(instance);
+		os_atomic_increment(&readers->publish_count);
+	}
+	os_semaphore_signal(&readers->done);
+	OS_THREAD_RETURN;
+}
+
+OS_THREAD_ENTRY(thread_bench_reader, readers_ptr)
+{
+	Bench_Readers *readers = (Bench_Readers*)readers_ptr;
+	Memory_Arena *arena = arena_acquire();
+	U32 length = 0;
+	for (U64 i = 0; i < readers->reads_per_reader; i++) {
+		World_Snapshot *snapshot = world_acquire(readers->instance);
+		World *world = &snapshot->world;
+		Output out;
+		out_init(&out, arena);
+		render_entity(world, dwarf_id(world, (U32)(i * 7919 % world->dwarves.count)), &out);
+		length += (U32)out.length;
+		world_release(snapshot);
+		arena_clear(arena);
+	}
+	arena_release(arena);
+	os_atomic_add(&readers->rendered_bytes, length);
+	os_semaphore_signal(&readers->done);
+	OS_THREAD_RETURN;
+}
+
+void bench_snapshot_contended(Bench *bench)
+{
+	Bench_Readers readers = { 0 };
+	readers.instance = bench_world_instance(10000);
+	readers.instance->world->path_prefix = "";
+	world_publish(readers.instance);
+	readers.reads_per_reader = bench->iterations / BENCH_READER_COUNT;
+	bench->iterations = readers.reads_per_reader * BENCH_READER_COUNT;
+	os_semaphore_init(&readers.done, 0);
+
+	os_thread_do(thread_bench_publisher, &readers);
+	bench_start(bench);
+	for (int i = 0; i < BENCH_READER_COUNT; i++)
+		os_thread_do(thread_bench_reader, &readers);
+	for (int i = 0; i < BENCH_READER_COUNT; i++)
+		os_semaphore_wait(&readers.done);
+	bench_stop(bench);
+
+	os_atomic_increment(&readers.stop);
+	os_semaphore_wait(&readers.done);
+	bench_sink += readers.rendered_bytes;
+
+	double seconds = (double)(os_timer_ns(bench->end) - os_timer_ns(bench->begin)) / 1e9;
+	printf("%u readers: %.0f reads/s, %.0f publishes/s\n", BENCH_READER_COUNT,
+		(double)bench->iterations / seconds, (double)readers.publish_count / seconds);
+}
+
+// The update of hunger and sleep alone, for a million dwarves
+void bench_tick_kernel(Bench *bench, Tick_Kernel kernel)
+{
+	World *world = bench_world(1000000);
+	bench_start(bench);
+	for (U64 i = 0; i < bench->iterations; i++)
+		kernel(world, 0, world->dwarves.count);
+}
+
+void bench_tick_kernel_scalar(Bench *bench)
+{
+	bench_tick_kernel(bench, tick_kernel_scalar);
+}
+
+#if ARCH_SSE2
+
+void bench_tick_kernel_avx2(Bench *bench)
+{
+	if (!os_cpu_has_avx2()) {
+		bench->iterations = 0;
+		return;
+	}
+	bench_tick_kernel(bench, tick_kernel_avx2);
+}
+
+#endif
+
+// Ticks on one thread for world sizes from 64 to 10M dwarves. An iteration
+// is one dwarf ticked, so the time per iteration is the cost per dwarf,
+// which includes the fixed cost of a tick spread over the dwarves.
+void bench_tick_serial(Bench *bench, int dwarf_count)
+{
+	World *world = bench_world(dwarf_count);
+	U64 ticks = max(bench->iterations / (U64)dwarf_count, (U64)1);
+	bench->iterations = ticks * (U64)dwarf_count;
+	bench_start(bench);
+	for (U64 i = 0; i < ticks; i++)
+		world_tick(world, 0);
+}
+
+void bench_tick_serial_64(Bench *bench)
+{
+	bench_tick_serial(bench, 64);
+}
+
+void bench_tick_serial_1k(Bench *bench)
+{
+	bench_tick_serial(bench, 1000);
+}
+
+void bench_tick_serial_64k(Bench *bench)
+{
+	bench_tick_serial(bench, 64000);
+}
+
+void bench_tick_serial_1m(Bench *bench)
+{
+	bench_tick_serial(bench, 1000000);
+}
+
+void bench_tick_serial_10m(Bench *bench)
+{
+	bench_tick_serial(bench, 10000000);
+}
+
+// A tick of a million dwarves on the work pool, chunks of dwarves on every
+// worker
+void bench_tick_pool(Bench *bench)
+{
+	World *world = bench_world(1000000);
+	bench_start(bench);
+	for (U64 i = 0; i < bench->iterations; i++)
+		world_tick(world, &work_pool);
+}
+
+// Catching up a minute of a 10k-dwarf world, by events or tick by tick
+void bench_catch_up_events(Bench *bench)
+{
+	World *world = bench_world(10000);
+	world_start_events(world);
+	bench_start(bench);
+	for (U64 i = 0; i < bench->iterations; i++)
+		world_advance(world, 60);
+}
+
+void bench_catch_up_ticks(Bench *bench)
+{
+	World *world = bench_world(10000);
+	bench_start(bench);
+	for (U64 i = 0; i < bench->iterations; i++) {
+		for (int tick = 0; tick < 60; tick++)
+			world_tick(world, &work_pool);
+	}
+}
+
+Bench_Case bench_cases[] = {
+	{ "arena/recycle", bench_arena_recycle, 2000000 },
+	{ "arena/malloc", bench_arena_malloc, 2000000 },
+	{ "parse/legacy_sscanf", bench_parse_legacy, 1000000 },
+	{ "parse/scalar", bench_parse_scalar, 1000000 },
+#if ARCH_SSE2
+	{ "parse/sse2", bench_parse_sse2, 1000000 },
+	{ "parse/avx2", bench_parse_avx2, 1000000 },
+#endif
+	{ "route/match", bench_route, 10000000 },
+	{ "route/match_138_routes", bench_route_large_table, 10000000 },
+	{ "route/match_138_long", bench_route_large_paths, 10000000 },
+	{ "format/direct_64_rows", bench_format_direct, 200000 },
+	{ "format/snprintf_64_rows", bench_format_snprintf, 200000 },
+	{ "random/next64", bench_next64, 100000000 },
+	{ "random/series_from_key", bench_series_from_key, 20000000 },
+	{ "random/fill_scalar_4k", bench_random_fill_scalar, 20000 },
+#if ARCH_SSE2
+	{ "random/fill_avx2_4k", bench_random_fill_avx2, 20000 },
+#endif
+	{ "snapshot/acquire", bench_snapshot_acquire, 10000000 },
+	{ "snapshot/publish_100k", bench_snapshot_publish, 200 },
+	{ "snapshot/contended_10k", bench_snapshot_contended, 2000000 },
+	{ "tick/kernel_scalar_1m", bench_tick_kernel_scalar, 200 },
+#if ARCH_SSE2
+	{ "tick/kernel_avx2_1m", bench_tick_kernel_avx2, 200 },
+#endif
+	{ "tick/per_dwarf_64", bench_tick_serial_64, 50000000 },
+	{ "tick/per_dwarf_1k", bench_tick_serial_1k, 50000000 },
+	{ "tick/per_dwarf_64k", bench_tick_serial_64k, 50000000 },
+	{ "tick/per_dwarf_1m", bench_tick_serial_1m, 50000000 },
+	{ "tick/per_dwarf_10m", bench_tick_serial_10m, 50000000 },
+	{ "tick/pool_1m", bench_tick_pool, 50 },
+	{ "catch_up/events_10k", bench_catch_up_events, 1000 },
+	{ "catch_up/ticks_10k", bench_catch_up_ticks, 100 },
+};
+
+bool bench_selected(const char *name, int argc, char **argv)
+{
+	if (argc <= 1)
+		return true;
+	for (int i = 1; i < argc; i++) {
+		if (strstr(name, argv[i]))
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	os_startup();
+	arena_pool_init();
+	http_init();
+	random_init();
+	route_init();
+	world_tick_init();
+	http_status_lines_init();
+	work_pool_start(&work_pool, (int)os_cpu_count());
+	printf("Work pool of %u workers\n", work_pool.worker_count);
+
+	for (U32 i = 0; i < Count(bench_cases); i++) {
+		Bench_Case *bench_case = &bench_cases[i];
+		if (!bench_selected(bench_case->name, argc, argv))
+			continue;
+
+		Bench bench;
+		bench.iterations = bench_case->iterations;
+		bench.stopped = false;
+		bench_start(&bench);
+		bench_case->func(&bench);
+		if (!bench.stopped)
+			bench_stop(&bench);
+
+		if (bench.iterations == 0) {
+			printf("%-24s skipped\n", bench_case->name);
+			continue;
+		}
+		U64 ns = os_timer_ns(bench.end) - os_timer_ns(bench.begin);
+		printf("%-24s %10llu iterations %12.1f ns/iteration\n", bench_case->name,
+			(unsigned long long)bench.iterations, (double)ns / (double)bench.iterations);
+	}
+	return 0;
+}
@@ -7,7 +7,18 @@
 #include "platform_linux.cpp"
 #endif
 
+#include "arena.cpp"
+#include "output.cpp"
 #include "random.cpp"
+#include "work.cpp"
+#include "http.cpp"
+#include "route.cpp"
+#include "cache.cpp"
+#include "static.cpp"
+#include "post_log.cpp"
+#include "name_table.cpp"
 #include "dorf.cpp"
+#include "save.cpp"
+#include "history.cpp"
 #include "main.cpp"
 
@@ -0,0 +1,113 @@
+
+// Cache of rendered world pages. The world only changes once per tick, so a
+// page is stored as the complete response bytes along with the tick it was
+// rendered at, and served as is until the world moves on. Requests that hit
+// the cache don't touch the world at all.
+//
+// The cache is direct-mapped: a key always goes to the same slot and evicts
+// whatever was there. The slot lock is held while a stale page is rendered,
+// so concurrent misses wait for one render instead of all rendering.
+
+#define PAGE_CACHE_SLOTS 256
+
+// Immutable once stored
+struct Cached_Page
+{
+	Memory_Arena *arena;
+	const char *data;
+	size_t length;
+	U64 tick;
+	char etag[40];
+
+	// Number of responses using the page, plus one while it's cached
+	os_atomic_uint32 ref_count;
+};
+
+struct Page_Cache_Slot
+{
+	os_mutex lock;
+	U32 route;
+	U32 id;
+	Cached_Page *page;
+};
+
+struct Page_Cache
+{
+	Page_Cache_Slot slots[PAGE_CACHE_SLOTS];
+
+	os_atomic_uint32 hits;
+	os_atomic_uint32 misses;
+};
+
+void page_cache_init(Page_Cache *cache)
+{
+	for (U32 i = 0; i < PAGE_CACHE_SLOTS; i++) {
+		os_mutex_init(&cache->slots[i].lock);
+	}
+}
+
+// Returns a page with a single reference held by the caller, the response
+// is written to memory allocated from `page->arena`.
+Cached_Page *page_create()
+{
+	Memory_Arena *arena = arena_acquire();
+	Cached_Page *page = (Cached_Page*)arena_push(arena, sizeof(Cached_Page));
+	page->arena = arena;
+	page->data = 0;
+	page->length = 0;
+	page->tick = 0;
+	page->etag[0] = '\0';
+	page->ref_count = 1;
+	return page;
+}
+
+void page_release(Cached_Page *page)
+{
+	if (os_atomic_add(&page->ref_count, (U32)-1) == 1)
+		arena_release(page->arena);
+}
+
+// Looks up the page rendered for (`route`, `id`) at `tick`. On a hit the
+// page is returned with a reference for the caller. On a miss null is
+// returned and the slot is left locked, the caller needs to render the page
+// and pass it to `page_cache_store`.
+Cached_Page *page_cache_lookup(Page_Cache *cache, U32 route, U32 id, U64 tick,
+	Page_Cache_Slot **slot_ref)
+{
+	U32 hash = (route * 0x9E3779B1u) ^ (id * 0x85EBCA77u);
+	Page_Cache_Slot *slot = &cache->slots[(hash ^ (hash >> 16)) % PAGE_CACHE_SLOTS];
+
+	os_mutex_lock(&slot->lock);
+	Cached_Page *page = slot->page;
+	if (page && slot->route == route && slot->id == id && page->tick == tick) {
+		os_atomic_increment(&page->ref_count);
+		os_mutex_unlock(&slot->lock);
+		os_atomic_increment(&cache->hits);
+		return page;
+	}
+
+	os_atomic_increment(&cache->misses);
+	*slot_ref = slot;
+	return 0;
+}
+
+// Replaces the page of a slot locked by `page_cache_lookup` and unlocks it.
+// The caller keeps its reference to `page`.
+void page_cache_store(Page_Cache_Slot *slot, U32 route, U32 id, Cached_Page *page)
+{
+	Cached_Page *old = slot->page;
+	os_atomic_increment(&page->ref_count);
+	slot->route = route;
+	slot->id = id;
+	slot->page = page;
+	os_mutex_unlock(&slot->lock);
+
+	if (old)
+		page_release(old);
+}
+
+// Unlocks a slot locked by `page_cache_lookup` without replacing its page.
+void page_cache_cancel(Page_Cache_Slot *slot)
+{
+	os_mutex_unlock(&slot->lock);
+}
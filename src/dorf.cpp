@@ -15,24 +15,75 @@ struct Activity_Info
 	{ "Sleeping" },
 };
 
-struct Dwarf
+// Dwarves are stored as a structure of arrays so that ticking only streams
+// through the columns it needs. Internally a dwarf is referred to by its
+// index. The id shown to the outside world combines the index plus one with
+// the generation of the slot, which is bumped when a dwarf is removed and
+// the slot becomes free for reuse. Ids of removed dwarves then stop
+// resolving instead of pointing to the dwarf reusing the slot. Slots that
+// were never reused have generation 0, so their id is the index plus one.
+#define DWARF_INDEX_BITS 24
+#define DWARF_MAX_COUNT ((1u << DWARF_INDEX_BITS) - 1)
+
+#define DWARF_COLUMNS(X) \
+	/* Hot: read or written every tick */ \
+	X(I32, hunger) \
+	X(I32, sleep) \
+	X(U8, activity) \
+	X(bool, alive) \
+	X(U32, location) \
+	/* Cold */ \
+	/* Offset in `World::names` */ \
+	X(U32, name) \
+	X(U32, seed) \
+	/* Used by `world_advance`: hunger and sleep are current as of */ \
+	/* `state_tick`, until `next_event_tick` they change linearly. */ \
+	X(U64, state_tick) \
+	X(U64, next_event_tick) \
+	/* The tick the dwarf dies (or died) */ \
+	X(U64, death_tick) \
+	/* Links of the list of residents of the location, index plus one */ \
+	/* or zero */ \
+	X(U32, resident_prev) \
+	X(U32, resident_next) \
+	X(U8, generation) \
+	/* Sequence number plus one of the latest post by the dwarf in the */ \
+	/* post log, zero if none */ \
+	X(U64, last_post)
+
+struct Dwarves
 {
-	U32 id;
-	U32 location;
-	const char *name;
-	I32 hunger;
-	I32 sleep;
-	Activity activity;
-	bool alive;
-	U32 seed;
+	U32 count;
+	U32 capacity;
+
+#define DWARF_COLUMN_FIELD(type, name) type *name;
+	DWARF_COLUMNS(DWARF_COLUMN_FIELD)
+#undef DWARF_COLUMN_FIELD
 };
 
 struct Location
 {
 	U32 id;
-	const char *name;
+	U32 name;
 	bool has_food;
 	bool has_bed;
+
+	// Bumped when dwarves arrive, leave or change their activity here
+	U64 version;
+
+	// Linked list of the dwarves here, living or dead, in order of arrival
+	U32 first_resident;
+	U32 last_resident;
+	U32 resident_count;
+};
+
+// Ids of the locations with some capability in ascending order. Locations
+// never lose or gain capabilities, so the lists are only appended to.
+struct Location_List
+{
+	U32 *ids;
+	U32 count;
+	U32 capacity;
 };
 
 enum Post_Type
@@ -43,281 +94,1497 @@ enum Post_Type
 
 struct Post
 {
+	U64 tick;
 	U32 by_id;
 	Post_Type type;
 	U64 data;
 };
 
+// Posts shown per page of the feeds
+#define FEED_PAGE_SIZE 128
+
+struct Tick_Context;
+
+// Ticks ahead of the simulated tick whose events are kept in bitmaps
+#define EVENT_WINDOW 64
+
+// Event past the window, the tick is kept in the entry so ordering the heap
+// doesn't look up the columns of the dwarves
+struct Dwarf_Event
+{
+	U64 tick;
+	U32 index;
+};
+
 struct World
 {
-	Dwarf dwarves[64];
-	Location locations[64];
-	Post posts[128];
-	U32 post_index;
+	Dwarves dwarves;
+
+	// Prepended to the links of the rendered pages, the `/w/:world` prefix
+	// of the world or empty for the default world
+	const char *path_prefix;
+
+	// Shared by all the copies of the world. `names_end` is the end of the
+	// table when the world was copied, set by `world_copy`.
+	Name_Table *names;
+	U32 names_end;
+
+	// Indexed by id - 1
+	Location *locations;
+	U32 location_count;
+	U32 location_capacity;
+
+	// `Location_Flags` of every location indexed by id, so the tick kernel
+	// can look them up with a gather.
+	I32 *location_flags;
+
+	Location_List food_locations;
+	Location_List bed_locations;
+
+	// Shared by all the copies of the world, which can read the posts below
+	// their `post_count`. Can be null, then posts are dropped.
+	Post_Log *post_log;
+	U64 post_count;
+
+	// Set for worlds rebuilt from the history, their posts are already in
+	// the log and only get linked to
+	bool replay;
+
+	// Bumped by new posts and when a dwarf moves, changes its activity or
+	// dies, ie. whenever the lists of dwarves or posts change.
+	U64 version;
+
+	// Number of ticks simulated
+	U64 tick;
+
+	// Every living dwarf has one pending event for `world_advance`. Events
+	// in [event_window_tick, event_window_tick + EVENT_WINDOW) are bits in
+	// the bitmap of their tick, which lists the dwarves in index order.
+	// Later events are in a binary min-heap that has room for every dwarf.
+	U64 *event_bitmaps;
+	U32 event_bitmap_words;
+	U32 event_tick_counts[EVENT_WINDOW];
+	U32 event_window_count;
+	U64 event_window_tick;
+	Dwarf_Event *event_heap;
+	U32 event_count;
+
+	// Set while the events above are valid, from `world_start_events` on
+	// until the world is ticked with `world_tick`
+	bool events_active;
+
+	// Ids of the dead dwarves in order of death, removed once they have been
+	// dead for `DWARF_BURIAL_TICKS`, see `world_next_burial`
+	U32 *burials;
+	U32 burial_first;
+	U32 burial_end;
+	U32 burial_capacity;
+
+	// Indices of removed dwarves that can be reused
+	U32 *free_dwarves;
+	U32 free_dwarf_count;
+	U32 free_dwarf_capacity;
+
+	// Scratch `Tick_Flags` of every dwarf written by the tick kernel
+	U8 *tick_flags;
+
+	// Used by `world_tick` to tick chunks of dwarves in parallel, one
+	// context per chunk.
+	Work_Group tick_group;
+	Tick_Context *tick_contexts;
+	U32 tick_context_count;
+};
+
+enum Location_Flags
+{
+	Location_Food = 0x1,
+	Location_Bed = 0x2,
+};
+
+// Chance of a dwarf dying each tick
+#define DWARF_DEATH_CHANCE 1e-6
+
+// Ticks a dead dwarf stays in the world, so its page and its death can be
+// seen for a while, before its slot is freed for a new dwarf
+#define DWARF_BURIAL_TICKS 3600
+
+void dwarves_reserve(Dwarves *dwarves, U32 capacity)
+{
+	if (capacity <= dwarves->capacity)
+		return;
+
+#define DWARF_COLUMN_GROW(type, name) \
+	dwarves->name = (type*)realloc((void*)dwarves->name, capacity * sizeof(type));
+	DWARF_COLUMNS(DWARF_COLUMN_GROW)
+#undef DWARF_COLUMN_GROW
+
+	dwarves->capacity = capacity;
+}
+
+void world_init(World *world, Name_Table *names)
+{
+	memset(world, 0, sizeof(World));
+	world->path_prefix = "";
+	world->names = names;
+	work_group_init(&world->tick_group);
+}
+
+void location_list_add(Location_List *list, U32 id)
+{
+	if (list->count == list->capacity) {
+		list->capacity = max(list->capacity * 2, 16);
+		list->ids = (U32*)realloc(list->ids, list->capacity * sizeof(U32));
+	}
+	list->ids[list->count++] = id;
+}
+
+// Makes `dest` a copy of `src`, reusing the memory `dest` already has. The
+// copy can't be simulated, it has no event heap, capability lists or tick
+// scratch data.
+void world_copy(World *dest, World *src)
+{
+	dwarves_reserve(&dest->dwarves, src->dwarves.count);
+	dest->dwarves.count = src->dwarves.count;
+
+#define DWARF_COLUMN_COPY(type, name) \
+	memcpy((void*)dest->dwarves.name, (void*)src->dwarves.name, src->dwarves.count * sizeof(type));
+	DWARF_COLUMNS(DWARF_COLUMN_COPY)
+#undef DWARF_COLUMN_COPY
+
+	if (dest->location_capacity < src->location_count) {
+		dest->location_capacity = src->location_count;
+		dest->locations = (Location*)realloc(dest->locations,
+			dest->location_capacity * sizeof(Location));
+	}
+	dest->location_count = src->location_count;
+	memcpy(dest->locations, src->locations, src->location_count * sizeof(Location));
+
+	dest->post_log = src->post_log;
+	dest->post_count = src->post_count;
+	dest->replay = src->replay;
+	dest->path_prefix = src->path_prefix;
+	dest->names = src->names;
+	dest->names_end = src->names->end;
+	dest->version = src->version;
+	dest->tick = src->tick;
+	dest->event_bitmaps = 0;
+	dest->event_bitmap_words = 0;
+	dest->event_window_count = 0;
+	dest->event_heap = 0;
+	dest->event_count = 0;
+	dest->events_active = false;
+	dest->burials = 0;
+	dest->burial_first = 0;
+	dest->burial_end = 0;
+	dest->burial_capacity = 0;
+	dest->location_flags = 0;
+	memset(&dest->food_locations, 0, sizeof(Location_List));
+	memset(&dest->bed_locations, 0, sizeof(Location_List));
+	dest->free_dwarves = 0;
+	dest->free_dwarf_count = 0;
+	dest->free_dwarf_capacity = 0;
+	dest->tick_flags = 0;
+	dest->tick_contexts = 0;
+	dest->tick_context_count = 0;
+}
+
+void world_reserve_locations(World *world, U32 capacity)
+{
+	if (capacity <= world->location_capacity)
+		return;
+
+	world->location_capacity = capacity;
+	world->locations = (Location*)realloc(world->locations,
+		world->location_capacity * sizeof(Location));
+	world->location_flags = (I32*)realloc(world->location_flags,
+		(world->location_capacity + 1) * sizeof(I32));
+	world->location_flags[0] = 0;
+}
+
+// Adds the location to the flags and capability lists
+void world_index_location(World *world, Location *location)
+{
+	world->location_flags[location->id] = (location->has_food ? Location_Food : 0)
+		| (location->has_bed ? Location_Bed : 0);
+	if (location->has_food)
+		location_list_add(&world->food_locations, location->id);
+	if (location->has_bed)
+		location_list_add(&world->bed_locations, location->id);
+}
+
+U32 world_add_location(World *world, const char *name, bool has_food, bool has_bed)
+{
+	if (world->location_count == world->location_capacity)
+		world_reserve_locations(world, max(world->location_capacity * 2, 16));
+
+	Location *location = &world->locations[world->location_count++];
+	memset(location, 0, sizeof(Location));
+	location->id = world->location_count;
+	location->name = name_intern(world->names, name, (int)strlen(name));
+	location->has_food = has_food;
+	location->has_bed = has_bed;
+	world_index_location(world, location);
+	return location->id;
+}
+
+inline const char *dwarf_name(World *world, U32 index)
+{
+	return name_get(world->names, world->dwarves.name[index]);
+}
+
+inline const char *location_name(World *world, Location *location)
+{
+	return name_get(world->names, location->name);
+}
+
+inline U32 dwarf_id(World *world, U32 index)
+{
+	return ((U32)world->dwarves.generation[index] << DWARF_INDEX_BITS) | (index + 1);
+}
+
+// Free slots have no location
+inline bool dwarf_exists(World *world, U32 index)
+{
+	return world->dwarves.location[index] != 0;
+}
+
+// Appends the dwarf to the residents of the location
+void location_add_resident(World *world, U32 location_id, U32 index)
+{
+	Dwarves *dwarves = &world->dwarves;
+	Location *location = &world->locations[location_id - 1];
+
+	dwarves->resident_prev[index] = location->last_resident;
+	dwarves->resident_next[index] = 0;
+	if (location->last_resident)
+		dwarves->resident_next[location->last_resident - 1] = index + 1;
+	else
+		location->first_resident = index + 1;
+	location->last_resident = index + 1;
+	location->resident_count++;
+}
+
+void location_remove_resident(World *world, U32 location_id, U32 index)
+{
+	Dwarves *dwarves = &world->dwarves;
+	Location *location = &world->locations[location_id - 1];
+	U32 prev = dwarves->resident_prev[index];
+	U32 next = dwarves->resident_next[index];
+
+	if (prev) dwarves->resident_next[prev - 1] = next;
+	else location->first_resident = next;
+	if (next) dwarves->resident_prev[next - 1] = prev;
+	else location->last_resident = prev;
+	location->resident_count--;
+}
+
+// Makes room for `capacity` dwarves in the columns and the simulation data
+void world_reserve_dwarves(World *world, U32 capacity)
+{
+	Dwarves *dwarves = &world->dwarves;
+	if (capacity <= dwarves->capacity)
+		return;
+
+	dwarves_reserve(dwarves, capacity);
+	world->event_heap = (Dwarf_Event*)realloc(world->event_heap,
+		dwarves->capacity * sizeof(Dwarf_Event));
+
+	// Every bitmap keeps its bits, the new words are clear
+	U32 words = (capacity + 63) / 64;
+	U64 *bitmaps = (U64*)calloc(EVENT_WINDOW * words, sizeof(U64));
+	for (U32 i = 0; i < EVENT_WINDOW && world->event_bitmaps; i++) {
+		memcpy(bitmaps + i * words, world->event_bitmaps + i * world->event_bitmap_words,
+			world->event_bitmap_words * sizeof(U64));
+	}
+	free(world->event_bitmaps);
+	world->event_bitmaps = bitmaps;
+	world->event_bitmap_words = words;
+	world->tick_flags = (U8*)realloc(world->tick_flags, dwarves->capacity);
+}
+
+// Removes a dead dwarf, its slot is reused by the next dwarf added.
+void world_remove_dwarf(World *world, U32 index)
+{
+	Dwarves *dwarves = &world->dwarves;
+	assert(dwarf_exists(world, index) && !dwarves->alive[index]);
+
+	U32 location = dwarves->location[index];
+	location_remove_resident(world, location, index);
+	world->locations[location - 1].version++;
+	world->version++;
+
+	dwarves->location[index] = 0;
+	dwarves->generation[index]++;
 
+	if (world->free_dwarf_count == world->free_dwarf_capacity) {
+		world->free_dwarf_capacity = max(world->free_dwarf_capacity * 2, 16);
+		world->free_dwarves = (U32*)realloc(world->free_dwarves,
+			world->free_dwarf_capacity * sizeof(U32));
+	}
+	world->free_dwarves[world->free_dwarf_count++] = index;
+}
+
+void world_queue_burial(World *world, U32 id)
+{
+	if (world->burial_end == world->burial_capacity) {
+		// Reuse the room of the dwarves already buried before growing
+		U32 queued = world->burial_end - world->burial_first;
+		memmove(world->burials, world->burials + world->burial_first,
+			queued * sizeof(U32));
+		world->burial_first = 0;
+		world->burial_end = queued;
+		if (queued * 2 >= world->burial_capacity) {
+			world->burial_capacity = max(world->burial_capacity * 2, 16);
+			world->burials = (U32*)realloc(world->burials,
+				world->burial_capacity * sizeof(U32));
+		}
+	}
+	world->burials[world->burial_end++] = id;
+}
+
+// Returns false if there is no dwarf with the id, including when the dwarf
+// has been removed.
+inline bool find_dwarf(World *world, U32 id, U32 *index)
+{
+	U32 slot = id & DWARF_MAX_COUNT;
+	if (slot == 0 || slot > world->dwarves.count)
+		return false;
+	if (world->dwarves.generation[slot - 1] != id >> DWARF_INDEX_BITS
+			|| !dwarf_exists(world, slot - 1))
+		return false;
+	*index = slot - 1;
+	return true;
+}
+
+inline Location *find_location(World *world, U32 id)
+{
+	if (id == 0 || id > world->location_count)
+		return 0;
+	return &world->locations[id - 1];
+}
+
+// The location of a dwarf always exists
+inline Location *dwarf_location(World *world, U32 index)
+{
+	return &world->locations[world->dwarves.location[index] - 1];
+}
+
+struct Tick_Move
+{
+	U32 index;
+	U32 from, to;
+};
+
+// Changes to the world made while ticking dwarves, apart from the dwarves
+// themselves. Dwarves are ticked in chunks on different threads, each chunk
+// collects its posts and version bumps to a context of its own, and the
+// contexts are merged to the world in chunk order so the result doesn't
+// depend on the number of threads.
+struct Tick_Context
+{
+	World *world;
+
+	// Tick and stream of the dwarf being ticked, see `dwarf_random_series`
+	U64 tick;
 	Random_Series random_series;
+
+	Post *posts;
+	U32 post_count;
+	U32 post_capacity;
+
+	// Ids of locations to bump the version of, once per entry
+	U32 *touched_locations;
+	U32 touched_count;
+	U32 touched_capacity;
+
+	// Moves between locations to apply to the resident lists, in order
+	Tick_Move *moves;
+	U32 move_count;
+	U32 move_capacity;
+
+	U64 version_delta;
 };
 
-void world_post(World *world, U32 id, Post_Type type, U64 data)
+// Every dwarf draws from a stream of its own that is determined by its seed,
+// index and the tick, so the dwarves can be ticked in any order. The index
+// is part of the counter as seeds may collide.
+inline Random_Series dwarf_random_series(World *world, U32 index, U64 tick)
+{
+	return series_from_key(tick, index + 1, world->dwarves.seed[index]);
+}
+
+void tick_post(Tick_Context *ctx, U32 id, Post_Type type, U64 data)
 {
-	world->post_index = (world->post_index + 1) % Count(world->posts);
-	Post *post = &world->posts[world->post_index];
+	if (ctx->post_count == ctx->post_capacity) {
+		ctx->post_capacity = max(ctx->post_capacity * 2, 16);
+		ctx->posts = (Post*)realloc(ctx->posts, ctx->post_capacity * sizeof(Post));
+	}
+	Post *post = &ctx->posts[ctx->post_count++];
+	post->tick = ctx->tick;
 	post->by_id = id;
 	post->type = type;
 	post->data = data;
 }
 
-void dwarf_do_activity(World *world, Dwarf *dwarf, Activity activity)
+void tick_touch_location(Tick_Context *ctx, U32 location_id)
 {
-	Random_Series *rs = &world->random_series;
+	if (ctx->touched_count == ctx->touched_capacity) {
+		ctx->touched_capacity = max(ctx->touched_capacity * 2, 16);
+		ctx->touched_locations = (U32*)realloc(ctx->touched_locations,
+			ctx->touched_capacity * sizeof(U32));
+	}
+	ctx->touched_locations[ctx->touched_count++] = location_id;
+}
 
-	dwarf->activity = activity;
-	if (activity != Activity_Idle && next_one_in(rs, 100)) {
-		world_post(world, dwarf->id, Post_Activity, activity);
+void tick_move(Tick_Context *ctx, U32 index, U32 from, U32 to)
+{
+	if (ctx->move_count == ctx->move_capacity) {
+		ctx->move_capacity = max(ctx->move_capacity * 2, 16);
+		ctx->moves = (Tick_Move*)realloc(ctx->moves,
+			ctx->move_capacity * sizeof(Tick_Move));
 	}
+	Tick_Move *move = &ctx->moves[ctx->move_count++];
+	move->index = index;
+	move->from = from;
+	move->to = to;
 }
 
-const char *dwarf_status(Dwarf *dwarf)
+// Appends the post to the post log and the timeline of the dwarf.
+void world_post(World *world, Post *post)
 {
-	if (!dwarf->alive)
-		return "Dead";
-	return activity_infos[dwarf->activity].description;
+	world->version++;
+
+	U32 index;
+	if (!world->post_log || !find_dwarf(world, post->by_id, &index))
+		return;
+
+	if (world->replay) {
+		world->dwarves.last_post[index] = ++world->post_count;
+		return;
+	}
+
+	Post_Record record;
+	record.tick = post->tick;
+	record.by_id = post->by_id;
+	record.type = (U32)post->type;
+	record.data = post->data;
+	record.previous = world->dwarves.last_post[index];
+
+	U64 sequence;
+	if (post_log_append(world->post_log, &record, &sequence))
+		world->dwarves.last_post[index] = sequence + 1;
+	world->post_count = world->post_log->count;
 }
 
-void world_tick(World *world)
+// Starts writing posts to `log` and links the dwarves to their latest posts
+// already in the log. A world loaded from a save already links the posts
+// below its `post_count`, unless the log has been lost since.
+void world_attach_post_log(World *world, Post_Log *log)
 {
-	Random_Series *rs = &world->random_series;
+	if (world->post_count > log->count) {
+		for (U32 i = 0; i < world->dwarves.count; i++)
+			world->dwarves.last_post[i] = 0;
+		world->post_count = 0;
+	}
 
-	for (U32 i = 0; i < Count(world->dwarves); i++) {
-		Dwarf *dwarf = &world->dwarves[i];
-		if (!dwarf->id || !dwarf->alive)
-			continue;
+	world->post_log = log;
+	U64 first = world->post_count;
+	world->post_count = log->count;
+	for (U64 sequence = first; sequence < log->count; sequence++) {
+		U32 index;
+		if (find_dwarf(world, post_log_get(log, sequence)->by_id, &index))
+			world->dwarves.last_post[index] = sequence + 1;
+	}
+}
 
-		Location *location = &world->locations[dwarf->location];
+void tick_contexts_reserve(World *world, U32 count)
+{
+	if (world->tick_context_count >= count)
+		return;
 
-		dwarf->hunger++;
-		dwarf->sleep++;
-		
-		switch (dwarf->activity) {
+	world->tick_contexts = (Tick_Context*)realloc(world->tick_contexts,
+		count * sizeof(Tick_Context));
+	for (U32 i = world->tick_context_count; i < count; i++) {
+		memset(&world->tick_contexts[i], 0, sizeof(Tick_Context));
+		world->tick_contexts[i].world = world;
+	}
+	world->tick_context_count = count;
+}
 
-		case Activity_Idle:
-			if (dwarf->sleep > 50) {
-				dwarf_do_activity(world, dwarf, Activity_Sleep);
-			} else if (dwarf->hunger > 50) {
-				dwarf_do_activity(world, dwarf, Activity_Eat);
-			}
-			break;
+// Applies the changes collected to `ctx` to the world and clears it.
+void tick_context_merge(World *world, Tick_Context *ctx)
+{
+	for (U32 i = 0; i < ctx->post_count; i++) {
+		world_post(world, &ctx->posts[i]);
+		if (ctx->posts[i].type == Post_Death)
+			world_queue_burial(world, ctx->posts[i].by_id);
+	}
+	for (U32 i = 0; i < ctx->touched_count; i++) {
+		world->locations[ctx->touched_locations[i] - 1].version++;
+	}
+	for (U32 i = 0; i < ctx->move_count; i++) {
+		Tick_Move *move = &ctx->moves[i];
+		location_remove_resident(world, move->from, move->index);
+		location_add_resident(world, move->to, move->index);
+	}
+	world->version += ctx->version_delta;
 
-		case Activity_Eat:
-			if (location->has_food) {
-				dwarf->hunger -= 3;
-			} else {
-				for (U32 i = 0; i < Count(world->locations); i++) {
-					Location *new_location = &world->locations[i];
-					if (new_location->id && new_location->has_food) {
-						dwarf->location = new_location->id;
-						break;
-					}
-				}
-			}
-			if (dwarf->hunger < 5) {
-				dwarf_do_activity(world, dwarf, Activity_Idle);
-			}
-			break;
+	ctx->post_count = 0;
+	ctx->touched_count = 0;
+	ctx->move_count = 0;
+	ctx->version_delta = 0;
+}
 
-		case Activity_Sleep:
-			if (location->has_bed) {
-				dwarf->sleep -= 3;
-			} else {
-				for (U32 i = 0; i < Count(world->locations); i++) {
-					Location *new_location = &world->locations[i];
-					if (new_location->id && new_location->has_bed) {
-						dwarf->location = new_location->id;
-						break;
-					}
-				}
-			}
-			if (dwarf->sleep < 5) {
-				dwarf_do_activity(world, dwarf, Activity_Idle);
-			}
-			break;
+void dwarf_do_activity(Tick_Context *ctx, U32 index, Activity activity)
+{
+	ctx->world->dwarves.activity[index] = (U8)activity;
+	if (activity != Activity_Idle && next_one_in(&ctx->random_series, 100)) {
+		tick_post(ctx, dwarf_id(ctx->world, index), Post_Activity, activity);
+	}
+}
+
+const char *dwarf_status(World *world, U32 index)
+{
+	if (!world->dwarves.alive[index])
+		return "Dead";
+	return activity_infos[world->dwarves.activity[index]].description;
+}
+
+// Returns the first location with food or a bed, or null if there is none.
+Location *find_location_with(World *world, bool food, bool bed)
+{
+	U32 id = 0;
+	if (food && world->food_locations.count > 0)
+		id = world->food_locations.ids[0];
+	if (bed && world->bed_locations.count > 0 && (!id || world->bed_locations.ids[0] < id))
+		id = world->bed_locations.ids[0];
+	return id ? &world->locations[id - 1] : 0;
+}
+
+// Advances the dwarf by one tick, apart from rolling for death.
+void dwarf_tick(Tick_Context *ctx, U32 index)
+{
+	World *world = ctx->world;
+	Dwarves *dwarves = &world->dwarves;
+	Location *location = dwarf_location(world, index);
+	U32 old_location = dwarves->location[index];
+	U8 old_activity = dwarves->activity[index];
+
+	I32 hunger = ++dwarves->hunger[index];
+	I32 sleep = ++dwarves->sleep[index];
 
+	switch (dwarves->activity[index]) {
+
+	case Activity_Idle:
+		if (sleep > 50) {
+			dwarf_do_activity(ctx, index, Activity_Sleep);
+		} else if (hunger > 50) {
+			dwarf_do_activity(ctx, index, Activity_Eat);
+		}
+		break;
+
+	case Activity_Eat:
+		if (location->has_food) {
+			hunger = dwarves->hunger[index] -= 3;
+		} else {
+			Location *new_location = find_location_with(world, true, false);
+			if (new_location)
+				dwarves->location[index] = new_location->id;
 		}
+		if (hunger < 5) {
+			dwarf_do_activity(ctx, index, Activity_Idle);
+		}
+		break;
 
-		// TODO: Support more precision, now the chance is
-		// 1:1000 and 1:1000 = 1:1000*1000 = 1:1000000
-		if (next_one_in(rs, 1000) && next_one_in(rs, 1000)) {
-			world_post(world, dwarf->id, Post_Death, 0);
-			dwarf->alive = false;
+	case Activity_Sleep:
+		if (location->has_bed) {
+			sleep = dwarves->sleep[index] -= 3;
+		} else {
+			Location *new_location = find_location_with(world, false, true);
+			if (new_location)
+				dwarves->location[index] = new_location->id;
+		}
+		if (sleep < 5) {
+			dwarf_do_activity(ctx, index, Activity_Idle);
 		}
+		break;
+
 	}
+
+	if (dwarves->location[index] != old_location)
+		tick_move(ctx, index, old_location, dwarves->location[index]);
+	if (dwarves->location[index] != old_location || dwarves->activity[index] != old_activity) {
+		ctx->version_delta++;
+		tick_touch_location(ctx, old_location);
+		tick_touch_location(ctx, dwarves->location[index]);
+	}
+}
+
+void dwarf_die(Tick_Context *ctx, U32 index, U64 tick)
+{
+	Dwarves *dwarves = &ctx->world->dwarves;
+	tick_post(ctx, dwarf_id(ctx->world, index), Post_Death, 0);
+	dwarves->alive[index] = false;
+	dwarves->death_tick[index] = tick;
+	tick_touch_location(ctx, dwarves->location[index]);
 }
 
-int render_dwarves(World *world, char *buffer)
+// `world_tick` runs in two passes over each chunk of dwarves. First a kernel
+// updates hunger, sleep and activity, which doesn't need random numbers and
+// can be vectorized. Then the posts and deaths are rolled from the streams
+// of the dwarves, so the result is the same as with ticking one dwarf at a
+// time.
+
+enum Tick_Flags
 {
-	char *ptr = buffer;
-	ptr += sprintf(ptr, "<html><head><title>Dwarves</title></head>");
-	ptr += sprintf(ptr, "<body><table><tr><th>Avatar</th><th>Name</th>");
-	ptr += sprintf(ptr, "<th>Location</th><th>Activity</th></tr>");
-	for (U32 i = 0; i < Count(world->dwarves); i++) {
-		Dwarf *dwarf = &world->dwarves[i];
-		if (dwarf->id == 0)
+	// The activity changed, so the change may need to be posted
+	Tick_Changed = 0x1,
+
+	// The dwarf needs to move, left to `dwarf_tick` by the kernel
+	Tick_Slow = 0x2,
+};
+
+typedef void (*Tick_Kernel)(World *world, U32 begin, U32 end);
+
+void tick_kernel_scalar(World *world, U32 begin, U32 end)
+{
+	Dwarves *dwarves = &world->dwarves;
+	I32 *location_flags = world->location_flags;
+
+	for (U32 i = begin; i < end; i++) {
+		world->tick_flags[i] = 0;
+		if (!dwarves->alive[i])
 			continue;
-		Location *location = &world->locations[dwarf->location];
 
-		ptr += sprintf(ptr, "<tr><td><img src=\"/entities/%d/avatar.svg\" "
-			"width=\"50\" height=\"50\"></td>", dwarf->id);
-		ptr += sprintf(ptr, "<td><a href=\"/entities/%d\">%s</a></td>",
-			dwarf->id, dwarf->name);
-		ptr += sprintf(ptr, "<td><a href=\"/locations/%d\">%s</a></td>",
-			location->id, location->name);
-		ptr += sprintf(ptr, "<td>%s</td></tr>\n",
-			dwarf_status(dwarf));
+		I32 flags = location_flags[dwarves->location[i]];
+		U8 activity = dwarves->activity[i];
+		if ((activity == Activity_Eat && !(flags & Location_Food))
+				|| (activity == Activity_Sleep && !(flags & Location_Bed))) {
+			world->tick_flags[i] = Tick_Slow;
+			continue;
+		}
+
+		I32 hunger = dwarves->hunger[i] + 1;
+		I32 sleep = dwarves->sleep[i] + 1;
+		U8 new_activity = activity;
+
+		if (activity == Activity_Idle) {
+			if (sleep > 50)
+				new_activity = Activity_Sleep;
+			else if (hunger > 50)
+				new_activity = Activity_Eat;
+		} else if (activity == Activity_Eat) {
+			hunger -= 3;
+			if (hunger < 5)
+				new_activity = Activity_Idle;
+		} else {
+			sleep -= 3;
+			if (sleep < 5)
+				new_activity = Activity_Idle;
+		}
+
+		dwarves->hunger[i] = hunger;
+		dwarves->sleep[i] = sleep;
+		dwarves->activity[i] = new_activity;
+		if (new_activity != activity)
+			world->tick_flags[i] = Tick_Changed;
 	}
-	ptr += sprintf(ptr, "</table></body></html>\n");
+}
 
-	return 200;
+#if ARCH_SSE2
+
+// Packs the low bytes of 8 lanes to memory
+TARGET_AVX2
+inline void store_u8x8(U8 *dest, __m256i value)
+{
+	__m128i words = _mm_packs_epi32(_mm256_castsi256_si128(value),
+		_mm256_extracti128_si256(value, 1));
+	_mm_storel_epi64((__m128i*)dest, _mm_packus_epi16(words, words));
 }
 
-int render_feed(World *world, char *buffer)
+TARGET_AVX2
+inline __m256i load_u8x8(const U8 *src)
 {
-	char *ptr = buffer;
-	ptr += sprintf(ptr, "<html><head><title>Activity feed</title></head>");
-	ptr += sprintf(ptr, "<body><ul>\n");
-	for (U32 i = 0; i < Count(world->posts); i++) {
-		Post *post = &world->posts[i];
-		if (post->by_id == 0)
-			continue;
+	return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src));
+}
+
+// Same as `tick_kernel_scalar` for 8 dwarves at a time
+TARGET_AVX2
+void tick_kernel_avx2(World *world, U32 begin, U32 end)
+{
+	Dwarves *dwarves = &world->dwarves;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i two = _mm256_set1_epi32(2);
+	const __m256i three = _mm256_set1_epi32(3);
+	const __m256i five = _mm256_set1_epi32(5);
+	const __m256i fifty = _mm256_set1_epi32(50);
+	const __m256i food = _mm256_set1_epi32(Location_Food);
+	const __m256i bed = _mm256_set1_epi32(Location_Bed);
+
+	U32 i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256i alive = _mm256_cmpgt_epi32(load_u8x8((const U8*)&dwarves->alive[i]), zero);
+		__m256i activity = load_u8x8(&dwarves->activity[i]);
+		__m256i location = _mm256_loadu_si256((const __m256i*)&dwarves->location[i]);
+		__m256i flags = _mm256_i32gather_epi32((const int*)world->location_flags, location, 4);
+
+		__m256i idle = _mm256_cmpeq_epi32(activity, zero);
+		__m256i eat = _mm256_cmpeq_epi32(activity, one);
+		__m256i sleep_activity = _mm256_cmpeq_epi32(activity, two);
+		__m256i has_food = _mm256_cmpeq_epi32(_mm256_and_si256(flags, food), food);
+		__m256i has_bed = _mm256_cmpeq_epi32(_mm256_and_si256(flags, bed), bed);
+
+		__m256i slow = _mm256_or_si256(_mm256_andnot_si256(has_food, eat),
+			_mm256_andnot_si256(has_bed, sleep_activity));
+		slow = _mm256_and_si256(slow, alive);
+		__m256i update = _mm256_andnot_si256(slow, alive);
+
+		__m256i old_hunger = _mm256_loadu_si256((const __m256i*)&dwarves->hunger[i]);
+		__m256i old_sleep = _mm256_loadu_si256((const __m256i*)&dwarves->sleep[i]);
+		__m256i hunger = _mm256_add_epi32(old_hunger, one);
+		__m256i sleep = _mm256_add_epi32(old_sleep, one);
+
+		// Eating and sleeping where possible
+		hunger = _mm256_sub_epi32(hunger, _mm256_and_si256(eat, three));
+		sleep = _mm256_sub_epi32(sleep, _mm256_and_si256(sleep_activity, three));
+
+		__m256i to_sleep = _mm256_and_si256(idle, _mm256_cmpgt_epi32(sleep, fifty));
+		__m256i to_eat = _mm256_andnot_si256(to_sleep,
+			_mm256_and_si256(idle, _mm256_cmpgt_epi32(hunger, fifty)));
+		__m256i to_idle = _mm256_or_si256(
+			_mm256_and_si256(eat, _mm256_cmpgt_epi32(five, hunger)),
+			_mm256_and_si256(sleep_activity, _mm256_cmpgt_epi32(five, sleep)));
+
+		__m256i new_activity = _mm256_andnot_si256(to_idle, activity);
+		new_activity = _mm256_blendv_epi8(new_activity, two, to_sleep);
+		new_activity = _mm256_blendv_epi8(new_activity, one, to_eat);
+		new_activity = _mm256_blendv_epi8(activity, new_activity, update);
+
+		__m256i changed = _mm256_and_si256(update,
+			_mm256_or_si256(_mm256_or_si256(to_sleep, to_eat), to_idle));
+		__m256i tick_flags = _mm256_or_si256(_mm256_and_si256(changed, one),
+			_mm256_and_si256(slow, two));
+
+		_mm256_storeu_si256((__m256i*)&dwarves->hunger[i],
+			_mm256_blendv_epi8(old_hunger, hunger, update));
+		_mm256_storeu_si256((__m256i*)&dwarves->sleep[i],
+			_mm256_blendv_epi8(old_sleep, sleep, update));
+		store_u8x8(&dwarves->activity[i], new_activity);
+		store_u8x8(&world->tick_flags[i], tick_flags);
+	}
+
+	// Like `http_scan_avx2`, the scalar tail would run with dirty upper
+	// halves otherwise
+	_mm256_zeroupper();
+	tick_kernel_scalar(world, i, end);
+}
+
+#endif
+
+Tick_Kernel tick_kernel = tick_kernel_scalar;
+
+// Picks the widest tick kernel the CPU supports.
+void world_tick_init()
+{
+#if ARCH_SSE2
+	if (os_cpu_has_avx2())
+		tick_kernel = tick_kernel_avx2;
+#endif
+}
+
+// Dwarves ticked by one task of `world_tick`. Fixed so that the chunks and
+// the order of merging them don't depend on the number of threads.
+#define TICK_CHUNK_SIZE 16384
+
+// Dwarves to generate random numbers for at once
+#define TICK_RANDOM_BATCH 256
+
+void tick_chunk(void *world_ptr, U32 begin, U32 end)
+{
+	World *world = (World*)world_ptr;
+	Dwarves *dwarves = &world->dwarves;
+	Tick_Context *ctx = &world->tick_contexts[begin / TICK_CHUNK_SIZE];
+	U64 tick = world->tick + 1;
+	ctx->tick = tick;
 
-		Dwarf *dwarf = 0;
-		for (U32 j = 0; j < Count(world->dwarves); j++) {
-			if (world->dwarves[j].id == post->by_id)
-				dwarf = &world->dwarves[j];
+	tick_kernel(world, begin, end);
+
+	// Same streams as `dwarf_random_series`, generated in bulk
+	U32 randoms[4 * TICK_RANDOM_BATCH];
+
+	for (U32 i = begin; i < end; i++) {
+		U32 batch_index = (i - begin) % TICK_RANDOM_BATCH;
+		if (batch_index == 0) {
+			U32 batch_count = min(end - i, TICK_RANDOM_BATCH);
+			random_fill(tick, i + 1, &dwarves->seed[i], randoms, 4 * batch_count);
 		}
-		if (!dwarf)
+
+		if (!dwarves->alive[i])
 			continue;
 
-		ptr += sprintf(ptr, "<li><a href=\"/entities/%d\">%s</a>:", dwarf->id, dwarf->name);
-		
-		switch (post->type) {
+		ctx->random_series = series_from_block(&randoms[4 * batch_index]);
+		Random_Series *rs = &ctx->random_series;
+
+		U8 flags = world->tick_flags[i];
+		if (flags & Tick_Slow) {
+			dwarf_tick(ctx, i);
+		} else if (flags & Tick_Changed) {
+			// Same as `dwarf_tick` does for an activity change in place
+			ctx->version_delta++;
+			tick_touch_location(ctx, dwarves->location[i]);
+			tick_touch_location(ctx, dwarves->location[i]);
+
+			U8 activity = dwarves->activity[i];
+			if (activity != Activity_Idle && next_one_in(rs, 100))
+				tick_post(ctx, dwarf_id(world, i), Post_Activity, activity);
+		}
+
+		if (next_chance(rs, DWARF_DEATH_CHANCE))
+			dwarf_die(ctx, i, tick);
+	}
+}
+
+// Ticks the chunks of dwarves on the workers of `pool`, or on the calling
+// thread if it's null. Only the dwarves of a chunk are written while
+// ticking it, everything else goes through its context.
+void world_tick(World *world, Work_Pool *pool)
+{
+	world->events_active = false;
+
+	U32 count = world->dwarves.count;
+	U32 chunk_count = (count + TICK_CHUNK_SIZE - 1) / TICK_CHUNK_SIZE;
+	tick_contexts_reserve(world, chunk_count);
 
-		case Post_Activity:
-			ptr += sprintf(ptr, "I will go %s", activity_infos[post->data].description);
+	work_parallel_for(pool, &world->tick_group, count, TICK_CHUNK_SIZE,
+		tick_chunk, world);
+
+	for (U32 i = 0; i < chunk_count; i++) {
+		tick_context_merge(world, &world->tick_contexts[i]);
+	}
+	world->tick++;
+}
+
+// Event-driven simulation. Between state changes the hunger and sleep of a
+// dwarf change by a constant amount per tick, so instead of ticking every
+// dwarf every tick, each dwarf is only ticked at its next state change (or
+// death, which is sampled ahead of time). Catching up any number of ticks
+// then costs in proportion to the number of events.
+//
+// The results follow the same rules as `world_tick` and activities are
+// posted from the same streams, but as deaths are sampled differently the
+// two don't produce the same world from the same seed.
+
+// How much hunger and sleep change per tick with the current activity,
+// as long as the activity doesn't change.
+void dwarf_rates(World *world, U32 index, I32 *hunger_rate, I32 *sleep_rate)
+{
+	Location *location = dwarf_location(world, index);
+	U8 activity = world->dwarves.activity[index];
+	*hunger_rate = 1;
+	*sleep_rate = 1;
+	if (activity == Activity_Eat && location->has_food)
+		*hunger_rate = -2;
+	else if (activity == Activity_Sleep && location->has_bed)
+		*sleep_rate = -2;
+}
+
+// Brings hunger and sleep up to date at `tick`, which must not be past the
+// next event of the dwarf.
+void dwarf_catch_up(World *world, U32 index, U64 tick)
+{
+	Dwarves *dwarves = &world->dwarves;
+	I32 hunger_rate, sleep_rate;
+	dwarf_rates(world, index, &hunger_rate, &sleep_rate);
+
+	I32 elapsed = (I32)(tick - dwarves->state_tick[index]);
+	dwarves->hunger[index] += hunger_rate * elapsed;
+	dwarves->sleep[index] += sleep_rate * elapsed;
+	dwarves->state_tick[index] = tick;
+}
+
+// Returns the number of ticks after `state_tick` until the dwarf next does
+// something else than following its rates.
+U64 dwarf_ticks_to_event(World *world, U32 index)
+{
+	Location *location = dwarf_location(world, index);
+	I32 hunger = world->dwarves.hunger[index];
+	I32 sleep = world->dwarves.sleep[index];
+
+	switch (world->dwarves.activity[index]) {
+
+	case Activity_Idle:
+		// Goes to sleep or eat the tick either goes over 50
+		return (U64)min(max(51 - sleep, 1), max(51 - hunger, 1));
+
+	case Activity_Eat:
+		// Moves to food the next tick if there is any
+		if (!location->has_food)
+			return find_location_with(world, true, false) ? 1 : UINT64_MAX;
+		// Stops eating the tick hunger goes below 5
+		return hunger >= 5 ? (U64)((hunger - 5) / 2 + 1) : 1;
+
+	case Activity_Sleep:
+		if (!location->has_bed)
+			return find_location_with(world, false, true) ? 1 : UINT64_MAX;
+		return sleep >= 5 ? (U64)((sleep - 5) / 2 + 1) : 1;
+
+	}
+	return 1;
+}
+
+inline U64 dwarf_event_tick(World *world, U32 index)
+{
+	return min(world->dwarves.next_event_tick[index], world->dwarves.death_tick[index]);
+}
+
+// Events past the window wait in a heap ordered by tick
+inline bool event_before(Dwarf_Event a, Dwarf_Event b)
+{
+	return a.tick < b.tick || (a.tick == b.tick && a.index < b.index);
+}
+
+void event_heap_push(World *world, Dwarf_Event event)
+{
+	Dwarf_Event *heap = world->event_heap;
+	U32 pos = world->event_count++;
+	while (pos > 0) {
+		U32 parent = (pos - 1) / 2;
+		if (!event_before(event, heap[parent]))
 			break;
+		heap[pos] = heap[parent];
+		pos = parent;
+	}
+	heap[pos] = event;
+}
 
-		case Post_Death:
-			ptr += sprintf(ptr, "Died suddenly");
+void event_heap_pop(World *world)
+{
+	Dwarf_Event *heap = world->event_heap;
+	Dwarf_Event last = heap[--world->event_count];
+
+	U32 pos = 0;
+	for (;;) {
+		U32 child = pos * 2 + 1;
+		if (child >= world->event_count)
+			break;
+		if (child + 1 < world->event_count && event_before(heap[child + 1], heap[child]))
+			child++;
+		if (!event_before(heap[child], last))
 			break;
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	heap[pos] = last;
+}
+
+inline U64 *event_bitmap(World *world, U64 tick)
+{
+	return world->event_bitmaps + (tick % EVENT_WINDOW) * world->event_bitmap_words;
+}
+
+void event_add(World *world, U32 index, U64 tick)
+{
+	if (tick < world->event_window_tick + EVENT_WINDOW) {
+		U64 *bitmap = event_bitmap(world, tick);
+		bitmap[index / 64] |= (U64)1 << (index % 64);
+		world->event_tick_counts[tick % EVENT_WINDOW]++;
+		world->event_window_count++;
+	} else {
+		Dwarf_Event event;
+		event.tick = tick;
+		event.index = index;
+		event_heap_push(world, event);
+	}
+}
+
+// Moves the window to start at `tick`, which must not skip over any events
+// in it, and takes in the events from the heap that fall in it.
+void event_window_move(World *world, U64 tick)
+{
+	world->event_window_tick = tick;
+	while (world->event_count > 0
+			&& world->event_heap[0].tick < tick + EVENT_WINDOW) {
+		Dwarf_Event event = world->event_heap[0];
+		event_heap_pop(world);
+		event_add(world, event.index, event.tick);
+	}
+}
+
+void events_clear(World *world)
+{
+	memset(world->event_bitmaps, 0,
+		EVENT_WINDOW * world->event_bitmap_words * sizeof(U64));
+	memset(world->event_tick_counts, 0, sizeof(world->event_tick_counts));
+	world->event_window_count = 0;
+	world->event_window_tick = world->tick + 1;
+	world->event_count = 0;
+}
+
+void dwarf_schedule(World *world, U32 index)
+{
+	U64 ticks = dwarf_ticks_to_event(world, index);
+	U64 state_tick = world->dwarves.state_tick[index];
+	world->dwarves.next_event_tick[index] = ticks == UINT64_MAX
+		? UINT64_MAX : state_tick + ticks;
+	event_add(world, index, dwarf_event_tick(world, index));
+}
+
+// Samples the death and schedules the first event of a living dwarf
+void dwarf_start_events(World *world, U32 index)
+{
+	Dwarves *dwarves = &world->dwarves;
+	Random_Series rs = dwarf_random_series(world, index, world->tick);
+	dwarves->state_tick[index] = world->tick;
+	dwarves->death_tick[index] = world->tick + next_geometric(&rs, DWARF_DEATH_CHANCE);
+	dwarf_schedule(world, index);
+}
+
+// Samples the deaths and schedules the first events of all the living
+// dwarves, needs to be called before `world_advance`.
+void world_start_events(World *world)
+{
+	events_clear(world);
+	world->events_active = true;
+	for (U32 i = 0; i < world->dwarves.count; i++) {
+		if (world->dwarves.alive[i])
+			dwarf_start_events(world, i);
+	}
+}
+
+// Schedules the living dwarves at the events they already have, for worlds
+// loaded from a save made by `world_advance`. Resampling the deaths would
+// make the world diverge from one that was never saved.
+void world_rebuild_events(World *world)
+{
+	Dwarves *dwarves = &world->dwarves;
+
+	events_clear(world);
+	world->events_active = true;
+	for (U32 i = 0; i < dwarves->count; i++) {
+		if (dwarves->alive[i])
+			event_add(world, i, dwarf_event_tick(world, i));
+	}
+}
+
+U32 world_add_dwarf(World *world, const char *name, U32 location, I32 hunger,
+	I32 sleep, U32 seed)
+{
+	Dwarves *dwarves = &world->dwarves;
+	if (dwarves->count == dwarves->capacity)
+		world_reserve_dwarves(world, max(dwarves->capacity * 2, 64));
+
+	U32 i;
+	if (world->free_dwarf_count > 0) {
+		i = world->free_dwarves[--world->free_dwarf_count];
+	} else {
+		assert(dwarves->count < DWARF_MAX_COUNT);
+		i = dwarves->count++;
+		dwarves->generation[i] = 0;
+	}
+
+	dwarves->hunger[i] = hunger;
+	dwarves->sleep[i] = sleep;
+	dwarves->activity[i] = Activity_Idle;
+	dwarves->alive[i] = true;
+	dwarves->location[i] = location;
+	dwarves->name[i] = name_intern(world->names, name, (int)strlen(name));
+	dwarves->seed[i] = seed;
+	dwarves->state_tick[i] = world->tick;
+	dwarves->next_event_tick[i] = UINT64_MAX;
+	dwarves->death_tick[i] = UINT64_MAX;
+	dwarves->last_post[i] = 0;
+	location_add_resident(world, location, i);
+
+	// Joins the simulation as if it had been there when the events started
+	if (world->events_active)
+		dwarf_start_events(world, i);
+	return dwarf_id(world, i);
+}
 
+// Returns the next dead dwarf that is due to be removed with
+// `world_remove_dwarf`, false if there is none yet. Removing the dwarves is
+// left to the caller, so it can journal the removals.
+bool world_next_burial(World *world, U32 *index)
+{
+	while (world->burial_first < world->burial_end) {
+		U32 id = world->burials[world->burial_first];
+		U32 next;
+		if (find_dwarf(world, id, &next) && !world->dwarves.alive[next]) {
+			if (world->dwarves.death_tick[next] + DWARF_BURIAL_TICKS > world->tick)
+				return false;
+			world->burial_first++;
+			*index = next;
+			return true;
 		}
-		ptr += sprintf(ptr, "</li>\n");
+
+		// Already removed by someone else
+		world->burial_first++;
 	}
-	ptr += sprintf(ptr, "</ul></body></html>\n");
+	return false;
+}
 
-	return 200;
+int dwarf_event_compare(const void *a, const void *b)
+{
+	const Dwarf_Event *x = (const Dwarf_Event*)a, *y = (const Dwarf_Event*)b;
+	if (x->tick != y->tick)
+		return x->tick < y->tick ? -1 : 1;
+	return x->index < y->index ? -1 : x->index > y->index;
 }
 
-int render_entity(World *world, U32 id, char *buffer)
+// Queues the dead dwarves of a loaded world for burial, in the order they
+// died like `tick_context_merge` would have queued them
+void world_rebuild_burials(World *world)
 {
-	char *ptr = buffer;
-	Dwarf *dwarf = 0;
-	for (U32 i = 0; i < Count(world->dwarves); i++) {
-		if (world->dwarves[i].id == id) {
-			dwarf = &world->dwarves[i];
-			break;
+	Dwarves *dwarves = &world->dwarves;
+	Dwarf_Event *dead = (Dwarf_Event*)malloc((dwarves->count + 1) * sizeof(Dwarf_Event));
+	U32 dead_count = 0;
+	for (U32 i = 0; i < dwarves->count; i++) {
+		if (dwarf_exists(world, i) && !dwarves->alive[i]) {
+			dead[dead_count].tick = dwarves->death_tick[i];
+			dead[dead_count].index = i;
+			dead_count++;
 		}
 	}
+	qsort(dead, dead_count, sizeof(Dwarf_Event), dwarf_event_compare);
 
-	if (!dwarf) {
-		sprintf(buffer, "Entity not found with ID #%u", id);
-		return 404;
+	world->burial_first = 0;
+	world->burial_end = 0;
+	for (U32 i = 0; i < dead_count; i++)
+		world_queue_burial(world, dwarf_id(world, dead[i].index));
+	free(dead);
+}
+
+// Runs the event of the dwarf at `tick` like `world_tick` would
+void dwarf_handle_event(World *world, Tick_Context *ctx, U32 index, U64 tick)
+{
+	Dwarves *dwarves = &world->dwarves;
+	ctx->tick = tick;
+	ctx->random_series = dwarf_random_series(world, index, tick);
+	dwarf_catch_up(world, index, tick - 1);
+	dwarf_tick(ctx, index);
+	dwarves->state_tick[index] = tick;
+
+	if (tick == dwarves->death_tick[index])
+		dwarf_die(ctx, index, tick);
+	else
+		dwarf_schedule(world, index);
+}
+
+// Advances the world by `ticks` ticks, handling only the ticks where
+// something happens. Nothing reads the posts or versions while advancing,
+// so the changes are collected to one context and merged at the end.
+//
+// Compared to `world_tick` from the same world, every dwarf alive in both
+// ends up in the same state with the same activity posts at the same ticks,
+// which the modes/agree test checks. Which dwarves die and when differs, so
+// the worlds as a whole diverge from the first death on.
+void world_advance(World *world, U64 ticks)
+{
+	Dwarves *dwarves = &world->dwarves;
+	U64 target = world->tick + ticks;
+
+	tick_contexts_reserve(world, 1);
+	Tick_Context *ctx = &world->tick_contexts[0];
+
+	U64 tick = world->tick + 1;
+	while (tick <= target) {
+		// Jump over ticks without events
+		if (world->event_window_count == 0) {
+			if (world->event_count == 0 || world->event_heap[0].tick > target)
+				break;
+			tick = world->event_heap[0].tick;
+		}
+		event_window_move(world, tick);
+
+		U32 count = world->event_tick_counts[tick % EVENT_WINDOW];
+		world->event_tick_counts[tick % EVENT_WINDOW] = 0;
+		world->event_window_count -= count;
+
+		// Events of a tick come out of the bitmap in index order, the order
+		// `world_tick` handles the dwarves in. New events are always on a
+		// later tick, so they don't land in the bitmap being scanned.
+		U64 *bitmap = event_bitmap(world, tick);
+		for (U32 word = 0; count > 0; word++) {
+			U64 bits = bitmap[word];
+			bitmap[word] = 0;
+			for (; bits; bits &= bits - 1, count--) {
+				U32 index = word * 64 + count_trailing_zeros64(bits);
+				dwarf_handle_event(world, ctx, index, tick);
+			}
+		}
+		tick++;
 	}
+	event_window_move(world, target + 1);
+
+	for (U32 i = 0; i < dwarves->count; i++) {
+		if (dwarves->alive[i])
+			dwarf_catch_up(world, i, target);
+	}
+	tick_context_merge(world, ctx);
+	world->tick = target;
+}
 
-	ptr += sprintf(ptr, "<html><head><title>%s</title></head>", dwarf->name);
-	ptr += sprintf(ptr, "<body><h1>%s</h1>", dwarf->name); 
-	ptr += sprintf(ptr, "<img src=\"/entities/%d/avatar.svg\""
-		"width=\"200\" height=\"200\">", dwarf->id); 
-	Location* location = &world->locations[dwarf->location];
-	ptr += sprintf(ptr, "<h2>%s in <a href=\"/locations/%d\">%s</a></h2>",
-		dwarf_status(dwarf), location->id, location->name); 
-	ptr += sprintf(ptr, "<h3>Hunger: %d, sleep: %d</h3>", dwarf->hunger, dwarf->sleep); 
-	ptr += sprintf(ptr, "</body></html>"); 
+int render_dwarves(World *world, Output *out)
+{
+	Dwarves *dwarves = &world->dwarves;
+	const char *prefix = world->path_prefix;
+
+	out_literal(out, "<html><head><title>Dwarves</title></head>");
+	out_literal(out, "<body><table><tr><th>Avatar</th><th>Name</th>");
+	out_literal(out, "<th>Location</th><th>Activity</th></tr>");
+	for (U32 i = 0; i < dwarves->count; i++) {
+		if (!dwarf_exists(world, i))
+			continue;
+
+		U32 id = dwarf_id(world, i);
+		Location *location = dwarf_location(world, i);
+
+		out_literal(out, "<tr><td><img src=\"");
+		out_string(out, prefix);
+		out_literal(out, "/entities/");
+		out_u32(out, id);
+		out_literal(out, "/avatar.svg\" width=\"50\" height=\"50\"></td><td><a href=\"");
+		out_string(out, prefix);
+		out_literal(out, "/entities/");
+		out_u32(out, id);
+		out_literal(out, "\">");
+		out_html(out, dwarf_name(world, i));
+		out_literal(out, "</a></td><td><a href=\"");
+		out_string(out, prefix);
+		out_literal(out, "/locations/");
+		out_u32(out, location->id);
+		out_literal(out, "\">");
+		out_html(out, location_name(world, location));
+		out_literal(out, "</a></td><td>");
+		out_string(out, dwarf_status(world, i));
+		out_literal(out, "</td></tr>\n");
+	}
+	out_literal(out, "</table></body></html>\n");
 
 	return 200;
 }
 
-int render_entity_avatar(World *world, U32 id, char *buffer)
+// Link to the page of a dwarf with its name
+void render_dwarf_link(World *world, U32 id, U32 index, Output *out)
 {
-	char *ptr = buffer;
-	Dwarf *dwarf = 0;
-	for (U32 i = 0; i < Count(world->dwarves); i++) {
-		if (world->dwarves[i].id == id) {
-			dwarf = &world->dwarves[i];
-			break;
+	out_literal(out, "<a href=\"");
+	out_string(out, world->path_prefix);
+	out_literal(out, "/entities/");
+	out_u32(out, id);
+	out_literal(out, "\">");
+	out_html(out, dwarf_name(world, index));
+	out_literal(out, "</a>");
+}
+
+void render_post(World *world, Post_Record *record, Output *out)
+{
+	U32 index;
+	if (!find_dwarf(world, record->by_id, &index))
+		return;
+
+	out_literal(out, "<li>");
+	render_dwarf_link(world, record->by_id, index, out);
+	out_literal(out, ":");
+
+	switch (record->type) {
+
+	case Post_Activity:
+		out_literal(out, "I will go ");
+		out_string(out, activity_infos[record->data].description);
+		break;
+
+	case Post_Death:
+		out_literal(out, "Died suddenly");
+		break;
+
+	}
+	out_literal(out, "</li>\n");
+}
+
+// Renders the posts before sequence number `before` from newest to oldest,
+// `UINT64_MAX` for the latest posts.
+int render_feed(World *world, U64 before, Output *out)
+{
+	U64 sequence = min(before, world->post_count);
+
+	out_literal(out, "<html><head><title>Activity feed</title></head>");
+	out_literal(out, "<body><ul>\n");
+	for (U32 shown = 0; shown < FEED_PAGE_SIZE && sequence > 0; shown++) {
+		sequence--;
+		render_post(world, post_log_get(world->post_log, sequence), out);
+	}
+	out_literal(out, "</ul>");
+	if (sequence > 0) {
+		out_literal(out, "<a href=\"");
+		out_string(out, world->path_prefix);
+		out_literal(out, "/feed?before=");
+		out_u64(out, sequence);
+		out_literal(out, "\">Older posts</a>");
+	}
+	out_literal(out, "</body></html>\n");
+
+	return 200;
+}
+
+// Renders the posts by the dwarf from newest to oldest following its
+// timeline. `before` is the sequence number of a post by the dwarf to start
+// after, `UINT64_MAX` for the latest posts.
+int render_entity_feed(World *world, U32 id, U64 before, Output *out)
+{
+	U32 index;
+	if (!find_dwarf(world, id, &index)) {
+		out_literal(out, "Entity not found with ID #");
+		out_u32(out, id);
+		return 404;
+	}
+
+	U64 next = world->dwarves.last_post[index];
+	if (before != UINT64_MAX) {
+		if (before >= world->post_count
+				|| post_log_get(world->post_log, before)->by_id != id) {
+			out_literal(out, "Post not found with sequence number ");
+			out_u64(out, before);
+			return 404;
 		}
+		next = post_log_get(world->post_log, before)->previous;
 	}
 
-	if (!dwarf) {
-		sprintf(buffer, "Entity not found with ID #%u", id);
+	out_literal(out, "<html><head><title>");
+	out_html(out, dwarf_name(world, index));
+	out_literal(out, "</title></head><body><h1>Posts by ");
+	render_dwarf_link(world, id, index, out);
+	out_literal(out, "</h1><ul>\n");
+	U64 last = 0;
+	for (U32 shown = 0; shown < FEED_PAGE_SIZE && next > 0; shown++) {
+		last = next - 1;
+		Post_Record *record = post_log_get(world->post_log, last);
+		render_post(world, record, out);
+		next = record->previous;
+	}
+	out_literal(out, "</ul>");
+	if (next > 0) {
+		out_literal(out, "<a href=\"");
+		out_string(out, world->path_prefix);
+		out_literal(out, "/entities/");
+		out_u32(out, id);
+		out_literal(out, "/feed?before=");
+		out_u64(out, last);
+		out_literal(out, "\">Older posts</a>");
+	}
+	out_literal(out, "</body></html>\n");
+
+	return 200;
+}
+
+int render_entity(World *world, U32 id, Output *out)
+{
+	U32 index;
+	if (!find_dwarf(world, id, &index)) {
+		out_literal(out, "Entity not found with ID #");
+		out_u32(out, id);
 		return 404;
 	}
 
-	ptr += sprintf(ptr, "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\""
+	const char *name = dwarf_name(world, index);
+	const char *prefix = world->path_prefix;
+	out_literal(out, "<html><head><title>");
+	out_html(out, name);
+	out_literal(out, "</title></head><body><h1>");
+	out_html(out, name);
+	out_literal(out, "</h1><img src=\"");
+	out_string(out, prefix);
+	out_literal(out, "/entities/");
+	out_u32(out, id);
+	out_literal(out, "/avatar.svg\"width=\"200\" height=\"200\">");
+
+	Location* location = dwarf_location(world, index);
+	out_literal(out, "<h2>");
+	out_string(out, dwarf_status(world, index));
+	out_literal(out, " in <a href=\"");
+	out_string(out, prefix);
+	out_literal(out, "/locations/");
+	out_u32(out, location->id);
+	out_literal(out, "\">");
+	out_html(out, location_name(world, location));
+	out_literal(out, "</a></h2><h3>Hunger: ");
+	out_i32(out, world->dwarves.hunger[index]);
+	out_literal(out, ", sleep: ");
+	out_i32(out, world->dwarves.sleep[index]);
+	out_literal(out, "</h3><a href=\"");
+	out_string(out, prefix);
+	out_literal(out, "/entities/");
+	out_u32(out, id);
+	out_literal(out, "/feed\">Posts</a></body></html>");
+
+	return 200;
+}
+
+int render_entity_avatar(World *world, U32 id, Output *out)
+{
+	U32 index;
+	if (!find_dwarf(world, id, &index)) {
+		out_literal(out, "Entity not found with ID #");
+		out_u32(out, id);
+		return 404;
+	}
+
+	out_literal(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\""
 		" width=\"100\" height=\"100\">\n");
-	ptr += sprintf(ptr, "<circle cx=\"50\" cy=\"50\" r=\"30\" fill=\"#%06x\" />\n",
-			dwarf->seed & 0xFFFFFF); 
-	ptr += sprintf(ptr, "</svg>\n"); 
+	out_literal(out, "<circle cx=\"50\" cy=\"50\" r=\"30\" fill=\"#");
+	out_hex(out, world->dwarves.seed[index] & 0xFFFFFF, 6);
+	out_literal(out, "\" />\n</svg>\n");
 
 	return 200;
 }
 
-int render_locations(World *world, char *buffer)
+int render_locations(World *world, Output *out)
 {
-	char *ptr = buffer;
-	ptr += sprintf(ptr, "<html><head><title>Locations</title></head>");
-	ptr += sprintf(ptr, "<body><ul>\n");
-	for (U32 i = 0; i < Count(world->locations); i++) {
+	out_literal(out, "<html><head><title>Locations</title></head>");
+	out_literal(out, "<body><ul>\n");
+	for (U32 i = 0; i < world->location_count; i++) {
 		Location *location = &world->locations[i];
-		if (location->id == 0)
-			continue;
-
-		ptr += sprintf(ptr, "<li><a href=\"/locations/%d\">%s</a></li>\n",
-				location->id, location->name);
+		out_literal(out, "<li><a href=\"");
+		out_string(out, world->path_prefix);
+		out_literal(out, "/locations/");
+		out_u32(out, location->id);
+		out_literal(out, "\">");
+		out_html(out, location_name(world, location));
+		out_literal(out, "</a></li>\n");
 	}
-	ptr += sprintf(ptr, "</ul></body></html>\n");
+	out_literal(out, "</ul></body></html>\n");
 
 	return 200;
 }
 
-int render_location(World *world, U32 id, char *buffer)
+int render_location(World *world, U32 id, Output *out)
 {
-	char *ptr = buffer;
-	Location *location = 0;
-	for (U32 i = 0; i < Count(world->locations); i++) {
-		if (world->locations[i].id == id) {
-			location = &world->locations[i];
-			break;
-		}
-	}
+	Location *location = find_location(world, id);
 
 	if (!location) {
-		sprintf(buffer, "Location not found with ID #%u", id);
+		out_literal(out, "Location not found with ID #");
+		out_u32(out, id);
 		return 404;
 	}
 
-	ptr += sprintf(ptr, "<html><head><title>%s</title></head><body>", location->name);
-	ptr += sprintf(ptr, "<h1>%s</h1><ul>", location->name);
+	const char *name = location_name(world, location);
+	out_literal(out, "<html><head><title>");
+	out_html(out, name);
+	out_literal(out, "</title></head><body><h1>");
+	out_html(out, name);
+	out_literal(out, "</h1><ul>");
 
-	for (U32 i = 0; i < Count(world->dwarves); i++) {
-		Dwarf *dwarf = &world->dwarves[i];
-		if (dwarf->id != 0 && dwarf->location == id) {
-			ptr += sprintf(ptr, "<li><a href=\"/entities/%d\">%s</a> (%s)</li>\n",
-				dwarf->id, dwarf->name, dwarf_status(dwarf));
-		}
+	Dwarves *dwarves = &world->dwarves;
+	for (U32 resident = location->first_resident; resident;
+			resident = dwarves->resident_next[resident - 1]) {
+		out_literal(out, "<li>");
+		render_dwarf_link(world, dwarf_id(world, resident - 1), resident - 1, out);
+		out_literal(out, " (");
+		out_string(out, dwarf_status(world, resident - 1));
+		out_literal(out, ")</li>\n");
 	}
 
-	ptr += sprintf(ptr, "</ul></body></html>\n");
+	out_literal(out, "</ul></body></html>\n");
 
 	return 200;
 }
-
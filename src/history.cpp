@@ -0,0 +1,444 @@
+
+// History of the world. The simulation is deterministic, so the only things
+// that decide how the world got to its state are where the world started
+// and how far it was advanced on each update. Those are written to a
+// journal, along with periodic checkpoints of the whole world in the save
+// format. Any past tick can then be rebuilt by loading the checkpoint
+// before it and replaying the journal from there.
+//
+// Future mutations of the world from outside the simulation need to be
+// journaled as their own entries to be replayed.
+
+#define JOURNAL_PATH "journal.log"
+#define CHECKPOINT_DIRECTORY "checkpoints"
+
+// Ticks between checkpoints
+#define CHECKPOINT_INTERVAL 600
+
+// Checkpoints kept on disk, older ones are deleted
+#define CHECKPOINT_LIMIT 144
+
+// Rebuilt past worlds kept in memory
+#define HISTORY_CACHE_SIZE 4
+
+enum Journal_Type
+{
+	Journal_Advance = 1,
+	Journal_Checkpoint = 2,
+	Journal_Remove = 3,
+};
+
+enum Journal_Flags
+{
+	// The advance was simulated with `world_tick`
+	Journal_Tick_By_Tick = 0x1,
+};
+
+struct Journal_Entry
+{
+	U32 type;
+	U32 flags;
+
+	// Advance: first tick and number of ticks of one update of the world
+	// Checkpoint: tick of the checkpoint, `count` is unused
+	// Remove: tick the dead dwarf was removed at, `count` is its id
+	U64 tick;
+	U64 count;
+};
+
+struct Journal
+{
+	// Appended to by the simulation and save threads, read by the request
+	// handlers rebuilding the past
+	os_mutex lock;
+	FILE *file;
+
+	Journal_Entry *entries;
+	U32 count;
+	U32 capacity;
+
+	// Ticks of all the checkpoints in order, the files of the ones below
+	// `first_checkpoint` have been deleted
+	U64 *checkpoints;
+	U32 checkpoint_count;
+	U32 checkpoint_capacity;
+	U32 first_checkpoint;
+
+	// Directory of the world the journal is in
+	char directory[128];
+};
+
+void checkpoint_path(Journal *journal, char *path, size_t size, U64 tick)
+{
+	snprintf(path, size, "%s/" CHECKPOINT_DIRECTORY "/%llu.save",
+		journal->directory, (unsigned long long)tick);
+}
+
+// Replaces the journal file with the entries in memory and keeps it open
+// for appending. On failure the old file is kept as it is, it still holds
+// every entry. The lock must be held, or the journal not shared yet.
+void journal_rewrite(Journal *journal)
+{
+	// The directory is at most 127 characters, so the path always fits
+	char path[256];
+	char temp_path[sizeof(path) + 4];
+	snprintf(path, sizeof(path), "%s/" JOURNAL_PATH, journal->directory);
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+	FILE *file = fopen(temp_path, "wb");
+	bool ok = file != 0;
+	ok = ok && fwrite(journal->entries, sizeof(Journal_Entry), journal->count, file)
+		== journal->count;
+	ok = ok && os_sync_file(file);
+	ok = (!file || fclose(file) == 0) && ok;
+	if (!ok) {
+		printf("Failed to write '%s'%s\n", temp_path,
+			journal->file ? "" : ", keeping the journal in memory only");
+		remove(temp_path);
+		return;
+	}
+
+	if (journal->file)
+		fclose(journal->file);
+	journal->file = os_replace_file(temp_path, path) ? fopen(path, "ab") : 0;
+	if (!journal->file)
+		printf("Failed to replace '%s', keeping the journal in memory only\n", path);
+}
+
+// Drops the entries that only lead up to checkpoints that have been
+// deleted, see `history_rebuild` for the ones still needed. Only done once
+// they are at least half of the journal, so the file isn't rewritten for
+// every deleted checkpoint. Returns true if the file needs to be rewritten.
+// The lock must be held.
+bool journal_compact(Journal *journal)
+{
+	U64 start = journal->checkpoints[journal->first_checkpoint];
+	U32 first = journal->count;
+	while (first > 0 && !(journal->entries[first - 1].type == Journal_Advance
+			&& journal->entries[first - 1].tick < start))
+		first--;
+	if (first == 0 || first < journal->count / 2)
+		return false;
+
+	journal->count -= first;
+	memmove(journal->entries, journal->entries + first,
+		journal->count * sizeof(Journal_Entry));
+	journal->checkpoint_count -= journal->first_checkpoint;
+	memmove(journal->checkpoints, journal->checkpoints + journal->first_checkpoint,
+		journal->checkpoint_count * sizeof(U64));
+	journal->first_checkpoint = 0;
+	return true;
+}
+
+// Adds the entry in memory, the lock must be held. Returns true if entries
+// were dropped, see `journal_compact`.
+bool journal_push(Journal *journal, const Journal_Entry *entry)
+{
+	if (journal->count == journal->capacity) {
+		journal->capacity = max(journal->capacity * 2, 256);
+		journal->entries = (Journal_Entry*)realloc(journal->entries,
+			journal->capacity * sizeof(Journal_Entry));
+	}
+	journal->entries[journal->count++] = *entry;
+
+	if (entry->type != Journal_Checkpoint)
+		return false;
+
+	if (journal->checkpoint_count == journal->checkpoint_capacity) {
+		journal->checkpoint_capacity = max(journal->checkpoint_capacity * 2, 16);
+		journal->checkpoints = (U64*)realloc(journal->checkpoints,
+			journal->checkpoint_capacity * sizeof(U64));
+	}
+	journal->checkpoints[journal->checkpoint_count++] = entry->tick;
+
+	U32 first_checkpoint = journal->first_checkpoint;
+	while (journal->checkpoint_count - journal->first_checkpoint > CHECKPOINT_LIMIT) {
+		char path[256];
+		checkpoint_path(journal, path, sizeof(path),
+			journal->checkpoints[journal->first_checkpoint++]);
+		remove(path);
+	}
+	return journal->first_checkpoint != first_checkpoint && journal_compact(journal);
+}
+
+// Reads the journal in `directory` of a world that is now at `tick`. If
+// `keep` is not set the world is new and the old history is dropped,
+// otherwise the entries past `tick` are, as the world lost them when it was
+// last saved.
+void journal_open(Journal *journal, const char *directory, U64 tick, bool keep)
+{
+	memset(journal, 0, sizeof(Journal));
+	os_mutex_init(&journal->lock);
+	snprintf(journal->directory, sizeof(journal->directory), "%s", directory);
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/" CHECKPOINT_DIRECTORY, directory);
+	os_create_directory(path);
+
+	snprintf(path, sizeof(path), "%s/" JOURNAL_PATH, directory);
+	os_mapped_file file;
+	if (os_map_file(path, &file)) {
+		const Journal_Entry *entries = (const Journal_Entry*)file.data;
+		size_t count = file.size / sizeof(Journal_Entry);
+		for (size_t i = 0; i < count; i++) {
+			const Journal_Entry *entry = &entries[i];
+			bool valid = keep && (entry->type == Journal_Advance
+				? entry->tick + entry->count <= tick : entry->tick <= tick);
+			if (valid) {
+				journal_push(journal, entry);
+			} else if (entry->type == Journal_Checkpoint) {
+				char checkpoint[256];
+				checkpoint_path(journal, checkpoint, sizeof(checkpoint), entry->tick);
+				remove(checkpoint);
+			}
+		}
+		os_unmap_file(&file);
+	}
+
+	journal_rewrite(journal);
+}
+
+void journal_append(Journal *journal, const Journal_Entry *entry)
+{
+	os_mutex_lock(&journal->lock);
+	if (journal_push(journal, entry)) {
+		if (journal->file)
+			journal_rewrite(journal);
+	} else if (journal->file && (fwrite(entry, sizeof(Journal_Entry), 1, journal->file) != 1
+			|| fflush(journal->file) != 0)) {
+		printf("Failed to append to the journal, keeping it in memory only\n");
+		fclose(journal->file);
+		journal->file = 0;
+	}
+	os_mutex_unlock(&journal->lock);
+}
+
+void journal_advance(Journal *journal, U64 tick, U64 count, bool tick_by_tick)
+{
+	Journal_Entry entry = { 0 };
+	entry.type = Journal_Advance;
+	entry.flags = tick_by_tick ? Journal_Tick_By_Tick : 0;
+	entry.tick = tick;
+	entry.count = count;
+	journal_append(journal, &entry);
+}
+
+void journal_remove(Journal *journal, U64 tick, U32 id)
+{
+	Journal_Entry entry = { 0 };
+	entry.type = Journal_Remove;
+	entry.tick = tick;
+	entry.count = id;
+	journal_append(journal, &entry);
+}
+
+// Writes a checkpoint of the world if the last one is old enough. Only
+// called from one thread.
+bool world_checkpoint(Journal *journal, World *world, U32 flags)
+{
+	os_mutex_lock(&journal->lock);
+	bool due = journal->checkpoint_count == journal->first_checkpoint
+		|| world->tick >= journal->checkpoints[journal->checkpoint_count - 1]
+			+ CHECKPOINT_INTERVAL;
+	os_mutex_unlock(&journal->lock);
+	if (!due)
+		return false;
+
+	char path[256];
+	checkpoint_path(journal, path, sizeof(path), world->tick);
+	if (!world_save(world, path, 0, flags)) {
+		printf("Failed to write checkpoint '%s'\n", path);
+		return false;
+	}
+
+	Journal_Entry entry = { 0 };
+	entry.type = Journal_Checkpoint;
+	entry.tick = world->tick;
+	journal_append(journal, &entry);
+	return true;
+}
+
+// Rebuilds the world as it was at `tick` into `world`, which can hold an
+// earlier rebuilt world. Posts made while replaying are already in the
+// post log and are only linked. Returns false if the history doesn't
+// reach `tick`.
+bool history_rebuild(Journal *journal, Post_Log *post_log, U64 tick, World *world)
+{
+	// Copy the entries to replay, so the journal isn't locked while
+	// replaying them
+	os_mutex_lock(&journal->lock);
+
+	U32 checkpoint = journal->checkpoint_count;
+	while (checkpoint > journal->first_checkpoint
+			&& journal->checkpoints[checkpoint - 1] > tick)
+		checkpoint--;
+	if (checkpoint == journal->first_checkpoint) {
+		os_mutex_unlock(&journal->lock);
+		return false;
+	}
+	U64 start = journal->checkpoints[checkpoint - 1];
+
+	// The advances follow each other without gaps, but checkpoints are
+	// journaled after they are written and can come after later advances.
+	U32 first = journal->count;
+	while (first > 0 && !(journal->entries[first - 1].type == Journal_Advance
+			&& journal->entries[first - 1].tick < start))
+		first--;
+
+	// Removals are journaled after the advance that reached their tick and
+	// the checkpoint at `start` already has the ones at `start`.
+	Journal_Entry *replays = (Journal_Entry*)malloc(
+		(journal->count - first + 1) * sizeof(Journal_Entry));
+	U32 replay_count = 0;
+	U64 end = start;
+	for (U32 i = first; i < journal->count; i++) {
+		Journal_Entry *entry = &journal->entries[i];
+		if (entry->type == Journal_Advance && entry->tick < tick) {
+			replays[replay_count++] = *entry;
+			end = entry->tick + entry->count;
+		} else if (entry->type == Journal_Remove && entry->tick > start
+				&& entry->tick <= tick) {
+			replays[replay_count++] = *entry;
+		}
+	}
+	os_mutex_unlock(&journal->lock);
+
+	char path[256];
+	checkpoint_path(journal, path, sizeof(path), start);
+	U64 last_updated;
+	U32 flags;
+	if (end < tick || !world_load(world, path, &last_updated, &flags)) {
+		free(replays);
+		return false;
+	}
+	world->post_log = post_log;
+	world->replay = true;
+
+	// Mirrors how the server picks the events when starting up, the mode
+	// only changes between runs.
+	bool events = (flags & World_Save_Events) != 0;
+	if (events)
+		world_rebuild_events(world);
+
+	for (U32 i = 0; i < replay_count; i++) {
+		Journal_Entry *entry = &replays[i];
+		if (entry->type == Journal_Remove) {
+			U32 index;
+			if (find_dwarf(world, (U32)entry->count, &index) && !world->dwarves.alive[index])
+				world_remove_dwarf(world, index);
+			continue;
+		}
+
+		U64 count = min(entry->count, tick - entry->tick);
+		if (entry->flags & Journal_Tick_By_Tick) {
+			// Rebuilds run on the workers of the pool, which must not wait
+			// for it, so the ticks run on this thread without one
+			for (U64 t = 0; t < count; t++)
+				world_tick(world, 0);
+			events = false;
+		} else {
+			if (!events)
+				world_start_events(world);
+			events = true;
+			world_advance(world, count);
+		}
+	}
+
+	free(replays);
+	return world->tick == tick;
+}
+
+struct History_World
+{
+	World world;
+	Name_Table names;
+	U64 tick;
+
+	// Set once the world has been rebuilt
+	bool valid;
+	U32 readers;
+	U64 last_used;
+};
+
+// LRU cache of rebuilt past worlds
+struct History
+{
+	os_mutex lock;
+	History_World worlds[HISTORY_CACHE_SIZE];
+	U64 use_count;
+
+	Journal *journal;
+	Post_Log *post_log;
+};
+
+void history_init(History *history, Journal *journal, Post_Log *post_log,
+	const char *path_prefix)
+{
+	memset(history, 0, sizeof(History));
+	os_mutex_init(&history->lock);
+	history->journal = journal;
+	history->post_log = post_log;
+	for (U32 i = 0; i < HISTORY_CACHE_SIZE; i++) {
+		History_World *past = &history->worlds[i];
+		name_table_init(&past->names);
+		world_init(&past->world, &past->names);
+		past->world.path_prefix = path_prefix;
+	}
+}
+
+// Returns the world as it was at `tick`, which stays valid until released
+// with `history_release`. On failure returns null and the HTTP status: 404
+// if the history doesn't reach the tick, 503 if every cached world is in use.
+History_World *history_acquire(History *history, U64 tick, int *status)
+{
+	os_mutex_lock(&history->lock);
+
+	History_World *victim = 0;
+	for (U32 i = 0; i < HISTORY_CACHE_SIZE; i++) {
+		History_World *past = &history->worlds[i];
+		if (past->valid && past->tick == tick) {
+			past->readers++;
+			past->last_used = ++history->use_count;
+			os_mutex_unlock(&history->lock);
+			return past;
+		}
+		if (past->readers == 0 && (!victim || past->last_used < victim->last_used))
+			victim = past;
+	}
+	if (!victim) {
+		os_mutex_unlock(&history->lock);
+		*status = 503;
+		return 0;
+	}
+
+	// Reserve the world so no one else touches it while rebuilding
+	victim->valid = false;
+	victim->readers = 1;
+	victim->last_used = ++history->use_count;
+	os_mutex_unlock(&history->lock);
+
+	bool rebuilt = history_rebuild(history->journal, history->post_log, tick,
+		&victim->world);
+
+	os_mutex_lock(&history->lock);
+	victim->valid = rebuilt;
+	victim->tick = tick;
+	if (!rebuilt) {
+		victim->readers = 0;
+		victim->last_used = 0;
+	}
+	os_mutex_unlock(&history->lock);
+
+	if (!rebuilt) {
+		*status = 404;
+		return 0;
+	}
+	return victim;
+}
+
+void history_release(History *history, History_World *past)
+{
+	os_mutex_lock(&history->lock);
+	past->readers--;
+	os_mutex_unlock(&history->lock);
+}
@@ -0,0 +1,320 @@
+
+// HTTP/1.x request parser working in place on the receive buffer. The
+// request line and the headers we care about are returned as views into the
+// buffer, nothing is copied.
+
+// Maximum size of the request line and headers
+#define HTTP_MAX_REQUEST_SIZE KB(8)
+
+struct String_View
+{
+	const char *data;
+	int length;
+};
+
+struct HTTP_Request
+{
+	// Null-terminated in place. The query string is split from the path
+	// without the '?', it's empty if there is none.
+	String_View method;
+	String_View path;
+	String_View query;
+	String_View version;
+
+	// Empty if the header is missing
+	String_View connection;
+	String_View if_none_match;
+	String_View accept_encoding;
+
+	// Size of the request line and headers including the final empty line
+	int length;
+};
+
+enum HTTP_Parse_Result
+{
+	HTTP_Parse_Incomplete,
+	HTTP_Parse_Ok,
+	HTTP_Parse_Error,
+};
+
+inline bool view_equals_nocase(String_View view, const char *string, int length)
+{
+	if (view.length != length)
+		return false;
+	for (int i = 0; i < length; i++) {
+		char c = view.data[i];
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		if (c != string[i])
+			return false;
+	}
+	return true;
+}
+
+// Returns a pointer to the first `a` or `b` in [begin, end), or `end` if
+// neither is found.
+typedef const char *(*HTTP_Scan_Func)(const char *begin, const char *end,
+	char a, char b);
+
+const char *http_scan_scalar(const char *begin, const char *end, char a, char b)
+{
+	const char *ptr = begin;
+	while (ptr < end && *ptr != a && *ptr != b)
+		ptr++;
+	return ptr;
+}
+
+#if ARCH_SSE2
+
+const char *http_scan_sse2(const char *begin, const char *end, char a, char b)
+{
+	const char *ptr = begin;
+	__m128i match_a = _mm_set1_epi8(a);
+	__m128i match_b = _mm_set1_epi8(b);
+	while (end - ptr >= 16) {
+		__m128i data = _mm_loadu_si128((const __m128i*)ptr);
+		__m128i found = _mm_or_si128(_mm_cmpeq_epi8(data, match_a),
+			_mm_cmpeq_epi8(data, match_b));
+		U32 mask = (U32)_mm_movemask_epi8(found);
+		if (mask)
+			return ptr + count_trailing_zeros32(mask);
+		ptr += 16;
+	}
+	return http_scan_scalar(ptr, end, a, b);
+}
+
+TARGET_AVX2
+const char *http_scan_avx2(const char *begin, const char *end, char a, char b)
+{
+	const char *ptr = begin;
+	__m256i match_a = _mm256_set1_epi8(a);
+	__m256i match_b = _mm256_set1_epi8(b);
+	while (end - ptr >= 32) {
+		__m256i data = _mm256_loadu_si256((const __m256i*)ptr);
+		__m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(data, match_a),
+			_mm256_cmpeq_epi8(data, match_b));
+		U32 mask = (U32)_mm256_movemask_epi8(found);
+		if (mask)
+			return ptr + count_trailing_zeros32(mask);
+		ptr += 32;
+	}
+
+	// GCC tail-calls the SSE2 scanner without clearing the upper halves,
+	// which makes every SSE instruction after it pay the transition penalty
+	_mm256_zeroupper();
+	return http_scan_sse2(ptr, end, a, b);
+}
+
+HTTP_Scan_Func http_scan = http_scan_sse2;
+
+#else
+
+HTTP_Scan_Func http_scan = http_scan_scalar;
+
+#endif
+
+// Picks the widest scanner the CPU supports.
+void http_init()
+{
+#if ARCH_SSE2
+	if (os_cpu_has_avx2())
+		http_scan = http_scan_avx2;
+#endif
+}
+
+inline String_View http_trim(const char *begin, const char *end)
+{
+	while (begin < end && (*begin == ' ' || *begin == '\t'))
+		begin++;
+	while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+
+	String_View view;
+	view.data = begin;
+	view.length = (int)(end - begin);
+	return view;
+}
+
+// Finds the end of the line starting at `begin`. Returns the position of the
+// terminating '\n' and sets `line_end` to the end of the line contents, or
+// returns `end` if the line is incomplete and null if it contains a
+// null-byte.
+inline const char *http_find_line(const char *begin, const char *end,
+	const char **line_end)
+{
+	const char *newline = http_scan(begin, end, '\n', '\0');
+	if (newline == end)
+		return end;
+	if (*newline == '\0')
+		return 0;
+
+	*line_end = newline > begin && newline[-1] == '\r' ? newline - 1 : newline;
+	return newline;
+}
+
+// Parses the request line and headers from the start of `data`. On success
+// the method, path and version are null-terminated in place.
+HTTP_Parse_Result http_parse_request(char *data, int size, HTTP_Request *request)
+{
+	const char *end = data + size;
+	const char *line_end;
+
+	const char *newline = http_find_line(data, end, &line_end);
+	if (newline == end) return HTTP_Parse_Incomplete;
+	if (!newline) return HTTP_Parse_Error;
+
+	// Request line: method SP path SP version
+	char *method = data;
+	char *method_end = (char*)memchr(method, ' ', line_end - method);
+	if (!method_end || method_end == method) return HTTP_Parse_Error;
+
+	char *path = method_end + 1;
+	char *path_end = (char*)memchr(path, ' ', line_end - path);
+	if (!path_end || path_end == path) return HTTP_Parse_Error;
+
+	char *version = path_end + 1;
+	char *version_end = (char*)line_end;
+	if (version_end == version || memchr(version, ' ', version_end - version))
+		return HTTP_Parse_Error;
+
+	request->connection.length = 0;
+	request->if_none_match.length = 0;
+	request->accept_encoding.length = 0;
+
+	const char *line = newline + 1;
+	for (;;) {
+		newline = http_find_line(line, end, &line_end);
+		if (newline == end) return HTTP_Parse_Incomplete;
+		if (!newline) return HTTP_Parse_Error;
+
+		if (line_end == line)
+			break;
+
+		const char *colon = http_scan(line, line_end, ':', ':');
+		if (colon == line_end || colon == line)
+			return HTTP_Parse_Error;
+
+		String_View name;
+		name.data = line;
+		name.length = (int)(colon - line);
+		String_View value = http_trim(colon + 1, line_end);
+
+		if (view_equals_nocase(name, "connection", 10))
+			request->connection = value;
+		else if (view_equals_nocase(name, "if-none-match", 13))
+			request->if_none_match = value;
+		else if (view_equals_nocase(name, "accept-encoding", 15))
+			request->accept_encoding = value;
+
+		line = newline + 1;
+	}
+
+	request->length = (int)(newline + 1 - data);
+
+	char *query = (char*)memchr(path, '?', path_end - path);
+
+	*method_end = '\0';
+	*path_end = '\0';
+	*version_end = '\0';
+	request->method.data = method;
+	request->method.length = (int)(method_end - method);
+	request->path.data = path;
+	request->path.length = (int)((query ? query : path_end) - path);
+	request->query.data = query ? query + 1 : path_end;
+	request->query.length = query ? (int)(path_end - query - 1) : 0;
+	if (query)
+		*query = '\0';
+	request->version.data = version;
+	request->version.length = (int)(version_end - version);
+
+	return HTTP_Parse_Ok;
+}
+
+// Whether the connection should stay open after responding to the request.
+// HTTP/1.1 defaults to keeping it open, older versions to closing it.
+bool http_keep_alive(HTTP_Request *request)
+{
+	String_View value = request->connection;
+	bool http_11 = !strcmp(request->version.data, "HTTP/1.1");
+
+	// The header is a comma-separated list of tokens
+	const char *ptr = value.data;
+	const char *end = value.data + value.length;
+	while (ptr < end) {
+		const char *token_end = (const char*)memchr(ptr, ',', end - ptr);
+		if (!token_end)
+			token_end = end;
+
+		String_View token = http_trim(ptr, token_end);
+		if (view_equals_nocase(token, "close", 5))
+			return false;
+		if (view_equals_nocase(token, "keep-alive", 10))
+			return true;
+
+		ptr = token_end + 1;
+	}
+	return http_11;
+}
+
+// Finds the decimal value of the parameter `name` in a query string like
+// "a=1&b=2". Returns false if it's missing or not a number.
+bool http_query_u64(String_View query, const char *name, U64 *value)
+{
+	int name_length = (int)strlen(name);
+
+	const char *ptr = query.data;
+	const char *end = query.data + query.length;
+	while (ptr < end) {
+		const char *param_end = (const char*)memchr(ptr, '&', end - ptr);
+		if (!param_end)
+			param_end = end;
+
+		if (param_end - ptr > name_length && !memcmp(ptr, name, name_length)
+				&& ptr[name_length] == '=') {
+			const char *digit = ptr + name_length + 1;
+			if (digit == param_end)
+				return false;
+
+			U64 result = 0;
+			for (; digit < param_end; digit++) {
+				if (*digit < '0' || *digit > '9' || result > (UINT64_MAX - 9) / 10)
+					return false;
+				result = result * 10 + (U64)(*digit - '0');
+			}
+			*value = result;
+			return true;
+		}
+
+		ptr = param_end + 1;
+	}
+	return false;
+}
+
+// Whether an If-None-Match header value matches `etag`. The value is either
+// "*" or a comma-separated list of entity tags, weak tags compare equal to
+// strong ones.
+bool http_etag_matches(String_View header, const char *etag)
+{
+	int etag_length = (int)strlen(etag);
+
+	const char *ptr = header.data;
+	const char *end = header.data + header.length;
+	while (ptr < end) {
+		const char *tag_end = (const char*)memchr(ptr, ',', end - ptr);
+		if (!tag_end)
+			tag_end = end;
+
+		String_View tag = http_trim(ptr, tag_end);
+		if (tag.length == 1 && tag.data[0] == '*')
+			return true;
+		if (tag.length > 2 && tag.data[0] == 'W' && tag.data[1] == '/') {
+			tag.data += 2;
+			tag.length -= 2;
+		}
+		if (tag.length == etag_length && !memcmp(tag.data, etag, etag_length))
+			return true;
+
+		ptr = tag_end + 1;
+	}
+	return false;
+}
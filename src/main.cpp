@@ -5,14 +5,35 @@
 
 #define DORF_PORT "3500"
 
-os_socket server_socket;
-os_atomic_uint32 active_thread_count;
+// Longest name of a world
+#define WORLD_NAME_MAX 63
+
+// Most ticks simulated in one step while catching up with `world_advance`,
+// the budget of a slice is checked between the steps.
+#define WORLD_CATCH_UP_STEP 64
+
+os_atomic_uint32 active_connection_count;
+os_atomic_uint32 next_connection_id;
+Work_Pool work_pool;
+
+// Start time of the server, part of every ETag derived from world versions
+// as they restart from zero.
+U32 server_epoch;
+
+struct World_Registry;
 
 struct Server_Stats
 {
 	U32 snapshot_count;
 	U32 snapshot_index;
-	long *active_thread_counts;
+
+	// Busy plus queued tasks of the pool, sampled once a second
+	Work_Pool *pool;
+	long *pool_occupancies;
+
+	// Request rates of the worlds are sampled along with the pool
+	World_Registry *worlds;
+
 	os_mutex lock;
 };
 
@@ -88,59 +109,377 @@ struct HTTP_Status_Description {
 	/* { 520, "Unknown Error" }, */
 };
 
-const char *get_http_status_description(int status_code) {
-	for (U32 i = 0; i < Count(http_status_descriptions); i++) {
-		if (http_status_descriptions[i].status_code == status_code) {
-			return http_status_descriptions[i].description;
+struct HTTP_Status_Line
+{
+	char text[64];
+	int length;
+};
+
+// Complete status lines for the codes [100, 600), indexed by `code - 100`
+HTTP_Status_Line http_status_lines[500];
+
+void http_status_lines_init()
+{
+	for (int code = 100; code < 600; code++) {
+		const char *description = "Unknown";
+		for (U32 i = 0; i < Count(http_status_descriptions); i++) {
+			if (http_status_descriptions[i].status_code == code) {
+				description = http_status_descriptions[i].description;
+				break;
+			}
 		}
+
+		HTTP_Status_Line *line = &http_status_lines[code - 100];
+		line->length = snprintf(line->text, sizeof(line->text),
+			"HTTP/1.1 %d %s\r\n", code, description);
 	}
-	return "Unknown";
 }
 
+const HTTP_Status_Line *get_http_status_line(int status_code)
+{
+	if (status_code < 100 || status_code >= 600)
+		status_code = 500;
+	return &http_status_lines[status_code - 100];
+}
+
+// How responses are flushed to the socket, picked once per connection.
+enum Socket_Mode
+{
+	// Disable Nagle's algorithm so every response is sent immediately
+	Socket_No_Delay,
+
+	// Hold partial frames back while there are pipelined requests left and
+	// push them out when the connection goes idle.
+	Socket_Cork,
+};
+
+Socket_Mode socket_mode = Socket_No_Delay;
+
+// Applies `socket_mode` to a newly accepted socket, returns whether the
+// socket is corked.
+bool socket_prepare(os_socket sock)
+{
+	if (socket_mode == Socket_Cork && os_socket_set_corked(sock, true))
+		return true;
+	os_socket_set_delayed(sock, false);
+	return false;
+}
+
+struct Event_Loop;
+
+// Every listener is a separate socket bound to the same port with its own
+// accept thread, the kernel spreads the incoming connections between them.
+struct Listener
+{
+	os_socket socket;
+	U32 index;
+	os_atomic_uint32 accepted;
+
+	// Where accepted connections are handed to, without event loops they
+	// are served by the worker pool.
+	Event_Loop *event_loops;
+	int event_loop_count;
+	World_Registry *worlds;
+};
+
+Listener *listeners;
+U32 listener_count;
+
 void handle_kill(int signal)
 {
 	puts("server is kill");
 
-	os_socket_close(server_socket);
+	for (U32 i = 0; i < listener_count; i++) {
+		os_socket_close(listeners[i].socket);
+	}
 
 	exit(0);
 }
 
+// Counts of values in power of two buckets, value `v` goes to the bucket of
+// the number of bits in it, so bucket `i > 0` holds [2^(i-1), 2^i).
+#define HISTOGRAM_BUCKETS 32
+
+struct Histogram
+{
+	U32 buckets[HISTOGRAM_BUCKETS];
+	U32 count;
+	U64 max;
+};
+
+void histogram_add(Histogram *histogram, U64 value)
+{
+	U32 bucket = value ? 64 - count_leading_zeros64(value) : 0;
+	histogram->buckets[min(bucket, HISTOGRAM_BUCKETS - 1)]++;
+	histogram->count++;
+	histogram->max = max(histogram->max, value);
+}
+
+// Immutable copy of the world published after a tick
+struct World_Snapshot
+{
+	World world;
+
+	// Wall clock time the world was updated to
+	U64 last_updated;
+
+	// Number of threads reading the snapshot, it's reused only when it's
+	// not published and has no readers.
+	os_atomic_uint32 readers;
+	World_Snapshot *next;
+};
+
+// The simulation thread owns `world` and is the only thread that touches
+// it. After ticking it publishes a copy of the world as `current`, which is
+// read by the request handlers without locking anything.
 struct World_Instance
 {
+	// Name in the `/w/:world` prefix of the paths of the world
+	char name[WORLD_NAME_MAX + 1];
+	char path_prefix[WORLD_NAME_MAX + 4];
+
+	// Directory of the files of the world
+	char directory[WORLD_NAME_MAX + 8];
+
+	// Seed of the generated world
+	U64 seed;
+
+	// Core the simulation thread is pinned to
+	U32 core;
+
 	World *world;
-	os_mutex lock;
 	time_t last_updated;
+
+	// Ticks per second and ticks due that haven't been simulated yet, the
+	// world falls behind if a slice runs out of budget.
+	U32 tick_rate;
+	U64 pending_ticks;
+
+	// Run every tick of every dwarf instead of jumping between events
+	bool tick_by_tick;
+
+	// Workers to tick the world on, null to tick on the simulation thread
+	Work_Pool *tick_pool;
+
+	// Every update is journaled so past ticks can be rebuilt by `history`
+	Journal *journal;
+	History *history;
+
+	os_atomic_pointer current;
+
+	// All snapshots ever allocated, only used by the simulation thread
+	World_Snapshot *snapshots;
+	U32 snapshot_count;
+
+	// Pages rendered from the snapshots
+	Page_Cache page_cache;
+
+	// Written by the simulation thread and read by /stats without locking
+	U32 update_count;
+	float last_update_ms;
+	float max_update_ms;
+	double total_update_ms;
+
+	// Microseconds each update took, how late the simulation thread woke up
+	// after the end of its period, and how many periods it missed before
+	Histogram update_us;
+	Histogram lag_us;
+	Histogram missed_ticks;
+
+	// `request_rate` is sampled once a second by the stats thread
+	os_atomic_uint32 request_count;
+	U32 sampled_request_count;
+	U32 request_rate;
+};
+
+// Every world is a shard of its own: its own simulation thread, snapshots,
+// history and page cache, so worlds don't contend with each other. Only the
+// workers and event loops serving the requests are shared.
+struct World_Registry
+{
+	World_Instance *instances;
+	U32 count;
 };
 
-void update_to_now(World_Instance *world_instance)
+// Returns the world with the name, null if there is none
+World_Instance *world_registry_find(World_Registry *worlds, const char *name,
+	size_t length)
+{
+	for (U32 i = 0; i < worlds->count; i++) {
+		World_Instance *instance = &worlds->instances[i];
+		if (strlen(instance->name) == length && !memcmp(instance->name, name, length))
+			return instance;
+	}
+	return 0;
+}
+
+// Returns the latest published snapshot, which stays valid until released
+// with `world_release`.
+World_Snapshot *world_acquire(World_Instance *world_instance)
+{
+	for (;;) {
+		World_Snapshot *snapshot = (World_Snapshot*)os_atomic_load_pointer(
+			&world_instance->current);
+		os_atomic_increment(&snapshot->readers);
+
+		// If it's still published after registering as a reader it can't
+		// have been reused in between.
+		if (snapshot == os_atomic_load_pointer(&world_instance->current))
+			return snapshot;
+		os_atomic_decrement(&snapshot->readers);
+	}
+}
+
+void world_release(World_Snapshot *snapshot)
+{
+	os_atomic_decrement(&snapshot->readers);
+}
+
+// Copies the world to an unused snapshot and publishes it.
+void world_publish(World_Instance *world_instance)
+{
+	World_Snapshot *current = (World_Snapshot*)world_instance->current;
+	World_Snapshot *snapshot = world_instance->snapshots;
+	for (; snapshot; snapshot = snapshot->next) {
+		if (snapshot != current && os_atomic_add(&snapshot->readers, 0) == 0)
+			break;
+	}
+
+	if (!snapshot) {
+		snapshot = (World_Snapshot*)calloc(1, sizeof(World_Snapshot));
+		snapshot->next = world_instance->snapshots;
+		world_instance->snapshots = snapshot;
+		world_instance->snapshot_count++;
+	}
+
+	world_copy(&snapshot->world, world_instance->world);
+	snapshot->last_updated = (U64)world_instance->last_updated;
+	os_atomic_store_pointer(&world_instance->current, snapshot);
+}
+
+// Simulates the pending ticks for up to `budget_ms` and publishes the world.
+// At least one step is always taken, so a world that is too slow for its
+// rate still moves. Only called by the simulation thread.
+void world_update(World_Instance *world_instance, float budget_ms)
 {
 	os_timer_mark begin = os_get_timer();
+	World *world = world_instance->world;
+	U64 pending = world_instance->pending_ticks;
+	if (pending == 0)
+		return;
+
+	U64 first_tick = world->tick;
+	U64 count = 0;
+	do {
+		if (world_instance->tick_by_tick) {
+			world_tick(world, world_instance->tick_pool);
+			count++;
+		} else {
+			U64 step = min(pending - count, (U64)WORLD_CATCH_UP_STEP);
+			world_advance(world, step);
+			count += step;
+		}
+	} while (count < pending && os_timer_delta_ms(begin, os_get_timer()) < budget_ms);
 
-	int count = 0;
-	time_t now = time(NULL);
-	while (world_instance->last_updated < now) {
-		count++;
-		world_tick(world_instance->world);
-		world_instance->last_updated++;
+	journal_advance(world_instance->journal, first_tick, count,
+		world_instance->tick_by_tick);
+
+	// Dwarves that have been dead long enough free their slots
+	U32 index;
+	while (world_next_burial(world, &index)) {
+		journal_remove(world_instance->journal, world->tick, dwarf_id(world, index));
+		world_remove_dwarf(world, index);
 	}
+	pending -= count;
+	world_instance->pending_ticks = pending;
+	world_instance->last_updated = time(NULL) - (time_t)(pending / world_instance->tick_rate);
+	world_publish(world_instance);
 
 	os_timer_mark end = os_get_timer();
 
 	float ms = os_timer_delta_ms(begin, end);
-	if (count > 0)
-		printf("Updated world %d ticks: Took %.2fms\n", count, ms);
+	world_instance->update_count++;
+	world_instance->last_update_ms = ms;
+	world_instance->max_update_ms = max(world_instance->max_update_ms, ms);
+	world_instance->total_update_ms += ms;
+	histogram_add(&world_instance->update_us, (U64)(ms * 1000.0f));
+
+	// Regular updates are one tick, only report catching up
+	if (count > 1)
+		printf("Updated world '%s' %llu ticks, %llu behind: Took %.2fms\n",
+			world_instance->name, (unsigned long long)count,
+			(unsigned long long)pending, ms);
 }
 
+// Runs the ticks of the world at `tick_rate` on a periodic timer. The timer
+// keeps time by itself, so slow updates don't make the world drift, they
+// make it fall behind and catch up in the following slices.
 OS_THREAD_ENTRY(thread_background_world_update, world_instance_ptr)
 {
 	World_Instance *world_instance = (World_Instance*)world_instance_ptr;
+	if (!os_thread_pin(world_instance->core))
+		printf("Failed to pin world '%s' to core %u\n", world_instance->name,
+			world_instance->core);
+
+	U32 tick_rate = world_instance->tick_rate;
+	os_ticker ticker;
+	if (!os_ticker_start(&ticker, 1000000000ull / tick_rate)) {
+		printf("Failed to start the timer of world '%s'\n", world_instance->name);
+		return 0;
+	}
+
+	// Half of every period is left free for publishing and for the other
+	// threads on the core
+	float budget_ms = 500.0f / tick_rate;
+
+	// Catch up with the time the server was down
+	time_t now = time(NULL);
+	if (world_instance->last_updated < now)
+		world_instance->pending_ticks = (U64)(now - world_instance->last_updated) * tick_rate;
+
+	for (;;) {
+		world_update(world_instance, budget_ms);
+
+		U64 lag_ns;
+		U64 periods = os_ticker_wait(&ticker, &lag_ns);
+		if (periods == 0)
+			continue;
+		world_instance->pending_ticks += periods;
+		histogram_add(&world_instance->lag_us, lag_ns / 1000);
+		histogram_add(&world_instance->missed_ticks, periods - 1);
+	}
+}
+
+// Saves the latest snapshot, so the simulation keeps ticking meanwhile.
+// Also writes the checkpoints of the history when they are due.
+OS_THREAD_ENTRY(thread_background_world_save, world_instance_ptr)
+{
+	World_Instance *world_instance = (World_Instance*)world_instance_ptr;
+	U32 flags = world_instance->tick_by_tick ? 0 : World_Save_Events;
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/" WORLD_SAVE_PATH, world_instance->directory);
+
+	World_Snapshot *snapshot = world_acquire(world_instance);
+	world_checkpoint(world_instance->journal, &snapshot->world, flags);
+	world_release(snapshot);
 
 	for (;;) {
-		os_mutex_lock(&world_instance->lock);
-		update_to_now(world_instance);
-		os_mutex_unlock(&world_instance->lock);
-		os_sleep_seconds(10);
+		os_sleep_seconds(WORLD_SAVE_INTERVAL);
+
+		os_timer_mark begin = os_get_timer();
+		snapshot = world_acquire(world_instance);
+		bool saved = world_save(&snapshot->world, path, snapshot->last_updated, flags);
+		world_checkpoint(world_instance->journal, &snapshot->world, flags);
+		U64 tick = snapshot->world.tick;
+		world_release(snapshot);
+		os_timer_mark end = os_get_timer();
+
+		if (saved)
+			printf("Saved world '%s' at tick %llu: Took %.2fms\n", world_instance->name,
+				(unsigned long long)tick, os_timer_delta_ms(begin, end));
+		else
+			printf("Failed to save world to '%s'\n", path);
 	}
 }
 
@@ -150,55 +489,205 @@ OS_THREAD_ENTRY(thread_background_stat_update, server_stats)
 	for (;;) {
 
 		os_mutex_lock(&stats->lock);
-		stats->active_thread_counts[stats->snapshot_index] = active_thread_count;
+		stats->pool_occupancies[stats->snapshot_index] =
+			(long)(stats->pool->busy_count + stats->pool->queued_count);
 
 		stats->snapshot_index = (stats->snapshot_index + 1) % stats->snapshot_count;
+
+		for (U32 i = 0; i < stats->worlds->count; i++) {
+			World_Instance *instance = &stats->worlds->instances[i];
+			U32 request_count = instance->request_count;
+			instance->request_rate = request_count - instance->sampled_request_count;
+			instance->sampled_request_count = request_count;
+		}
 		os_mutex_unlock(&stats->lock);
 
 		os_sleep_seconds(1);
 	}
 }
 
-int render_stats(Server_Stats *stats, char *body)
+// Table cells of the stats
+void render_cell(Output *out, U64 value)
+{
+	out_literal(out, "<td>");
+	out_u64(out, value);
+	out_literal(out, "</td>");
+}
+
+void render_cell_ms(Output *out, double ms)
+{
+	out_literal(out, "<td>");
+	out_fixed(out, ms, 2);
+	out_literal(out, "ms</td>");
+}
+
+// Table of the histograms side by side, one row per bucket up to the last
+// non-empty one
+void render_histograms(Output *out, const char **titles, Histogram **histograms,
+	U32 count)
+{
+	U32 bucket_count = 1;
+	out_literal(out, "<table><tr><th>Below</th>");
+	for (U32 i = 0; i < count; i++) {
+		out_literal(out, "<th>");
+		out_string(out, titles[i]);
+		out_literal(out, "</th>");
+		for (U32 b = 0; b < HISTOGRAM_BUCKETS; b++) {
+			if (histograms[i]->buckets[b])
+				bucket_count = max(bucket_count, b + 1);
+		}
+	}
+	out_literal(out, "</tr>");
+
+	for (U32 b = 0; b < bucket_count; b++) {
+		out_literal(out, "<tr>");
+		render_cell(out, 1ull << b);
+		for (U32 i = 0; i < count; i++)
+			render_cell(out, histograms[i]->buckets[b]);
+		out_literal(out, "</tr>");
+	}
+
+	out_literal(out, "<tr><td>Max</td>");
+	for (U32 i = 0; i < count; i++)
+		render_cell(out, histograms[i]->max);
+	out_literal(out, "</tr></table>");
+}
+
+// Point of the pool occupancy graph, the coordinates are in pixels
+void render_graph_point(Output *out, float x, float y)
 {
-	char *ptr = body;
+	out_fixed(out, x, 2);
+	out_literal(out, " ");
+	out_fixed(out, y, 2);
+}
 
-	ptr += sprintf(ptr, "<html><head><title>Server stats</title></head><body>");
-	ptr += sprintf(ptr, "<h5>Active thread count</h5>");
-	ptr += sprintf(ptr, "<svg width=\"400\" height=\"200\">\n");
+int render_stats(Server_Stats *stats, Output *out)
+{
+	Work_Pool *pool = stats->pool;
+
+	out_literal(out, "<html><head><title>Server stats</title></head><body>");
+	out_literal(out, "<h5>Worker pool occupancy</h5><p>");
+	out_u32(out, pool->worker_count);
+	out_literal(out, " workers, ");
+	out_u32(out, (U32)pool->busy_count);
+	out_literal(out, " busy, ");
+	out_u32(out, (U32)pool->queued_count);
+	out_literal(out, " queued, ");
+	out_u32(out, (U32)pool->task_count);
+	out_literal(out, " tasks run, ");
+	out_u32(out, (U32)pool->steal_count);
+	out_literal(out, " stolen, ");
+	out_u32(out, (U32)active_connection_count);
+	out_literal(out, " open connections</p>");
+
+	out_literal(out, "<h5>Worlds</h5><table><tr><th>World</th><th>Core</th>"
+		"<th>Tick</th><th>Ticks/s</th><th>Behind</th><th>Dwarves</th>"
+		"<th>Updates</th><th>Last update</th>"
+		"<th>Average update</th><th>Slowest update</th><th>Requests/s</th>"
+		"<th>Page cache hits</th><th>Page cache misses</th></tr>");
+	for (U32 i = 0; i < stats->worlds->count; i++) {
+		World_Instance *instance = &stats->worlds->instances[i];
+		World_Snapshot *snapshot = world_acquire(instance);
+		U64 tick = snapshot->world.tick;
+		U32 dwarf_count = snapshot->world.dwarves.count;
+		world_release(snapshot);
+
+		U32 update_count = instance->update_count;
+		out_literal(out, "<tr><td><a href=\"/w/");
+		out_string(out, instance->name);
+		out_literal(out, "/dwarves\">");
+		out_string(out, instance->name);
+		out_literal(out, "</a></td>");
+		render_cell(out, instance->core);
+		render_cell(out, tick);
+		render_cell(out, instance->tick_rate);
+		render_cell(out, instance->pending_ticks);
+		render_cell(out, dwarf_count);
+		render_cell(out, update_count);
+		render_cell_ms(out, instance->last_update_ms);
+		render_cell_ms(out, update_count > 0
+			? instance->total_update_ms / update_count : 0.0);
+		render_cell_ms(out, instance->max_update_ms);
+		render_cell(out, instance->request_rate);
+		render_cell(out, (U32)instance->page_cache.hits);
+		render_cell(out, (U32)instance->page_cache.misses);
+		out_literal(out, "</tr>");
+	}
+	out_literal(out, "</table>");
+
+	for (U32 i = 0; i < stats->worlds->count; i++) {
+		World_Instance *instance = &stats->worlds->instances[i];
+		const char *titles[] = { "Update (us)", "Wakeup lag (us)", "Missed ticks" };
+		Histogram *histograms[] = { &instance->update_us, &instance->lag_us,
+			&instance->missed_ticks };
+		out_literal(out, "<h5>Ticks of '");
+		out_string(out, instance->name);
+		out_literal(out, "'</h5>");
+		render_histograms(out, titles, histograms, Count(histograms));
+	}
 
-	long max_thread_count = 1;
+	out_literal(out, "<p>Accepted connections:");
+	for (U32 i = 0; i < listener_count; i++) {
+		out_string(out, i > 0 ? ", " : " ");
+		out_u32(out, (U32)listeners[i].accepted);
+		out_literal(out, " on listener ");
+		out_u32(out, i);
+	}
+	out_literal(out, "</p>");
+
+	U32 local_hits = arena_pool.local_hits;
+	U32 shared_hits = arena_pool.shared_hits;
+	U32 misses = arena_pool.misses;
+	U32 acquires = max(local_hits + shared_hits + misses, 1);
+	out_literal(out, "<p>Arena pool: ");
+	out_u32(out, local_hits + shared_hits + misses);
+	out_literal(out, " acquired, ");
+	out_fixed(out, 100.0 * local_hits / acquires, 1);
+	out_literal(out, "% from the thread free list, ");
+	out_fixed(out, 100.0 * shared_hits / acquires, 1);
+	out_literal(out, "% from the shared free list, ");
+	out_u32(out, misses);
+	out_literal(out, " allocated</p>");
+	out_literal(out, "<svg width=\"400\" height=\"200\">\n");
+
+	long max_occupancy = 1;
 	for (U32 i = 0; i < stats->snapshot_count; i++) {
-		max_thread_count = max(max_thread_count, stats->active_thread_counts[i]);
+		max_occupancy = max(max_occupancy, stats->pool_occupancies[i]);
 	}
 
-	long ruler_size = (long)ceilf((float)max_thread_count / 5);
-	long ruler_count = max_thread_count / ruler_size + 1;
+	long ruler_size = (long)ceilf((float)max_occupancy / 5);
+	long ruler_count = max_occupancy / ruler_size + 1;
 	long graph_height = ruler_count * ruler_size;
 	for (long i = 0; i <= ruler_count; i++) {
 		long value = i * ruler_size;
 		float y = 195.0f - (float)value / graph_height * 170.0f;
-		ptr += sprintf(ptr, "<path d=\"M30 %f L400 %f\" stroke=\"#ddd\" stroke-width=\"1\""
-			" fill=\"none\" />\n", y, y);
-		ptr += sprintf(ptr, "<text x=\"25\" y=\"%f\" text-anchor=\"end\" "
-			"fill=\"gray\">%d</text>", y + 4.0f, (int)value);
+		out_literal(out, "<path d=\"M");
+		render_graph_point(out, 30.0f, y);
+		out_literal(out, " L");
+		render_graph_point(out, 400.0f, y);
+		out_literal(out, "\" stroke=\"#ddd\" stroke-width=\"1\" fill=\"none\" />\n");
+		out_literal(out, "<text x=\"25\" y=\"");
+		out_fixed(out, y + 4.0f, 2);
+		out_literal(out, "\" text-anchor=\"end\" fill=\"gray\">");
+		out_u64(out, (U64)value);
+		out_literal(out, "</text>");
 	}
 
-	ptr += sprintf(ptr, "<path d=\"");
-	char command_char = 'M';
+	out_literal(out, "<path d=\"");
 	for (U32 i = 0; i < stats->snapshot_count; i++) {
 		int snapshot_index = (stats->snapshot_index - 1 - i + stats->snapshot_count)
 			% stats->snapshot_count;
 
 		float x = 400.0f - ((float)i / (stats->snapshot_count - 1)) * 370.0f;
-		float y = 195.0f - (float)stats->active_thread_counts[snapshot_index]
+		float y = 195.0f - (float)stats->pool_occupancies[snapshot_index]
 			/ graph_height * 170.0f;
 
-		ptr += sprintf(ptr, "%c%f %f ", command_char, x, y);
-		command_char = 'L';
+		out_string(out, i > 0 ? "L" : "M");
+		render_graph_point(out, x, y);
+		out_literal(out, " ");
 	}
-	ptr += sprintf(ptr, "\" stroke=\"black\" stroke-width=\"2\" fill=\"none\" />\n");
-	ptr += sprintf(ptr, "</svg>");
+	out_literal(out, "\" stroke=\"black\" stroke-width=\"2\" fill=\"none\" />\n");
+	out_literal(out, "</svg>");
 
 	return 200;
 }
@@ -206,421 +695,1453 @@ int render_stats(Server_Stats *stats, char *body)
 struct Response_Thread_Data
 {
 	os_socket client_socket;
-	World_Instance *world_instance;
-	char *body_storage;
+	World_Registry *worlds;
 	int thread_id;
 };
 
+// Receive buffer of a connection. Requests are parsed in place, so it's
+// large enough to hold a maximum size request plus pipelined data.
+#define SOCKET_BUFFER_SIZE KB(16)
+
 struct Socket_Buffer
 {
 	os_socket socket;
 	char *data;
 	int data_size;
-	int pos;
-	int size;
-	int limit_left;
-};
 
-struct Read_Block
-{
-	char *data;
-	int length;
+	// Amount of received data at the start of `data`
+	int size;
 };
 
-Socket_Buffer buffer_new(os_socket socket, int size=1024)
+// The buffer data is freed with the arena
+Socket_Buffer buffer_new(os_socket socket, Memory_Arena *arena,
+	int size=SOCKET_BUFFER_SIZE)
 {
 	Socket_Buffer buffer = { 0 };
 	buffer.socket = socket;
-	buffer.data = (char*)malloc(size);
+	buffer.data = (char*)arena_push(arena, size);
 	buffer.data_size = size;
 	return buffer;
 }
 
-void buffer_limit(Socket_Buffer *buffer, int bytes)
+// Receives once to the end of the buffer, blocking if the socket is blocking.
+// Returns false if the peer closed the connection, the read failed or the
+// buffer is full.
+bool buffer_receive(Socket_Buffer *buffer)
 {
-	buffer->limit_left = bytes;
+	if (buffer->size >= buffer->data_size)
+		return false;
+
+	int bytes_read = os_socket_recv(buffer->socket, buffer->data + buffer->size,
+		buffer->data_size - buffer->size);
+	if (bytes_read <= 0)
+		return false;
+	buffer->size += bytes_read;
+	return true;
 }
 
-// NOTE: Does not free the socket
-void buffer_free(Socket_Buffer *buffer)
+// Reads as much as fits to the buffer or until the call would block.
+// Returns false if the peer closed the connection or the read failed.
+bool buffer_fill_available(Socket_Buffer *buffer)
 {
-	free(buffer->data);
+	while (buffer->size < buffer->data_size) {
+		int bytes_read = os_socket_recv(buffer->socket, buffer->data + buffer->size,
+			buffer->data_size - buffer->size);
+		if (bytes_read > 0) {
+			buffer->size += bytes_read;
+		} else if (bytes_read < 0 && os_socket_would_block()) {
+			return true;
+		} else {
+			return false;
+		}
+	}
+	return true;
 }
 
-bool buffer_fill_read(Socket_Buffer *buffer)
+// Discards the first `bytes` of the buffer, keeping any pipelined data.
+void buffer_consume(Socket_Buffer *buffer, int bytes)
 {
-	int to_read = min(buffer->data_size, buffer->limit_left);
-	if (to_read <= 0)
-		return false;
+	memmove(buffer->data, buffer->data + bytes, buffer->size - bytes);
+	buffer->size -= bytes;
+}
+
+// Parses the request at the start of the buffer.
+HTTP_Parse_Result buffer_parse_request(Socket_Buffer *buffer, HTTP_Request *request)
+{
+	HTTP_Parse_Result result = http_parse_request(buffer->data,
+		min(buffer->size, HTTP_MAX_REQUEST_SIZE), request);
 
-	int bytes_read = recv(buffer->socket, buffer->data, to_read, 0);
-	buffer->limit_left -= to_read;
-	buffer->size = bytes_read;
-	buffer->pos = 0;
-	return bytes_read > 0;
+	// Don't wait for more than the maximum size
+	if (result == HTTP_Parse_Incomplete && buffer->size >= HTTP_MAX_REQUEST_SIZE)
+		return HTTP_Parse_Error;
+	return result;
 }
 
-bool buffer_peek(Socket_Buffer *buffer, Read_Block *block, int length)
+struct Response_Stream;
+
+struct Response
 {
-	int buffer_left = buffer->size - buffer->pos;
-	if (buffer_left == 0) {
-		if (!buffer_fill_read(buffer))
-			return false;
-		buffer_left = buffer->size - buffer->pos;
-	}
+	int status;
+	const char *content_type;
+	Output body;
 
-	block->data = buffer->data + buffer->pos;
-	block->length = min(length, buffer_left);
-	return true;
+	// Set if the body is sent while it's rendered
+	Response_Stream *stream;
+
+	// Static file sent in place of the body, which keeps the index of the
+	// files referenced until the response has been sent.
+	Static_File *file;
+	Static_Index *static_index;
+
+	// Cached complete response sent in place of everything else
+	Cached_Page *page;
+
+	// Sent as the ETag header if set
+	const char *etag;
+};
+
+void response_init(Response *response, Memory_Arena *arena)
+{
+	out_init(&response->body, arena);
+	response->file = 0;
+	response->static_index = 0;
+	response->page = 0;
+	response->etag = 0;
+	response->stream = 0;
 }
 
-bool buffer_read(Socket_Buffer *buffer, Read_Block *block, int length)
+void set_response(Response *response, const char *content_type, int status)
 {
-	if (!buffer_peek(buffer, block, length))
-		return false;
-	buffer->pos += block->length;
-	return true;
+	response->status = status;
+	response->content_type = content_type;
 }
 
-bool buffer_accept(Socket_Buffer *buffer, const char *value, int length)
+void set_text_response(Response *response, const char *content_type, int status,
+	const char *body)
 {
-	int pos = 0;
-	Read_Block block;
-	while (length - pos > 0) {
-		if (!buffer_read(buffer, &block, length - pos))
-			return false;
-		if (memcmp(block.data, value + pos, block.length))
-			return false;
-		pos += block.length;
-	}
-	return true;
+	set_response(response, content_type, status);
+	out_string(&response->body, body);
 }
 
-int buffer_read_line(Socket_Buffer *buffer, char *line, int length)
+// The status line, headers and body of a response gathered to one vector of
+// buffers, so it can usually be sent with one system call.
+struct Response_Builder
 {
-	int pos = 0;
-	Read_Block block;
-	while (length - pos > 0) {
-		if (!buffer_peek(buffer, &block, length - pos)) return -3;
+	os_io_vec *vecs;
+	int vec_count;
 
-		char *end = (char*)memchr(block.data, '\r', block.length);
-		int in_length = end ? (int)(end - block.data) : block.length;
+	// First buffer with data left to send
+	int next_vec;
 
-		// Check for buffer overflow and null-byte injection
-		if (in_length > length - pos - 1) return -1;
-		if (memchr(block.data, '\0', in_length)) return -4;
+	// File sent after the buffers
+	os_mapped_file *file;
+	U64 file_offset;
+	Static_Index *static_index;
 
-		// Copy until block end or \r
-		memcpy(line + pos, block.data, in_length);
-		buffer->pos += in_length;
-		pos += in_length;
+	Cached_Page *page;
 
-		if (end) {
-			if (!buffer_accept(buffer, "\r\n", 2)) return -2;
-			line[pos] = '\0';
-			return pos;
-		}
-	}
+	// Bytes sent so far
+	U64 sent;
+};
 
-	// Reached the end of the line buffer without finding a \r
-	return -1;
+// Writes the decimal representation of `value` to `dest`, returns the
+// number of characters written.
+int format_u64(char *dest, U64 value)
+{
+	char digits[20];
+	char *start = format_u64_backwards(digits + sizeof(digits), value);
+	int count = (int)(digits + sizeof(digits) - start);
+	memcpy(dest, start, count);
+	return count;
 }
 
-void send_response(os_socket socket, const char *content_type, int status,
-	const char *body, size_t body_length)
+char *append_string(char *dest, const char *string, size_t length)
 {
-	const char *status_desc = get_http_status_description(status);
-	char response_start[128];
-	sprintf(response_start, "HTTP/1.1 %d %s\r\n", status, status_desc);
+	memcpy(dest, string, length);
+	return dest + length;
+}
+
+// Most output chunks sent with one system call while streaming
+#define STREAM_BATCH_CHUNKS 16
+
+// Sends a body while it's being rendered. Once the body grows past
+// `OUTPUT_STREAM_THRESHOLD` the headers are sent with `Transfer-Encoding:
+// chunked`, followed by every full chunk of the output as a chunk of the
+// encoding. Chunks taken by the socket are reused for the rest of the body,
+// so as long as the client keeps up a body of any size is rendered in the
+// same few chunks. What a non-blocking socket doesn't take stays in the
+// output and is sent with the rest of the response.
+struct Response_Stream
+{
+	os_socket socket;
+	Response *response;
+
+	// Status line and headers, built when the stream starts
+	char *headers;
+	int headers_length;
 
-	char content_length_header[128];
-	sprintf(content_length_header, "Content-Length: %d\r\n", (int)body_length);
-	char content_type_header[128];
-	sprintf(content_type_header, "Content-Type: %s\r\n", content_type);
-	const char *separator = "\r\n";
+	// Bytes sent of the headers and of the encoding of the first chunk
+	int headers_sent;
+	int chunk_sent;
 
-	os_socket_send(socket, response_start, (int)strlen(response_start));
-	os_socket_send(socket, content_length_header, (int)strlen(content_length_header));
-	os_socket_send(socket, content_type_header, (int)strlen(content_type_header));
-	os_socket_send(socket, separator, (int)strlen(separator));
-	os_socket_send_and_flush(socket, body, (int)strlen(body));
+	bool started;
+
+	// The socket failed, the rest of the body is dropped
+	bool failed;
+};
+
+static const char chunk_line_end[] = "\r\n";
+static const char chunk_last[] = "0\r\n\r\n";
+
+// Writes the size line of an encoded chunk of `length` bytes to `dest`,
+// which needs room for 10 characters. Returns the number of characters
+// written.
+int format_chunk_size(char *dest, U32 length)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	char digits[8];
+	int count = 0;
+	do {
+		digits[count++] = hex_digits[length & 0xF];
+		length >>= 4;
+	} while (length);
+
+	for (int i = 0; i < count; i++)
+		dest[i] = digits[count - 1 - i];
+	dest[count] = '\r';
+	dest[count + 1] = '\n';
+	return count + 2;
 }
 
-void send_text_response(os_socket socket, const char *content_type, int status,
-	const char *body)
+// Gathers the unsent headers and up to `max_chunks` encoded chunks of the
+// body to `vecs`, which needs room for `1 + 3 * max_chunks` buffers. The
+// size lines are written to `size_lines`. Returns the number of buffers.
+int response_stream_gather(Response_Stream *stream, os_io_vec *vecs,
+	char (*size_lines)[12], int max_chunks)
 {
-	send_response(socket, content_type, status, body, strlen(body));
+	int count = 0;
+	if (stream->headers_sent < stream->headers_length) {
+		vecs[count++] = os_io_vec_make(stream->headers + stream->headers_sent,
+			stream->headers_length - stream->headers_sent);
+	}
+
+	// A chunk of size zero would end the body, so empty ones are skipped
+	int first_vec = count;
+	int chunk_count = 0;
+	for (Output_Chunk *chunk = stream->response->body.first;
+			chunk && chunk_count < max_chunks; chunk = chunk->next) {
+		if (chunk->length == 0)
+			continue;
+		char *size_line = size_lines[chunk_count++];
+		vecs[count++] = os_io_vec_make(size_line,
+			format_chunk_size(size_line, (U32)chunk->length));
+		vecs[count++] = os_io_vec_make(chunk->data, chunk->length);
+		vecs[count++] = os_io_vec_make(chunk_line_end, sizeof(chunk_line_end) - 1);
+	}
+
+	size_t skip = (size_t)stream->chunk_sent;
+	for (int i = first_vec; skip > 0; i++) {
+		size_t consumed = min(skip, os_io_vec_length(&vecs[i]));
+		os_io_vec_consume(&vecs[i], consumed);
+		skip -= consumed;
+	}
+	return count;
 }
 
-OS_THREAD_ENTRY(thread_do_response, thread_data)
+// Marks `sent` bytes gathered by `response_stream_gather` as sent and
+// recycles the chunks that were sent completely.
+void response_stream_advance(Response_Stream *stream, size_t sent)
 {
-	Response_Thread_Data *data = (Response_Thread_Data*)thread_data;
-	os_socket client_socket = data->client_socket;
-	World_Instance *world_instance = data->world_instance;
-	char *body = data->body_storage;
+	Output *body = &stream->response->body;
+	size_t headers_taken = min(sent,
+		(size_t)(stream->headers_length - stream->headers_sent));
+	stream->headers_sent += (int)headers_taken;
+	sent -= headers_taken;
+
+	char size_line[12];
+	while (body->first) {
+		Output_Chunk *chunk = body->first;
+		size_t encoded = chunk->length > 0 ? format_chunk_size(size_line,
+			(U32)chunk->length) + chunk->length + sizeof(chunk_line_end) - 1 : 0;
+		size_t left = encoded - stream->chunk_sent;
+		if (left > sent) {
+			stream->chunk_sent += (int)sent;
+			break;
+		}
+		sent -= left;
+		stream->chunk_sent = 0;
+		out_recycle_first(body);
+	}
+}
 
-	os_atomic_increment(&active_thread_count);
+// Flush callback of the body of a streamed response
+void response_stream_flush(Output *body, void *stream_ptr)
+{
+	Response_Stream *stream = (Response_Stream*)stream_ptr;
+	if (stream->failed) {
+		while (body->first)
+			out_recycle_first(body);
+		return;
+	}
 
-	Socket_Buffer buffer = buffer_new(client_socket);
+	if (!stream->started) {
+		Response *response = stream->response;
+		const HTTP_Status_Line *status_line = get_http_status_line(response->status);
+		const char encoding_header[] = "Transfer-Encoding: chunked\r\nContent-Type: ";
+		const char line_end[] = "\r\n";
+		int content_type_length = (int)strlen(response->content_type);
+
+		stream->headers = (char*)arena_push(body->arena, status_line->length
+			+ sizeof(encoding_header) + content_type_length + 2 * sizeof(line_end));
+		char *ptr = stream->headers;
+		ptr = append_string(ptr, status_line->text, status_line->length);
+		ptr = append_string(ptr, encoding_header, sizeof(encoding_header) - 1);
+		ptr = append_string(ptr, response->content_type, content_type_length);
+		ptr = append_string(ptr, line_end, sizeof(line_end) - 1);
+		ptr = append_string(ptr, line_end, sizeof(line_end) - 1);
+		stream->headers_length = (int)(ptr - stream->headers);
+		stream->started = true;
+	}
 
 	for (;;) {
+		os_io_vec vecs[1 + 3 * STREAM_BATCH_CHUNKS];
+		char size_lines[STREAM_BATCH_CHUNKS][12];
+		int count = response_stream_gather(stream, vecs, size_lines, STREAM_BATCH_CHUNKS);
+		if (count == 0)
+			return;
+
+		int sent = os_socket_send_vectored(stream->socket, vecs, count, true);
+		if (sent < 0 && os_socket_would_block())
+			return;
+		if (sent <= 0) {
+			stream->failed = true;
+			while (body->first)
+				out_recycle_first(body);
+			return;
+		}
+		response_stream_advance(stream, (size_t)sent);
+	}
+}
 
-		// Allow only 8kB of request line and headers, but reset on every request
-		buffer_limit(&buffer, KB(8));
+// Makes the body of the response stream to `socket` once it's large enough.
+// The status is 200, the page needs to fail before writing much if it can.
+// Clients older than HTTP/1.1 don't know the chunked encoding and always get
+// the complete body.
+void response_stream_begin(Response *response, os_socket socket,
+	HTTP_Request *request, const char *content_type)
+{
+	set_response(response, content_type, 200);
+	if (strcmp(request->version.data, "HTTP/1.1"))
+		return;
+
+	Output *body = &response->body;
+	Response_Stream *stream = (Response_Stream*)arena_push(body->arena,
+		sizeof(Response_Stream));
+	memset(stream, 0, sizeof(Response_Stream));
+	stream->socket = socket;
+	stream->response = response;
+	response->stream = stream;
+	body->flush = response_stream_flush;
+	body->flush_data = stream;
+}
 
-		char line[256];
-		if (buffer_read_line(&buffer, line, sizeof(line)) < 0)
-			break;
+// Points the builder to the response, the vector and headers are allocated
+// from `arena`, the body is referenced in place.
+void response_build(Response_Builder *builder, Response *response,
+	Memory_Arena *arena)
+{
+	Output *body = &response->body;
+	int chunk_count = 0;
+	for (Output_Chunk *chunk = body->first; chunk; chunk = chunk->next)
+		chunk_count++;
+
+	// A started stream encodes every chunk with a size line and a line end
+	Response_Stream *stream = response->stream;
+	bool streamed = stream && stream->started;
+	int vec_capacity = 2 + (streamed ? 3 : 1) * chunk_count;
+
+	builder->vecs = (os_io_vec*)arena_push(arena, vec_capacity * sizeof(os_io_vec));
+	builder->vec_count = 0;
+	builder->next_vec = 0;
+	builder->sent = 0;
+	builder->file = 0;
+	builder->file_offset = 0;
+	builder->static_index = response->static_index;
+	builder->page = response->page;
+
+	// The rest of a started stream, ended by the last chunk
+	if (streamed) {
+		if (stream->failed)
+			return;
+		char (*size_lines)[12] = (char(*)[12])arena_push(arena, chunk_count * 12 + 1);
+		builder->vec_count = response_stream_gather(stream, builder->vecs, size_lines,
+			chunk_count);
+		builder->vecs[builder->vec_count++] = os_io_vec_make(chunk_last,
+			sizeof(chunk_last) - 1);
+		return;
+	}
 
-		os_timer_mark begin_respond = os_get_timer();
+	if (response->page) {
+		builder->vecs[builder->vec_count++] = os_io_vec_make(response->page->data,
+			response->page->length);
+		return;
+	}
 
-		char method[64];
-		char path[2048];
-		char http_version[32];
+	const HTTP_Status_Line *status_line = get_http_status_line(response->status);
+	builder->vecs[builder->vec_count++] = os_io_vec_make(status_line->text,
+		status_line->length);
 
-		if(sscanf(line, "%s %s %s\r\n", method, path, http_version) == EOF)
-		{
-			const char *body = "<html><body><h1>400 - Bad Request</h1></body></html>";
-			send_text_response(client_socket, "text/html", 400, body);
-			break;
+	if (response->file) {
+		Static_File *file = response->file;
+		builder->vecs[builder->vec_count++] = os_io_vec_make(file->headers,
+			file->headers_length);
+		builder->file = &file->mapping;
+		return;
+	}
+
+	const char length_header[] = "Content-Length: ";
+	const char type_header[] = "\r\nContent-Type: ";
+	const char etag_header[] = "ETag: ";
+	const char line_end[] = "\r\n";
+	int content_type_length = (int)strlen(response->content_type);
+	int etag_length = response->etag ? (int)strlen(response->etag) : 0;
+
+	char *headers = (char*)arena_push(arena, sizeof(length_header) + 20
+		+ sizeof(type_header) + content_type_length + sizeof(etag_header)
+		+ etag_length + 3 * sizeof(line_end));
+	char *ptr = headers;
+
+	// Not Modified has no body, so it doesn't describe one either
+	if (response->status != 304) {
+		ptr = append_string(ptr, length_header, sizeof(length_header) - 1);
+		ptr += format_u64(ptr, body->length);
+		ptr = append_string(ptr, type_header, sizeof(type_header) - 1);
+		ptr = append_string(ptr, response->content_type, content_type_length);
+		ptr = append_string(ptr, line_end, sizeof(line_end) - 1);
+	}
+	if (response->etag) {
+		ptr = append_string(ptr, etag_header, sizeof(etag_header) - 1);
+		ptr = append_string(ptr, response->etag, etag_length);
+		ptr = append_string(ptr, line_end, sizeof(line_end) - 1);
+	}
+	ptr = append_string(ptr, line_end, sizeof(line_end) - 1);
+	builder->vecs[builder->vec_count++] = os_io_vec_make(headers, ptr - headers);
+
+	for (Output_Chunk *chunk = body->first; chunk; chunk = chunk->next) {
+		if (chunk->length > 0)
+			builder->vecs[builder->vec_count++] = os_io_vec_make(chunk->data, chunk->length);
+	}
+}
+
+inline bool response_sent(Response_Builder *builder)
+{
+	return builder->next_vec == builder->vec_count
+		&& (!builder->file || builder->file_offset == builder->file->size);
+}
+
+// Sends as much of the response as the socket takes. Returns false if the
+// socket failed, true if everything was sent or the socket would block.
+bool response_send(Response_Builder *builder, os_socket socket)
+{
+	while (builder->next_vec < builder->vec_count) {
+		int sent = os_socket_send_vectored(socket, builder->vecs + builder->next_vec,
+			builder->vec_count - builder->next_vec, builder->file != 0);
+		if (sent < 0)
+			return os_socket_would_block();
+		if (sent == 0)
+			return false;
+		builder->sent += (U64)sent;
+
+		size_t left = (size_t)sent;
+		while (left > 0) {
+			os_io_vec *vec = &builder->vecs[builder->next_vec];
+			size_t consumed = min(left, os_io_vec_length(vec));
+			os_io_vec_consume(vec, consumed);
+			left -= consumed;
+			if (os_io_vec_length(vec) == 0)
+				builder->next_vec++;
 		}
+	}
+
+	while (!response_sent(builder)) {
+		int sent = os_socket_send_file(socket, builder->file, &builder->file_offset,
+			builder->file->size - builder->file_offset);
+		if (sent < 0)
+			return os_socket_would_block();
+		if (sent == 0)
+			return false;
+		builder->sent += (U64)sent;
+	}
+	return true;
+}
+
+// Releases what the response referenced, needs to be called once the
+// response has been sent or abandoned.
+void response_finish(Response_Builder *builder)
+{
+	if (builder->static_index) {
+		static_release(builder->static_index);
+		builder->static_index = 0;
+	}
+	if (builder->page) {
+		page_release(builder->page);
+		builder->page = 0;
+	}
+}
 
+// Sends the whole response to a blocking socket.
+void send_response(os_socket socket, Response *response, Memory_Arena *arena)
+{
+	Response_Builder builder;
+	response_build(&builder, response, arena);
+	response_send(&builder, socket);
+	response_finish(&builder);
+}
 
-		bool failed = false;
-		while (strlen(line)) {
-			if (buffer_read_line(&buffer, line, sizeof(line)) < 0) {
-				failed = true;
-				break;
-			}
+// Stores the complete bytes of a rendered response to the page.
+void page_store_response(Cached_Page *page, Response *response)
+{
+	Response_Builder builder;
+	response_build(&builder, response, page->arena);
+
+	size_t length = 0;
+	for (int i = 0; i < builder.vec_count; i++)
+		length += os_io_vec_length(&builder.vecs[i]);
+
+	char *data = (char*)arena_push(page->arena, length);
+	char *ptr = data;
+	for (int i = 0; i < builder.vec_count; i++) {
+		os_io_vec *vec = &builder.vecs[i];
+		ptr = append_string(ptr, os_io_vec_data(vec), os_io_vec_length(vec));
+	}
+
+	page->data = data;
+	page->length = length;
+}
+
+// Returns the version of the world data shown on a page, which changes
+// whenever the page would. Returns false if the page doesn't exist.
+bool page_version(World *world, Route_Kind route, U32 id, U64 *version)
+{
+	if (route == Route_Entity || route == Route_Entity_Avatar || route == Route_Entity_Feed) {
+		U32 index;
+		if (!find_dwarf(world, id, &index))
+			return false;
+
+		// Avatars only depend on the seed of the dwarf and the feed changes
+		// with every new post by the dwarf. Hunger and sleep change every
+		// tick until the dwarf dies.
+		if (route == Route_Entity_Avatar)
+			*version = 0;
+		else if (route == Route_Entity_Feed)
+			*version = world->dwarves.last_post[index];
+		else
+			*version = world->dwarves.alive[index] ? world->tick
+				: world->dwarves.death_tick[index];
+		return true;
+	} else if (route == Route_Location) {
+		Location *location = find_location(world, id);
+		if (!location)
+			return false;
+		*version = location->version;
+		return true;
+	}
+
+	*version = world->version;
+	return true;
+}
+
+inline void format_page_etag(char *dest, size_t size, U64 version)
+{
+	snprintf(dest, size, "\"%x-%llx\"", server_epoch, (unsigned long long)version);
+}
+
+int render_world_page(World *world, Route_Kind route, U32 id, U64 before, Output *out)
+{
+	switch (route) {
+	case Route_Dwarves: return render_dwarves(world, out);
+	case Route_Feed: return render_feed(world, before, out);
+	case Route_Entity: return render_entity(world, id, out);
+	case Route_Entity_Avatar: return render_entity_avatar(world, id, out);
+	case Route_Entity_Feed: return render_entity_feed(world, id, before, out);
+	case Route_Locations: return render_locations(world, out);
+	case Route_Location: return render_location(world, id, out);
+	default: return 500;
+	}
+}
+
+// Renders the response for the request to memory allocated from `arena`.
+// Pages with an ETag matching the If-None-Match header of the request are
+// answered with 304 Not Modified. Large pages that aren't cached are
+// streamed to `socket` while rendering, the rest of the response needs to
+// be sent afterwards like any other.
+void handle_request(World_Registry *worlds, HTTP_Request *request,
+	os_socket socket, Memory_Arena *arena, Response *response)
+{
+	response_init(response, arena);
+
+	const char *path = request->path.data;
+	String_View if_none_match = request->if_none_match;
+
+	// Paths under `/w/:world` go to that world, the rest to the first one
+	World_Instance *world_instance = &worlds->instances[0];
+	if (!strncmp(path, "/w/", 3)) {
+		const char *name = path + 3;
+		const char *name_end = strchr(name, '/');
+		size_t name_length = name_end ? (size_t)(name_end - name) : strlen(name);
+		world_instance = world_registry_find(worlds, name, name_length);
+		if (!world_instance) {
+			set_text_response(response, "text/html", 404,
+				"<html><body><h1>404 - No such world</h1></body></html>");
+			return;
 		}
-		if (failed)
-			break;
+		path = name_end ? name_end : "/";
+	}
+	os_atomic_increment(&world_instance->request_count);
 
-		U32 id;
-		if (!strcmp(path, "/favicon.ico")) {
-			FILE *icon = fopen("data/icon.ico", "rb");
-			fseek(icon, 0, SEEK_END);
-			int size = ftell(icon);
-			fseek(icon, 0, SEEK_SET);
-
-			const char *response_start = "HTTP/1.1 200 OK\r\n";
-			char content_length[128];
-			sprintf(content_length, "Content-Length: %d\r\n", size);
-			const char *content_type = "Content-Type: image/x-icon\r\n";
-			const char *separator = "\r\n";
-
-			os_socket_send(client_socket, response_start, (int)strlen(response_start));
-			os_socket_send(client_socket, content_length, (int)strlen(content_length));
-			os_socket_send(client_socket, content_type, (int)strlen(content_type));
-			os_socket_send(client_socket, separator, (int)strlen(separator));
-
-			while (!feof(icon)) {
-				char iconbuf[512];
-				int num = (int)fread(iconbuf, 1, sizeof(iconbuf), icon);
-
-				if (feof(icon)) {
-					os_socket_send_and_flush(client_socket, iconbuf, num);
-				} else {
-					os_socket_send(client_socket, iconbuf, num);
-				}
-			}
+	Route_Match match;
+	Route_Kind route = route_match(path, &match);
 
-			fclose(icon);
+	if (route == Route_Static) {
+		Static_File *file = static_find(path, &response->static_index);
+		if (!file) {
+			set_text_response(response, "text/html", 404,
+				"<html><body><h1>404 - Not Found</h1></body></html>");
+			return;
+		}
 
-		} else if (!strcmp(path, "/dwarves")) {
+		if (http_etag_matches(if_none_match, file->etag)) {
+			response->etag = file->etag;
+			set_response(response, file->content_type, 304);
+			return;
+		}
 
-			os_mutex_lock(&world_instance->lock);
-			update_to_now(world_instance);
-			int status = render_dwarves(world_instance->world, body);
-			os_mutex_unlock(&world_instance->lock);
+		response->file = file;
+		set_response(response, file->content_type, 200);
+		return;
+	}
 
-			send_response(client_socket, "text/html", status, body, strlen(body));
+	if (route == Route_Stats) {
+		os_mutex_lock(&global_stats.lock);
+		int status = render_stats(&global_stats, &response->body);
+		os_mutex_unlock(&global_stats.lock);
 
-		} else if (!strcmp(path, "/feed")) {
+		set_response(response, "text/html", status);
+		return;
+	}
 
-			os_mutex_lock(&world_instance->lock);
-			update_to_now(world_instance);
-			int status = render_feed(world_instance->world, body);
-			os_mutex_unlock(&world_instance->lock);
+	if (route == Route_None) {
+		set_text_response(response, "text/html", 200,
+			"<html><body><h1>Hello world!</h1></body></html>");
+		return;
+	}
 
-			send_text_response(client_socket, "text/html", status, body);
-		
-			// TODO: Seriously need a real routing scheme
-		} else if (sscanf(path, "/entities/%d", &id) == 1 && strstr(path, "avatar.svg")) {
+	// Everything else renders the world, which only changes once per tick
+	U32 id = match.capture_count > 0 ? match.captures[0] : 0;
+	U64 before = UINT64_MAX;
+	bool paged = (route == Route_Feed || route == Route_Entity_Feed)
+		&& http_query_u64(request->query, "before", &before);
+	const char *content_type = route == Route_Entity_Avatar
+		? "image/svg+xml" : "text/html";
+
+	// Past worlds are rebuilt from the history and never change, they are
+	// rendered every time and streamed. The cached pages are rendered with
+	// their slot locked, so those are never held up by a slow client.
+	U64 at;
+	if (http_query_u64(request->query, "at", &at)) {
+		int status;
+		History_World *past = history_acquire(world_instance->history, at, &status);
+		if (!past) {
+			set_text_response(response, "text/html", status, status == 404
+				? "<html><body><h1>404 - No history of that tick</h1></body></html>"
+				: "<html><body><h1>503 - Too busy rebuilding history</h1></body></html>");
+			return;
+		}
+		response_stream_begin(response, socket, request, content_type);
+		status = render_world_page(&past->world, route, id, before, &response->body);
+		history_release(world_instance->history, past);
+		response->status = status;
+		return;
+	}
 
-			os_mutex_lock(&world_instance->lock);
-			update_to_now(world_instance);
-			int status = render_entity_avatar(world_instance->world, id, body);
-			os_mutex_unlock(&world_instance->lock);
+	World_Snapshot *snapshot = world_acquire(world_instance);
+	U64 tick = snapshot->world.tick;
+
+	// Only the latest page of a feed is cached, older pages are rendered
+	// every time
+	if (paged) {
+		response_stream_begin(response, socket, request, content_type);
+		int status = render_world_page(&snapshot->world, route, id, before,
+			&response->body);
+		world_release(snapshot);
+		response->status = status;
+		return;
+	}
 
-			send_text_response(client_socket, "image/svg+xml", status, body);
+	Page_Cache_Slot *slot;
+	Cached_Page *page = page_cache_lookup(&world_instance->page_cache, route, id,
+		tick, &slot);
+	if (page) {
+		if (page->etag[0] && http_etag_matches(if_none_match, page->etag)) {
+			response->etag = arena_push_string(arena, page->etag,
+				(int)strlen(page->etag));
+			set_response(response, content_type, 304);
+			page_release(page);
+			world_release(snapshot);
+			return;
+		}
+		response->page = page;
+		world_release(snapshot);
+		return;
+	}
 
-		} else if (sscanf(path, "/entities/%d", &id) == 1) {
+	World *world = &snapshot->world;
 
-			os_mutex_lock(&world_instance->lock);
-			update_to_now(world_instance);
-			int status = render_entity(world_instance->world, id, body);
-			os_mutex_unlock(&world_instance->lock);
+	char etag[sizeof(page->etag)];
+	etag[0] = '\0';
+	U64 version;
+	if (page_version(world, route, id, &version))
+		format_page_etag(etag, sizeof(etag), version);
 
-			send_text_response(client_socket, "text/html", status, body);
+	// Only the version needs to be read to know the page hasn't changed
+	if (etag[0] && http_etag_matches(if_none_match, etag)) {
+		world_release(snapshot);
+		page_cache_cancel(slot);
 
-		} else if (!strcmp(path, "/locations")) {
+		response->etag = arena_push_string(arena, etag, (int)strlen(etag));
+		set_response(response, content_type, 304);
+		return;
+	}
 
-			os_mutex_lock(&world_instance->lock);
-			update_to_now(world_instance);
-			int status = render_locations(world_instance->world, body);
-			os_mutex_unlock(&world_instance->lock);
+	page = page_create();
+	Response rendered;
+	response_init(&rendered, page->arena);
 
-			send_text_response(client_socket, "text/html", status, body);
+	int status = render_world_page(world, route, id, UINT64_MAX, &rendered.body);
 
-		} else if (sscanf(path, "/locations/%d", &id) == 1) {
+	page->tick = tick;
+	world_release(snapshot);
 
-			os_mutex_lock(&world_instance->lock);
-			update_to_now(world_instance);
-			int status = render_location(world_instance->world, id, body);
-			os_mutex_unlock(&world_instance->lock);
+	if (etag[0]) {
+		memcpy(page->etag, etag, sizeof(etag));
+		rendered.etag = page->etag;
+	}
+	set_response(&rendered, content_type, status);
+	page_store_response(page, &rendered);
+	page_cache_store(slot, route, id, page);
 
-			send_text_response(client_socket, "text/html", status, body);
+	response->page = page;
+}
 
-		} else if (!strcmp(path, "/stats")) {
+// Serves a blocking connection until the client leaves, used when there is
+// no event loop. Every connection has a thread of its own, so idle clients
+// never hold up the workers.
+OS_THREAD_ENTRY(thread_serve_connection, thread_data)
+{
+	Response_Thread_Data *data = (Response_Thread_Data*)thread_data;
+	os_socket client_socket = data->client_socket;
+	World_Registry *worlds = data->worlds;
 
-			os_mutex_lock(&global_stats.lock);
-			int status = render_stats(&global_stats, body);
-			os_mutex_unlock(&global_stats.lock);
+	// The connection arena lives until the client leaves, the request arena
+	// is recycled after every response.
+	Memory_Arena *arena = arena_acquire();
+	Socket_Buffer buffer = buffer_new(client_socket, arena);
+	bool corked = socket_prepare(client_socket);
 
-			send_text_response(client_socket, "text/html", status, body);
+	for (;;) {
+		HTTP_Request request;
+		HTTP_Parse_Result result = buffer_parse_request(&buffer, &request);
+		if (result == HTTP_Parse_Incomplete) {
+			if (!buffer_receive(&buffer))
+				break;
+			continue;
+		}
 
-		}  else {
-			const char *body = "<html><body><h1>Hello world!</h1></body></html>";
-			send_text_response(client_socket, "text/html", 200, body);
+		os_timer_mark begin_respond = os_get_timer();
+		Memory_Arena *request_arena = arena_acquire();
+		Response response;
+
+		if (result == HTTP_Parse_Error) {
+			response_init(&response, request_arena);
+			set_text_response(&response, "text/html", 400,
+				"<html><body><h1>400 - Bad Request</h1></body></html>");
+			send_response(client_socket, &response, request_arena);
+			arena_release(request_arena);
+			break;
 		}
 
+		handle_request(worlds, &request, client_socket, request_arena, &response);
+		send_response(client_socket, &response, request_arena);
+		arena_release(request_arena);
+
 		float ms = os_timer_delta_ms(begin_respond, os_get_timer());
-		printf("%d: Request %s %s (took %.2f ms)\n", data->thread_id, method, path, ms);
+		printf("%d: Request %s %s (took %.2f ms)\n", data->thread_id,
+			request.method.data, request.path.data, ms);
+
+		bool keep_alive = http_keep_alive(&request);
+		buffer_consume(&buffer, request.length);
+		if (!keep_alive)
+			break;
+
+		// Push the responses out when there are no pipelined requests left
+		if (corked && buffer.size == 0)
+			os_socket_push(client_socket);
 	}
 
 	os_socket_stop_recv(client_socket);
 	os_socket_close(client_socket);
 
-	buffer_free(&buffer);
-	free(body);
+	arena_release(arena);
+	arena_thread_exit();
 	free(thread_data);
 
-	os_atomic_decrement(&active_thread_count);
-
-	OS_THREAD_RETURN;
+	os_atomic_decrement(&active_connection_count);
+	return 0;
 }
 
-int main(int argc, char **argv)
+// Non-blocking connections are driven by a small fixed number of event loop
+// threads. Each connection is a state machine that is advanced whenever its
+// socket becomes readable or writable. Once a complete request has been
+// read the connection is handed to the worker pool, which responds to it and
+// re-arms the socket with the loop when it needs to wait again.
+
+enum Connection_State
 {
-	os_startup();
+	Connection_Read_Request,
+	Connection_Write_Response,
+	Connection_Closed,
+};
 
-	static char err_buffer[128];
+// Why `connection_process` returned
+enum Connection_Step
+{
+	Step_Wait,
+	Step_Request_Ready,
+	Step_Closed,
+};
 
-	signal(SIGINT, handle_kill);
+struct Event_Loop;
 
-	global_stats.snapshot_count = 100;
-	global_stats.active_thread_counts = (long*)calloc(global_stats.snapshot_count, sizeof(long));
-	os_mutex_init(&global_stats.lock);
+struct Connection
+{
+	os_socket socket;
+	Connection_State state;
+	int id;
+	time_t last_active;
+	bool close_after_response;
 
-	struct addrinfo *addr = NULL;
-	struct addrinfo hints = { 0 };
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-	hints.ai_flags = AI_PASSIVE;
+	// See `Socket_Mode`, a corked socket needs to be pushed after writing
+	bool corked;
+	bool needs_push;
 
-	getaddrinfo(NULL, DORF_PORT, &hints, &addr);
+	// Set while a worker owns the connection
+	bool busy;
 
-	server_socket = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-	if (bind(server_socket, addr->ai_addr, (int)addr->ai_addrlen)) {
-		os_socket_format_last_error(err_buffer, sizeof(err_buffer));
-		printf("Failed to bind socket: %s\n", err_buffer);
-	}
-	if (listen(server_socket, SOMAXCONN)) {
-		os_socket_format_last_error(err_buffer, sizeof(err_buffer));
-		printf("Failed to bind socket: %s\n", err_buffer);
+	Event_Loop *loop;
+
+	// Holds the receive buffer for the lifetime of the connection
+	Memory_Arena *arena;
+
+	// Request bytes received so far, `request` is parsed in place from the
+	// start of the buffer once it's complete (or invalid).
+	Socket_Buffer buffer;
+	HTTP_Request request;
+	HTTP_Parse_Result parse_result;
+
+	// Holds the response until it has been sent
+	Memory_Arena *response_arena;
+	Response_Builder response;
+
+	Connection *prev, *next;
+};
+
+struct Event_Loop
+{
+	os_event_loop loop;
+	World_Registry *worlds;
+	Work_Pool *pool;
+
+	// Protects `connections`, which is modified by the acceptor, the loop and
+	// the workers.
+	os_mutex lock;
+	Connection *connections;
+};
+
+// Responds to the parsed request at the start of the buffer.
+void connection_respond(Connection *connection)
+{
+	HTTP_Request *request = &connection->request;
+	os_timer_mark begin_respond = os_get_timer();
+
+	connection->response_arena = arena_acquire();
+
+	Response response;
+	if (connection->parse_result != HTTP_Parse_Ok) {
+		response_init(&response, connection->response_arena);
+		set_text_response(&response, "text/html", 400,
+			"<html><body><h1>400 - Bad Request</h1></body></html>");
+		connection->close_after_response = true;
+		request->length = connection->buffer.size;
+	} else {
+		handle_request(connection->loop->worlds, request, connection->socket,
+			connection->response_arena, &response);
+		connection->close_after_response = !http_keep_alive(request);
+
+		float ms = os_timer_delta_ms(begin_respond, os_get_timer());
+		printf("%d: Request %s %s (took %.2f ms)\n", connection->id,
+			request->method.data, request->path.data, ms);
 	}
 
-	freeaddrinfo(addr);
+	response_build(&connection->response, &response, connection->response_arena);
+	connection->state = Connection_Write_Response;
+	buffer_consume(&connection->buffer, request->length);
+}
 
-	const char *names[] = {
-		"Urist", "Gimli", "Thir", "Tharun", "Dofor", "Ufir",
-		"Bohir",
-	};
+// Advances the connection state machine as far as the socket allows. Stops
+// when a request is ready unless `respond` is set, in which case the request
+// is responded to on the current thread.
+Connection_Step connection_process(Connection *connection, bool readable,
+	bool respond)
+{
+	for (;;) {
+		if (connection->state == Connection_Read_Request) {
+			if (readable) {
+				int size = connection->buffer.size;
+				if (!buffer_fill_available(&connection->buffer)) {
+					connection->state = Connection_Closed;
+					continue;
+				}
+				readable = false;
 
-	puts("Dorfbook serving at port " DORF_PORT);
-	puts("Enter ^C to stop");
+				// Only traffic keeps the connection from the idle sweep
+				if (connection->buffer.size > size)
+					connection->last_active = time(NULL);
+			}
 
-	char name_buf[512], *name_ptr = name_buf;
+			connection->parse_result = buffer_parse_request(&connection->buffer,
+				&connection->request);
+			if (connection->parse_result == HTTP_Parse_Incomplete) {
+				// Going idle, so push out what has been held back
+				if (connection->needs_push) {
+					os_socket_push(connection->socket);
+					connection->needs_push = false;
+				}
+				return Step_Wait;
+			} else if (respond) {
+				connection_respond(connection);
+			} else {
+				return Step_Request_Ready;
+			}
 
-	static World world = { 0 };
-	world.random_series = series_from_seed32(0xD02F);
+		} else if (connection->state == Connection_Write_Response) {
+			U64 sent = connection->response.sent;
+			if (!response_send(&connection->response, connection->socket)) {
+				connection->state = Connection_Closed;
+				continue;
+			}
+			if (connection->response.sent > sent)
+				connection->last_active = time(NULL);
+			if (!response_sent(&connection->response))
+				return Step_Wait;
+
+			response_finish(&connection->response);
+			arena_release(connection->response_arena);
+			connection->response_arena = 0;
+			connection->needs_push = connection->corked;
+			if (connection->close_after_response) {
+				connection->state = Connection_Closed;
+				continue;
+			}
+			connection->state = Connection_Read_Request;
 
-	world.locations[1].id = 1;
-	world.locations[1].name = "Initial Cave";
-	world.locations[2].id = 2;
-	world.locations[2].name = "The Great Outdoors";
-	world.locations[3].id = 3;
-	world.locations[3].name = "Some Pub";
-	world.locations[3].has_food = true;
-	world.locations[4].id = 4;
-	world.locations[4].name = "Bedroom";
-	world.locations[4].has_bed = true;
+			// The buffer may have been full, so there can be more to read
+			// even without a new event.
+			readable = true;
 
-	for (U32 id = 1; id < 10; id++) {
-		char *name = name_ptr;
+		} else {
+			return Step_Closed;
+		}
+	}
+}
 
-		U32 first_name_index = next32(&world.random_series) % Count(names);
-		U32 last_name_index = next32(&world.random_series) % Count(names);
+// Needs to be called with the loop locked
+void connection_unlink(Event_Loop *loop, Connection *connection)
+{
+	if (connection->prev) connection->prev->next = connection->next;
+	else loop->connections = connection->next;
+	if (connection->next) connection->next->prev = connection->prev;
+	connection->prev = 0;
+	connection->next = 0;
+}
 
-		name_ptr += 1 + sprintf(name_ptr, "%s %sson",
-			names[first_name_index], names[last_name_index]);
+void connection_free(Connection *connection)
+{
+	os_event_loop_remove(connection->loop->loop, connection->socket);
+	os_socket_stop_recv(connection->socket);
+	os_socket_close(connection->socket);
 
-		Dwarf *dwarf = &world.dwarves[id];
-		dwarf->id = id;
-		dwarf->location = 1;
-		dwarf->name = name;
-		dwarf->hunger = next32(&world.random_series) % 50;
-		dwarf->sleep = next32(&world.random_series) % 50;
-		dwarf->alive = true;
-		dwarf->seed = next32(&world.random_series);
+	if (connection->response_arena) {
+		response_finish(&connection->response);
+		arena_release(connection->response_arena);
 	}
+	arena_release(connection->arena);
+	free(connection);
 
-	World_Instance world_instance = { 0 };
-	world_instance.last_updated = time(NULL);
-	world_instance.world = &world;
-	os_mutex_init(&world_instance.lock);
+	os_atomic_decrement(&active_connection_count);
+}
 
-	os_thread_do(thread_background_world_update, &world_instance);
-	os_thread_do(thread_background_stat_update, &global_stats);
+void connection_close(Connection *connection)
+{
+	Event_Loop *loop = connection->loop;
 
-	int thread_id = 0;
+	os_mutex_lock(&loop->lock);
+	connection_unlink(loop, connection);
+	os_mutex_unlock(&loop->lock);
+
+	connection_free(connection);
+}
+
+// Hands the connection back to the loop to wait for the socket. A connection
+// only waits to write after a short write, otherwise it waits for the next
+// request. Writability is not asked for while reading, an idle socket is
+// always writable and would wake the loop up forever.
+void connection_wait(Connection *connection)
+{
+	Event_Loop *loop = connection->loop;
+	U32 interest = connection->state == Connection_Write_Response
+		? OS_Event_Write : OS_Event_Read;
+
+	// The idle sweep holds the lock, so it can't free the connection before
+	// it is armed. Once armed the loop owns it, so nothing is written after.
+	os_mutex_lock(&loop->lock);
+	connection->busy = false;
+	connection->last_active = time(NULL);
+	bool armed = os_event_loop_rearm(loop->loop, connection->socket, connection,
+		interest);
+	if (!armed)
+		connection_unlink(loop, connection);
+	os_mutex_unlock(&loop->lock);
+
+	// No event can arrive for it and the sweep can't find it anymore
+	if (!armed)
+		connection_free(connection);
+}
+
+void work_respond_to_connection(void *connection_ptr)
+{
+	Connection *connection = (Connection*)connection_ptr;
+
+	connection_respond(connection);
+	if (connection_process(connection, false, true) == Step_Closed)
+		connection_close(connection);
+	else
+		connection_wait(connection);
+}
+
+OS_THREAD_ENTRY(thread_event_loop, event_loop)
+{
+	Event_Loop *loop = (Event_Loop*)event_loop;
+	os_event events[64];
+	time_t last_sweep = time(NULL);
 
 	for (;;) {
-		os_socket client_socket = accept(server_socket, NULL, NULL);
+		int count = os_event_loop_wait(loop->loop, events, Count(events), 1000);
+
+		for (int i = 0; i < count; i++) {
+			Connection *connection = (Connection*)events[i].user;
+			bool readable = (events[i].flags & OS_Event_Read) != 0;
+
+			Connection_Step step = connection_process(connection, readable, false);
+
+			// Hangup is only final after the remaining data has been read
+			if (step == Step_Wait && events[i].flags & OS_Event_Hangup
+				&& connection->state == Connection_Read_Request) {
+				step = Step_Closed;
+			}
+
+			if (step == Step_Request_Ready) {
+				connection->busy = true;
+				work_submit(loop->pool, work_respond_to_connection, connection);
+			} else if (step == Step_Closed) {
+				connection_close(connection);
+			} else {
+				connection_wait(connection);
+			}
+		}
+
+		// Don't keep idle connections for longer than 15 seconds.
+		time_t now = time(NULL);
+		if (now != last_sweep) {
+			last_sweep = now;
+
+			os_mutex_lock(&loop->lock);
+			Connection *idle = 0;
+			for (Connection *connection = loop->connections; connection; ) {
+				Connection *next = connection->next;
+				if (!connection->busy && now - connection->last_active > 15) {
+					connection_unlink(loop, connection);
+					connection->next = idle;
+					idle = connection;
+				}
+				connection = next;
+			}
+			os_mutex_unlock(&loop->lock);
+
+			while (idle) {
+				Connection *next = idle->next;
+				connection_free(idle);
+				idle = next;
+			}
+		}
+	}
+}
+
+// Accepts connections on the listener forever.
+void accept_connections(Listener *listener)
+{
+	char err_buffer[128];
+
+	for (;;) {
+		os_socket client_socket = accept(listener->socket, NULL, NULL);
 		if (!os_valid_socket(client_socket))
 			continue;
 
+		U32 accepted = os_atomic_add(&listener->accepted, 1);
+		int id = (int)os_atomic_add(&next_connection_id, 1) + 1;
+
+		if (listener->event_loop_count > 0) {
+			if (!os_socket_set_nonblocking(client_socket)) {
+				os_socket_format_last_error(err_buffer, sizeof(err_buffer));
+				printf("Failed to set socket non-blocking: %s\n", err_buffer);
+				os_socket_close(client_socket);
+				continue;
+			}
+
+			// With as many listeners as loops every listener feeds its own loop
+			int loop_index = (int)((listener->index + accepted * listener_count)
+				% listener->event_loop_count);
+			Event_Loop *loop = &listener->event_loops[loop_index];
+
+			Connection *connection = (Connection*)calloc(1, sizeof(Connection));
+			connection->socket = client_socket;
+			connection->state = Connection_Read_Request;
+			connection->id = id;
+			connection->last_active = time(NULL);
+			connection->loop = loop;
+			connection->arena = arena_acquire();
+			connection->buffer = buffer_new(client_socket, connection->arena);
+			connection->corked = socket_prepare(client_socket);
+
+			os_atomic_increment(&active_connection_count);
+
+			// Link before registering, the loop may wake up immediately. The
+			// lock keeps the idle sweep out until it is registered.
+			os_mutex_lock(&loop->lock);
+			connection->next = loop->connections;
+			if (loop->connections) loop->connections->prev = connection;
+			loop->connections = connection;
+			bool added = os_event_loop_add(loop->loop, client_socket, connection,
+				OS_Event_Read);
+			if (!added)
+				connection_unlink(loop, connection);
+			os_mutex_unlock(&loop->lock);
+
+			if (!added)
+				connection_free(connection);
+			continue;
+		}
+
 		// Don't block on any function for longer than 15 seconds.
 		int timeout = 15;
 		if (!os_socket_set_timeout(client_socket, timeout, timeout)) {
 			os_socket_format_last_error(err_buffer, sizeof(err_buffer));
 			printf("Failed to set socket timeout: %s\n", err_buffer);
+			os_socket_close(client_socket);
 			continue;
 		}
 
 		Response_Thread_Data *thread_data = (Response_Thread_Data*)malloc(sizeof(Response_Thread_Data));
 		thread_data->client_socket = client_socket;
-		thread_data->world_instance = &world_instance;
-		thread_data->body_storage = (char*)malloc(1024*1024);
-		thread_data->thread_id = ++thread_id;
-
-#if 1
-		os_thread_do(thread_do_response, thread_data);
-#else
-		thread_do_response(thread_data);
-#endif
+		thread_data->worlds = listener->worlds;
+		thread_data->thread_id = id;
+
+		os_atomic_increment(&active_connection_count);
+		os_thread_do(thread_serve_connection, thread_data);
+	}
+}
+
+OS_THREAD_ENTRY(thread_accept, listener)
+{
+	accept_connections((Listener*)listener);
+	OS_THREAD_RETURN;
+}
+
+// Builds a new world with `dwarf_count` dwarves in the initial cave
+void generate_world(World *world, int dwarf_count, U64 seed)
+{
+	const char *names[] = {
+		"Urist", "Gimli", "Thir", "Tharun", "Dofor", "Ufir",
+		"Bohir",
+	};
+
+	U32 initial_cave = world_add_location(world, "Initial Cave", false, false);
+	world_add_location(world, "The Great Outdoors", false, false);
+	world_add_location(world, "Some Pub", true, false);
+	world_add_location(world, "Bedroom", false, true);
+
+	// Dwarf `i` is generated from Philox block `i` of the world seed
+	static U32 dwarf_randoms[4 * 1024];
+	for (int i = 0; i < dwarf_count; i++) {
+		char name[64];
+
+		if (i % 1024 == 0)
+			random_fill(seed, (U64)i, 0, dwarf_randoms, Count(dwarf_randoms));
+		U32 *randoms = &dwarf_randoms[4 * (i % 1024)];
+
+		U32 first_name_index = randoms[0] % Count(names);
+		U32 last_name_index = randoms[1] % Count(names);
+
+		snprintf(name, sizeof(name), "%s %sson",
+			names[first_name_index], names[last_name_index]);
+
+		I32 hunger = (randoms[2] & 0xFFFF) % 50;
+		I32 sleep = (randoms[2] >> 16) % 50;
+		U32 seed = randoms[3];
+		world_add_dwarf(world, name, initial_cave, hunger, sleep, seed);
+	}
+}
+
+// Loads or generates the world and starts simulating and saving it
+void world_instance_start(World_Instance *world_instance, int dwarf_count,
+	U32 tick_rate, bool tick_by_tick)
+{
+	const char *directory = world_instance->directory;
+	os_create_directory(directory);
+
+	Post_Log *post_log = (Post_Log*)calloc(1, sizeof(Post_Log));
+	post_log_open(post_log, directory);
+
+	Name_Table *names = (Name_Table*)malloc(sizeof(Name_Table));
+	name_table_init(names);
+
+	World *world = (World*)malloc(sizeof(World));
+	world_init(world, names);
+	world->path_prefix = world_instance->path_prefix;
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/" WORLD_SAVE_PATH, directory);
+	os_timer_mark load_begin = os_get_timer();
+	U64 last_updated = (U64)time(NULL);
+	U32 save_flags = 0;
+	bool loaded = world_load(world, path, &last_updated, &save_flags);
+	if (loaded) {
+		printf("Loaded world '%s' at tick %llu with %u dwarves: Took %.2fms\n",
+			world_instance->name, (unsigned long long)world->tick,
+			world->dwarves.count, os_timer_delta_ms(load_begin, os_get_timer()));
+
+		// Posts after the save are made again as the world catches up
+		post_log_truncate(post_log, world->post_count);
+	} else {
+		generate_world(world, dwarf_count, world_instance->seed);
+	}
+
+	world_attach_post_log(world, post_log);
+
+	Journal *journal = (Journal*)malloc(sizeof(Journal));
+	journal_open(journal, directory, world->tick, loaded);
+	History *history = (History*)malloc(sizeof(History));
+	history_init(history, journal, post_log, world_instance->path_prefix);
+
+	page_cache_init(&world_instance->page_cache);
+	world_instance->journal = journal;
+	world_instance->history = history;
+	world_instance->last_updated = (time_t)last_updated;
+	world_instance->world = world;
+	world_instance->tick_rate = tick_rate;
+	world_instance->tick_by_tick = tick_by_tick;
+
+	world_instance->tick_pool = &work_pool;
+	if (!tick_by_tick) {
+		if (loaded && (save_flags & World_Save_Events))
+			world_rebuild_events(world);
+		else
+			world_start_events(world);
 	}
+	world_publish(world_instance);
+
+	os_thread_do(thread_background_world_update, world_instance);
+	os_thread_do(thread_background_world_save, world_instance);
 }
 
+// The test and benchmark programs include the server without its entry point
+#ifndef DORF_NO_MAIN
+
+int main(int argc, char **argv)
+{
+	os_startup();
+
+	static char err_buffer[128];
+
+	signal(SIGINT, handle_kill);
+
+	// Number of event loop threads, zero falls back to blocking connections
+	// served by the workers
+	int event_loop_count = 2;
+	int worker_count = (int)os_cpu_count();
+
+	// Number of listening sockets, defaults to one per event loop
+	int listener_arg = -1;
+	bool tick_by_tick = false;
+	int dwarf_count = 9;
+	int tick_rate = 1;
+
+	// Without any `--world` there is one world in the working directory
+	static World_Registry worlds;
+	worlds.instances = (World_Instance*)calloc(max(argc / 2, 1), sizeof(World_Instance));
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--threaded")) {
+			event_loop_count = 0;
+		} else if (!strcmp(argv[i], "--loops") && i + 1 < argc) {
+			event_loop_count = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+			worker_count = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--listeners") && i + 1 < argc) {
+			listener_arg = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--dwarves") && i + 1 < argc) {
+			dwarf_count = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--tick-rate") && i + 1 < argc) {
+			tick_rate = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--tick-by-tick")) {
+			tick_by_tick = true;
+		} else if (!strcmp(argv[i], "--cork")) {
+			socket_mode = Socket_Cork;
+		} else if (!strcmp(argv[i], "--world") && i + 1 < argc) {
+			const char *name = argv[++i];
+			size_t length = strlen(name);
+			bool valid = length > 0 && length <= WORLD_NAME_MAX
+				&& strspn(name, "abcdefghijklmnopqrstuvwxyz0123456789-_") == length
+				&& !world_registry_find(&worlds, name, length);
+			if (!valid) {
+				printf("Invalid or repeated world name '%s'\n", name);
+				return 1;
+			}
+
+			World_Instance *instance = &worlds.instances[worlds.count++];
+			memcpy(instance->name, name, length + 1);
+			snprintf(instance->path_prefix, sizeof(instance->path_prefix), "/w/%s", name);
+			snprintf(instance->directory, sizeof(instance->directory), "worlds/%s", name);
+			instance->seed = static_hash(name, length);
+		} else {
+			printf("Usage: %s [--threaded] [--cork] [--loops count] [--workers count]"
+				" [--listeners count] [--dwarves count] [--tick-rate ticks_per_second]"
+				" [--tick-by-tick] [--world name]...\n", argv[0]);
+			puts("  --tick-by-tick  Tick every dwarf every tick instead of jumping between"
+				" events. Dwarves follow the same rules, but deaths are rolled every"
+				" tick, so the world diverges from event mode once a dwarf dies.");
+			return 1;
+		}
+	}
+	event_loop_count = max(event_loop_count, 0);
+	worker_count = max(worker_count, 1);
+	tick_rate = min(max(tick_rate, 1), 1000);
+
+	if (worlds.count == 0) {
+		World_Instance *instance = &worlds.instances[worlds.count++];
+		strcpy(instance->name, "default");
+		strcpy(instance->directory, ".");
+		instance->seed = 0xD02F;
+	} else {
+		os_create_directory("worlds");
+	}
+
+	// The simulation threads are spread over the cores
+	for (U32 i = 0; i < worlds.count; i++)
+		worlds.instances[i].core = i % os_cpu_count();
+	listener_count = (U32)max(listener_arg >= 0 ? listener_arg : event_loop_count, 1);
+
+	server_epoch = (U32)time(NULL);
+	arena_pool_init();
+	http_init();
+	random_init();
+	route_init();
+	world_tick_init();
+	http_status_lines_init();
+	static_init();
+	work_pool_start(&work_pool, worker_count);
+
+	global_stats.snapshot_count = 100;
+	global_stats.pool = &work_pool;
+	global_stats.pool_occupancies = (long*)calloc(global_stats.snapshot_count, sizeof(long));
+	os_mutex_init(&global_stats.lock);
+
+	struct addrinfo *addr = NULL;
+	struct addrinfo hints = { 0 };
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_PASSIVE;
+
+	getaddrinfo(NULL, DORF_PORT, &hints, &addr);
+
+	listeners = (Listener*)calloc(listener_count, sizeof(Listener));
+	for (U32 i = 0; i < listener_count; i++) {
+		Listener *listener = &listeners[i];
+		listener->index = i;
+		listener->socket = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+
+		// Without SO_REUSEPORT the other listeners would fail to bind
+		if (!os_socket_set_reuse_port(listener->socket) && listener_count > 1) {
+			puts("Multiple listeners not supported, using one");
+			listener_count = 1;
+		}
+
+		if (bind(listener->socket, addr->ai_addr, (int)addr->ai_addrlen)) {
+			os_socket_format_last_error(err_buffer, sizeof(err_buffer));
+			printf("Failed to bind socket: %s\n", err_buffer);
+		}
+		if (listen(listener->socket, SOMAXCONN)) {
+			os_socket_format_last_error(err_buffer, sizeof(err_buffer));
+			printf("Failed to bind socket: %s\n", err_buffer);
+		}
+	}
+
+	freeaddrinfo(addr);
+
+	puts("Dorfbook serving at port " DORF_PORT);
+	puts("Enter ^C to stop");
+
+	for (U32 i = 0; i < worlds.count; i++)
+		world_instance_start(&worlds.instances[i], dwarf_count, (U32)tick_rate,
+			tick_by_tick);
+	global_stats.worlds = &worlds;
+	os_thread_do(thread_background_stat_update, &global_stats);
+
+	Event_Loop *event_loops = (Event_Loop*)calloc(max(event_loop_count, 1), sizeof(Event_Loop));
+	for (int i = 0; i < event_loop_count; i++) {
+		Event_Loop *loop = &event_loops[i];
+		loop->loop = os_event_loop_create();
+		if (!os_valid_event_loop(loop->loop)) {
+			puts("Event loops not supported, using a thread per connection");
+			event_loop_count = 0;
+			break;
+		}
+		loop->worlds = &worlds;
+		loop->pool = &work_pool;
+		os_mutex_init(&loop->lock);
+		os_thread_do(thread_event_loop, loop);
+	}
+	for (U32 i = 0; i < listener_count; i++) {
+		Listener *listener = &listeners[i];
+		listener->event_loops = event_loops;
+		listener->event_loop_count = event_loop_count;
+		listener->worlds = &worlds;
+	}
+
+	// The main thread accepts on the first listener
+	for (U32 i = 1; i < listener_count; i++) {
+		os_thread_do(thread_accept, &listeners[i]);
+	}
+	accept_connections(&listeners[0]);
+}
+
+#endif
@@ -0,0 +1,120 @@
+
+// Interned names. Every distinct name is stored once and referred to by its
+// offset. Names are appended to blocks that never move, so all the copies
+// of the world share one table and can read the names below the end they
+// saw while the simulation thread adds more.
+
+#define NAME_BLOCK_SIZE KB(64)
+#define NAME_MAX_BLOCKS 4096
+
+struct Name_Table
+{
+	char *blocks[NAME_MAX_BLOCKS];
+
+	// Offset of the next name, names never cross blocks
+	U32 end;
+
+	// Open addressing hash of the offsets of the names for interning, only
+	// used by the simulation thread. Zero marks an empty slot.
+	U32 *slots;
+	U32 slot_count;
+	U32 name_count;
+};
+
+inline const char *name_get(Name_Table *table, U32 offset)
+{
+	return table->blocks[offset / NAME_BLOCK_SIZE] + offset % NAME_BLOCK_SIZE;
+}
+
+void name_table_insert(Name_Table *table, U32 offset)
+{
+	if ((table->name_count + 1) * 2 > table->slot_count) {
+		U32 *old_slots = table->slots;
+		U32 old_count = table->slot_count;
+		table->slot_count = max(old_count * 2, 256);
+		table->slots = (U32*)calloc(table->slot_count, sizeof(U32));
+		table->name_count = 0;
+		for (U32 i = 0; i < old_count; i++) {
+			if (old_slots[i])
+				name_table_insert(table, old_slots[i]);
+		}
+		free(old_slots);
+	}
+
+	const char *name = name_get(table, offset);
+	U32 mask = table->slot_count - 1;
+	U32 slot = (U32)static_hash(name, strlen(name)) & mask;
+	while (table->slots[slot])
+		slot = (slot + 1) & mask;
+	table->slots[slot] = offset;
+	table->name_count++;
+}
+
+// Offset 0 is the empty name
+void name_table_init(Name_Table *table)
+{
+	memset(table, 0, sizeof(Name_Table));
+	table->blocks[0] = (char*)calloc(1, NAME_BLOCK_SIZE);
+	table->end = 1;
+}
+
+// Returns the offset of the name, adding it if it's new.
+U32 name_intern(Name_Table *table, const char *name, int length)
+{
+	if (length == 0)
+		return 0;
+	assert(length < NAME_BLOCK_SIZE);
+
+	if (table->slot_count > 0) {
+		U32 mask = table->slot_count - 1;
+		U32 slot = (U32)static_hash(name, length) & mask;
+		for (; table->slots[slot]; slot = (slot + 1) & mask) {
+			const char *other = name_get(table, table->slots[slot]);
+			if (!memcmp(other, name, length) && other[length] == '\0')
+				return table->slots[slot];
+		}
+	}
+
+	U32 position = table->end % NAME_BLOCK_SIZE;
+	if (position + length + 1 > NAME_BLOCK_SIZE) {
+		U32 block = table->end / NAME_BLOCK_SIZE + 1;
+		assert(block < NAME_MAX_BLOCKS);
+		table->blocks[block] = (char*)calloc(1, NAME_BLOCK_SIZE);
+		table->end = block * NAME_BLOCK_SIZE;
+	}
+
+	U32 offset = table->end;
+	char *dest = table->blocks[offset / NAME_BLOCK_SIZE] + offset % NAME_BLOCK_SIZE;
+	memcpy(dest, name, length);
+	dest[length] = '\0';
+	table->end += length + 1;
+
+	name_table_insert(table, offset);
+	return offset;
+}
+
+// Replaces the contents of the table with the names in [0, end) of `data`,
+// which is laid out like the blocks of a table.
+void name_table_load(Name_Table *table, const char *data, U32 end)
+{
+	for (U32 block = 0; block * NAME_BLOCK_SIZE < end; block++) {
+		if (!table->blocks[block])
+			table->blocks[block] = (char*)calloc(1, NAME_BLOCK_SIZE);
+		U32 size = min(end - block * NAME_BLOCK_SIZE, NAME_BLOCK_SIZE);
+		memcpy(table->blocks[block], data + block * NAME_BLOCK_SIZE, size);
+	}
+	table->end = end;
+
+	free(table->slots);
+	table->slots = 0;
+	table->slot_count = 0;
+	table->name_count = 0;
+
+	// The unused ends of blocks are zeros, ie. empty names
+	for (U32 offset = 1; offset < end; ) {
+		U32 length = (U32)strlen(name_get(table, offset));
+		if (length > 0)
+			name_table_insert(table, offset);
+		offset += length + 1;
+	}
+}
@@ -0,0 +1,261 @@
+
+// Append-only text output built from chunks allocated from an arena, so
+// the size of the rendered data is only limited by memory. Values are
+// written with the `out_*` functions, which copy straight to the end of the
+// output without parsing a format string. A streaming output hands its full
+// chunks to a callback as it grows and reuses the chunks that the callback
+// is done with.
+
+#define OUTPUT_CHUNK_MIN KB(4)
+#define OUTPUT_CHUNK_MAX KB(64)
+
+// Size of output a streaming output buffers before it starts flushing, so
+// small outputs are only handled once complete
+#define OUTPUT_STREAM_THRESHOLD KB(16)
+
+struct Output_Chunk
+{
+	Output_Chunk *next;
+	char *data;
+	int length;
+	int capacity;
+};
+
+struct Output;
+
+// Called with the chunks of a streaming output when it needs a new one, all
+// of them are complete. Chunks the callback is done with are given back with
+// `out_recycle_first`, the rest stay in the output.
+typedef void Output_Flush(Output *out, void *data);
+
+struct Output
+{
+	Memory_Arena *arena;
+	Output_Chunk *first, *last;
+
+	// Total bytes written, including flushed ones. Only chunks are limited
+	// to an int, a page listing millions of dwarves can exceed it.
+	size_t length;
+
+	// Set on streaming outputs
+	Output_Flush *flush;
+	void *flush_data;
+
+	// Flushed chunks to reuse
+	Output_Chunk *free;
+};
+
+void out_init(Output *out, Memory_Arena *arena)
+{
+	out->arena = arena;
+	out->first = 0;
+	out->last = 0;
+	out->length = 0;
+	out->flush = 0;
+	out->flush_data = 0;
+	out->free = 0;
+}
+
+// Moves the first chunk to the free list once its data is no longer needed
+void out_recycle_first(Output *out)
+{
+	Output_Chunk *chunk = out->first;
+	out->first = chunk->next;
+	if (!out->first)
+		out->last = 0;
+	chunk->next = out->free;
+	out->free = chunk;
+}
+
+// Appends a new chunk which has room for at least `min_capacity` bytes.
+Output_Chunk *out_add_chunk(Output *out, int min_capacity)
+{
+	if (out->flush && out->length >= OUTPUT_STREAM_THRESHOLD)
+		out->flush(out, out->flush_data);
+
+	Output_Chunk *chunk = out->free;
+	if (chunk && chunk->capacity >= min_capacity) {
+		out->free = chunk->next;
+	} else {
+		int capacity = out->last ? min(out->last->capacity * 2, OUTPUT_CHUNK_MAX)
+			: OUTPUT_CHUNK_MIN;
+		capacity = max(capacity, min_capacity);
+
+		chunk = (Output_Chunk*)arena_push(out->arena, sizeof(Output_Chunk));
+		chunk->data = (char*)arena_push(out->arena, capacity);
+		chunk->capacity = capacity;
+	}
+	chunk->next = 0;
+	chunk->length = 0;
+
+	if (out->last) out->last->next = chunk;
+	else out->first = chunk;
+	out->last = chunk;
+	return chunk;
+}
+
+void out_write(Output *out, const char *data, int length)
+{
+	while (length > 0) {
+		Output_Chunk *chunk = out->last;
+		if (!chunk || chunk->length == chunk->capacity)
+			chunk = out_add_chunk(out, 0);
+
+		int to_copy = min(length, chunk->capacity - chunk->length);
+		memcpy(chunk->data + chunk->length, data, to_copy);
+		chunk->length += to_copy;
+		out->length += to_copy;
+		data += to_copy;
+		length -= to_copy;
+	}
+}
+
+inline void out_string(Output *out, const char *string)
+{
+	out_write(out, string, (int)strlen(string));
+}
+
+// Returns room for at least `size` bytes at the end of the output, which
+// are added to it with `out_commit` once written.
+inline char *out_reserve(Output *out, int size)
+{
+	Output_Chunk *chunk = out->last;
+	if (!chunk || chunk->capacity - chunk->length < size)
+		chunk = out_add_chunk(out, size);
+	return chunk->data + chunk->length;
+}
+
+inline void out_commit(Output *out, int size)
+{
+	out->last->length += size;
+	out->length += size;
+}
+
+// Appends a string literal without measuring it
+#define out_literal(out, literal) out_write((out), (literal), sizeof(literal) - 1)
+
+// Decimal digits of 0 to 99, two characters each
+static const char out_digit_pairs[201] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// Writes the decimal digits of `value` so that they end at `end`, two
+// digits at a time. Returns where the digits start.
+char *format_u64_backwards(char *end, U64 value)
+{
+	while (value >= 100) {
+		U32 pair = (U32)(value % 100);
+		value /= 100;
+		end -= 2;
+		memcpy(end, out_digit_pairs + pair * 2, 2);
+	}
+	if (value >= 10) {
+		end -= 2;
+		memcpy(end, out_digit_pairs + value * 2, 2);
+	} else {
+		*--end = (char)('0' + value);
+	}
+	return end;
+}
+
+void out_u64(Output *out, U64 value)
+{
+	char *dest = out_reserve(out, 20);
+	char digits[20];
+	char *start = format_u64_backwards(digits + sizeof(digits), value);
+	int length = (int)(digits + sizeof(digits) - start);
+	memcpy(dest, start, length);
+	out_commit(out, length);
+}
+
+inline void out_u32(Output *out, U32 value)
+{
+	out_u64(out, value);
+}
+
+void out_i32(Output *out, I32 value)
+{
+	if (value < 0) {
+		out_literal(out, "-");
+		out_u64(out, (U64)-(I64)value);
+	} else {
+		out_u64(out, (U64)value);
+	}
+}
+
+// Lowercase hexadecimal, padded with zeros to at least `min_digits` digits
+void out_hex(Output *out, U64 value, int min_digits)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	char digits[16];
+	int count = 0;
+	do {
+		digits[count++] = hex_digits[value & 0xF];
+		value >>= 4;
+	} while (value || count < min_digits);
+
+	char *dest = out_reserve(out, count);
+	for (int i = 0; i < count; i++)
+		dest[i] = digits[count - 1 - i];
+	out_commit(out, count);
+}
+
+// Writes `value` rounded to `decimals` decimals, at most 9. The value is
+// scaled and rounded to an integer, which doesn't depend on the locale but
+// can round a value just below a tie up where printf wouldn't.
+void out_fixed(Output *out, double value, U32 decimals)
+{
+	static const U64 scales[] = { 1, 10, 100, 1000, 10000, 100000, 1000000,
+		10000000, 100000000, 1000000000 };
+	assert(decimals < Count(scales));
+	U64 scale = scales[decimals];
+
+	double magnitude = value < 0.0 ? -value : value;
+	double scaled = magnitude * (double)scale + 0.5;
+
+	// Also catches NaN, neither is ever rendered in practice
+	if (!(scaled < 1.8e19)) {
+		out_string(out, value < 0.0 ? "-inf" : "inf");
+		return;
+	}
+
+	U64 fixed = (U64)scaled;
+	if (value < 0.0 && fixed > 0)
+		out_literal(out, "-");
+	out_u64(out, fixed / scale);
+	if (decimals == 0)
+		return;
+
+	char *dest = out_reserve(out, decimals + 1);
+	dest[0] = '.';
+	U64 fraction = fixed % scale;
+	for (U32 i = decimals; i > 0; i--) {
+		dest[i] = (char)('0' + fraction % 10);
+		fraction /= 10;
+	}
+	out_commit(out, decimals + 1);
+}
+
+// Writes the string with the characters that are special in HTML escaped,
+// so it's safe both as text and in a quoted attribute value.
+void out_html(Output *out, const char *string)
+{
+	for (;;) {
+		size_t run = strcspn(string, "&<>\"'");
+		out_write(out, string, (int)run);
+		string += run;
+
+		switch (*string) {
+		case '\0': return;
+		case '&': out_literal(out, "&amp;"); break;
+		case '<': out_literal(out, "&lt;"); break;
+		case '>': out_literal(out, "&gt;"); break;
+		case '"': out_literal(out, "&quot;"); break;
+		case '\'': out_literal(out, "&#39;"); break;
+		}
+		string++;
+	}
+}
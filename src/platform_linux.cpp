@@ -8,6 +8,16 @@
 #include <pthread.h>
 #include <errno.h>
 #include <netinet/tcp.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <semaphore.h>
+#include <sys/timerfd.h>
 
 typedef timespec os_timer_mark;
 
@@ -23,6 +33,63 @@ float os_timer_delta_ms(os_timer_mark begin, os_timer_mark end)
 	time_t sec_diff = end.tv_sec - begin.tv_sec;
 	int nano_diff = end.tv_nsec - begin.tv_nsec;
 	float ms = sec_diff * 1000.0f + nano_diff / 1000000.0f;
+	return ms;
+}
+
+U64 os_timer_ns(os_timer_mark mark)
+{
+	return (U64)mark.tv_sec * 1000000000ull + (U64)mark.tv_nsec;
+}
+
+// Wakes a thread up at a fixed rate on the monotonic clock, without drifting
+// however long the thread takes between the waits.
+struct os_ticker
+{
+	int fd;
+	U64 period_ns;
+	U64 start_ns;
+
+	// Periods elapsed up to the last wait
+	U64 periods;
+};
+
+bool os_ticker_start(os_ticker *ticker, U64 period_ns)
+{
+	ticker->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (ticker->fd == -1)
+		return false;
+
+	itimerspec spec;
+	spec.it_interval.tv_sec = (time_t)(period_ns / 1000000000ull);
+	spec.it_interval.tv_nsec = (long)(period_ns % 1000000000ull);
+	spec.it_value = spec.it_interval;
+
+	ticker->period_ns = period_ns;
+	ticker->start_ns = os_timer_ns(os_get_timer());
+	ticker->periods = 0;
+	if (timerfd_settime(ticker->fd, 0, &spec, NULL) != 0) {
+		close(ticker->fd);
+		return false;
+	}
+	return true;
+}
+
+// Blocks until the end of the next period. Returns the number of periods
+// that ended since the last wait, more than one if the thread missed some,
+// and how late the thread woke up after the end of the last one.
+U64 os_ticker_wait(os_ticker *ticker, U64 *lag_ns)
+{
+	U64 periods;
+	while (read(ticker->fd, &periods, sizeof(periods)) != sizeof(periods)) {
+		if (errno != EINTR)
+			return 0;
+	}
+
+	ticker->periods += periods;
+	U64 deadline = ticker->start_ns + ticker->periods * ticker->period_ns;
+	U64 now = os_timer_ns(os_get_timer());
+	*lag_ns = now > deadline ? now - deadline : 0;
+	return periods;
 }
 
 typedef int os_socket;
@@ -53,19 +120,100 @@ int os_socket_send(os_socket sock, const char *data, int length)
 	return send(sock, data, length, MSG_NOSIGNAL);
 }
 
+int os_socket_recv(os_socket sock, char *data, int length)
+{
+	return recv(sock, data, length, 0);
+}
+
+// Returns true if the last failed send or recv would have blocked
+// on a non-blocking socket.
+bool os_socket_would_block()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+bool os_socket_set_nonblocking(os_socket sock)
+{
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags == -1)
+		return false;
+	return fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+typedef iovec os_io_vec;
+
+inline os_io_vec os_io_vec_make(const char *data, size_t length)
+{
+	os_io_vec vec;
+	vec.iov_base = (void*)data;
+	vec.iov_len = length;
+	return vec;
+}
+
+inline const char *os_io_vec_data(os_io_vec *vec)
+{
+	return (const char*)vec->iov_base;
+}
+
+inline size_t os_io_vec_length(os_io_vec *vec)
+{
+	return vec->iov_len;
+}
+
+inline void os_io_vec_consume(os_io_vec *vec, size_t bytes)
+{
+	vec->iov_base = (char*)vec->iov_base + bytes;
+	vec->iov_len -= bytes;
+}
+
+// Maximum number of buffers passed to one os_socket_send_vectored call
+#define OS_IO_VEC_MAX 64
+
+// Sends the buffers in order with one system call, returns the number of
+// bytes sent. If `more` is set the data is followed by more data, so a
+// partial frame can be held back.
+int os_socket_send_vectored(os_socket sock, os_io_vec *vecs, int count,
+	bool more=false)
+{
+	msghdr message = { 0 };
+	message.msg_iov = vecs;
+	message.msg_iovlen = min(count, OS_IO_VEC_MAX);
+	return (int)sendmsg(sock, &message, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+}
+
 bool os_socket_set_delayed(os_socket sock, bool delayed) {
 	int flag = delayed ? 0 : 1;
 	return setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
 		(const char*)&flag, sizeof(flag)) == 0;
 }
 
-int os_socket_send_and_flush(os_socket sock, const char *data, int length)
+// While corked partial frames are held back until the socket is pushed.
+bool os_socket_set_corked(os_socket sock, bool corked)
 {
-	bool set = os_socket_set_delayed(sock, false);
-	int ret = os_socket_send(sock, data, length);
-	if (set) os_socket_set_delayed(sock, true);
+	int flag = corked ? 1 : 0;
+	return setsockopt(sock, IPPROTO_TCP, TCP_CORK,
+		(const char*)&flag, sizeof(flag)) == 0;
+}
 
-	return ret;
+// Sends any partial frames held back by a corked socket.
+void os_socket_push(os_socket sock)
+{
+	os_socket_set_corked(sock, false);
+	os_socket_set_corked(sock, true);
+}
+
+// Lets several sockets listen on the same port, the kernel balances the
+// incoming connections between them. Also allows binding while old
+// connections are still in TIME_WAIT.
+bool os_socket_set_reuse_port(os_socket sock)
+{
+	int flag = 1;
+	unsigned fail = 0;
+	fail |= (unsigned)setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
+		(const char*)&flag, sizeof(flag));
+	fail |= (unsigned)setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+		(const char*)&flag, sizeof(flag));
+	return fail == 0;
 }
 
 bool os_socket_set_timeout(os_socket sock, int recv_sec, int send_sec)
@@ -85,6 +233,250 @@ bool os_socket_set_timeout(os_socket sock, int recv_sec, int send_sec)
 	return fail == 0;
 }
 
+// Edge-triggered readiness notification for non-blocking sockets. An event
+// is only reported when the state changes, so the handler needs to read or
+// write until the call would block before waiting again.
+typedef int os_event_loop;
+
+enum os_event_flags
+{
+	OS_Event_Read = 0x1,
+	OS_Event_Write = 0x2,
+	OS_Event_Hangup = 0x4,
+};
+
+struct os_event
+{
+	void *user;
+	U32 flags;
+};
+
+inline bool os_valid_event_loop(os_event_loop loop)
+{
+	return loop != -1;
+}
+
+inline os_event_loop os_event_loop_create()
+{
+	return epoll_create1(0);
+}
+
+// Events for `interest`, a combination of `OS_Event_Read` and
+// `OS_Event_Write`. Hangups are always reported.
+inline U32 os_epoll_events(U32 interest)
+{
+	U32 events = EPOLLET | EPOLLONESHOT;
+	if (interest & OS_Event_Read) events |= EPOLLIN | EPOLLRDHUP;
+	if (interest & OS_Event_Write) events |= EPOLLOUT;
+	return events;
+}
+
+// Sockets are registered as one-shot: after an event is reported for a socket
+// no more events are reported until it's re-armed. This lets the socket be
+// handed to another thread without racing with the loop.
+bool os_event_loop_add(os_event_loop loop, os_socket sock, void *user, U32 interest)
+{
+	epoll_event event = { 0 };
+	event.events = os_epoll_events(interest);
+	event.data.ptr = user;
+	return epoll_ctl(loop, EPOLL_CTL_ADD, sock, &event) == 0;
+}
+
+// Re-arming reports the event immediately if the socket is already ready.
+bool os_event_loop_rearm(os_event_loop loop, os_socket sock, void *user, U32 interest)
+{
+	epoll_event event = { 0 };
+	event.events = os_epoll_events(interest);
+	event.data.ptr = user;
+	return epoll_ctl(loop, EPOLL_CTL_MOD, sock, &event) == 0;
+}
+
+void os_event_loop_remove(os_event_loop loop, os_socket sock)
+{
+	epoll_event event = { 0 };
+	epoll_ctl(loop, EPOLL_CTL_DEL, sock, &event);
+}
+
+// Waits for at most `timeout_ms` milliseconds, returns the number of events
+// written to `events`.
+int os_event_loop_wait(os_event_loop loop, os_event *events, int max_events,
+	int timeout_ms)
+{
+	epoll_event epoll_events[64];
+	int count = epoll_wait(loop, epoll_events,
+		min(max_events, (int)Count(epoll_events)), timeout_ms);
+	if (count < 0)
+		return 0;
+
+	for (int i = 0; i < count; i++) {
+		U32 in = epoll_events[i].events;
+		U32 flags = 0;
+		if (in & EPOLLIN) flags |= OS_Event_Read;
+		if (in & EPOLLOUT) flags |= OS_Event_Write;
+		if (in & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) flags |= OS_Event_Hangup;
+		events[i].user = epoll_events[i].data.ptr;
+		events[i].flags = flags;
+	}
+	return count;
+}
+
+// Read-only view of a whole file. The file stays open so it can also be sent
+// directly with os_socket_send_file.
+struct os_mapped_file
+{
+	int fd;
+	const char *data;
+	size_t size;
+};
+
+bool os_map_file(const char *path, os_mapped_file *file)
+{
+	file->fd = open(path, O_RDONLY);
+	if (file->fd == -1)
+		return false;
+
+	struct stat info;
+	if (fstat(file->fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+		close(file->fd);
+		return false;
+	}
+
+	file->size = (size_t)info.st_size;
+	file->data = 0;
+	if (file->size > 0) {
+		void *data = mmap(NULL, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+		if (data == MAP_FAILED) {
+			close(file->fd);
+			return false;
+		}
+		file->data = (const char*)data;
+	}
+	return true;
+}
+
+void os_unmap_file(os_mapped_file *file)
+{
+	if (file->data)
+		munmap((void*)file->data, file->size);
+	close(file->fd);
+}
+
+// Read-write view of the first `size` bytes of a file, which is grown to
+// `size` if it's shorter. The file is created if it doesn't exist and
+// `create` is set. Writes go to the file, the view can be cast to writable.
+bool os_map_file_writable(const char *path, size_t size, bool create,
+	os_mapped_file *file)
+{
+	file->fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0644);
+	if (file->fd == -1)
+		return false;
+
+	struct stat info;
+	if (fstat(file->fd, &info) != 0 || !S_ISREG(info.st_mode)
+			|| ((size_t)info.st_size < size && ftruncate(file->fd, (off_t)size) != 0)) {
+		close(file->fd);
+		return false;
+	}
+
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+	if (data == MAP_FAILED) {
+		close(file->fd);
+		return false;
+	}
+	file->data = (const char*)data;
+	file->size = size;
+	return true;
+}
+
+// Succeeds if the directory exists afterwards
+bool os_create_directory(const char *path)
+{
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// Writes out the buffered data of the file and waits until it is on disk
+bool os_sync_file(FILE *file)
+{
+	return fflush(file) == 0 && fsync(fileno(file)) == 0;
+}
+
+// Atomically replaces `dest` with `src`
+bool os_replace_file(const char *src, const char *dest)
+{
+	return rename(src, dest) == 0;
+}
+
+// Sends at most `length` bytes of the file starting from `*offset` without
+// copying them through user space. Advances `*offset` by the amount sent
+// and returns it, or -1 on error.
+int os_socket_send_file(os_socket sock, os_mapped_file *file, U64 *offset,
+	size_t length)
+{
+	off_t file_offset = (off_t)*offset;
+	ssize_t sent = sendfile(sock, file->fd, &file_offset, length);
+	if (sent > 0)
+		*offset += (U64)sent;
+	return (int)sent;
+}
+
+typedef void (*os_directory_callback)(const char *name, void *user);
+
+// Calls `callback` with the name of every regular file in the directory.
+bool os_list_directory(const char *path, os_directory_callback callback,
+	void *user)
+{
+	DIR *dir = opendir(path);
+	if (!dir)
+		return false;
+
+	char file_path[512];
+	while (dirent *entry = readdir(dir)) {
+		snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+		struct stat info;
+		if (stat(file_path, &info) == 0 && S_ISREG(info.st_mode))
+			callback(entry->d_name, user);
+	}
+	closedir(dir);
+	return true;
+}
+
+// Notifies about files being created, removed or changed in a directory.
+typedef int os_file_watch;
+
+inline bool os_valid_file_watch(os_file_watch watch)
+{
+	return watch != -1;
+}
+
+os_file_watch os_watch_directory(const char *path)
+{
+	int watch = inotify_init1(IN_CLOEXEC);
+	if (watch == -1)
+		return -1;
+
+	U32 mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM;
+	if (inotify_add_watch(watch, path, mask) == -1) {
+		close(watch);
+		return -1;
+	}
+	return watch;
+}
+
+// Blocks until something changes in the watched directory, returns false if
+// the watch failed.
+bool os_file_watch_wait(os_file_watch watch)
+{
+	char events[KB(4)];
+	for (;;) {
+		ssize_t length = read(watch, events, sizeof(events));
+		if (length > 0)
+			return true;
+		if (length < 0 && errno == EINTR)
+			continue;
+		return false;
+	}
+}
+
 typedef pthread_mutex_t os_mutex;
 
 inline void os_mutex_init(os_mutex *mutex)
@@ -102,11 +494,44 @@ inline void os_mutex_unlock(os_mutex *mutex)
 	pthread_mutex_unlock(mutex);
 }
 
+typedef sem_t os_semaphore;
+
+inline void os_semaphore_init(os_semaphore *semaphore, U32 initial_count)
+{
+	sem_init(semaphore, 0, initial_count);
+}
+
+inline void os_semaphore_signal(os_semaphore *semaphore)
+{
+	sem_post(semaphore);
+}
+
+inline void os_semaphore_wait(os_semaphore *semaphore)
+{
+	while (sem_wait(semaphore) != 0 && errno == EINTR)
+		;
+}
+
 inline void os_sleep_seconds(int seconds)
 {
 	sleep(seconds);
 }
 
+inline bool os_cpu_has_avx2()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+inline U32 os_cpu_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (U32)count : 1;
+}
+
 typedef volatile U32 os_atomic_uint32;
 
 inline void os_atomic_increment(os_atomic_uint32 *value)
@@ -119,6 +544,27 @@ inline void os_atomic_decrement(os_atomic_uint32 *value)
 	__sync_fetch_and_sub(value, 1);
 }
 
+// Returns the value before the addition
+inline U32 os_atomic_add(os_atomic_uint32 *value, U32 amount)
+{
+	return __sync_fetch_and_add(value, amount);
+}
+
+typedef void *volatile os_atomic_pointer;
+
+// Both are full barriers
+inline void *os_atomic_load_pointer(os_atomic_pointer *pointer)
+{
+	return __atomic_load_n(pointer, __ATOMIC_SEQ_CST);
+}
+
+inline void os_atomic_store_pointer(os_atomic_pointer *pointer, void *value)
+{
+	__atomic_store_n(pointer, value, __ATOMIC_SEQ_CST);
+}
+
+#define os_thread_local __thread
+
 #define OS_THREAD_ENTRY(function, param) void* function(void *param)
 #define OS_THREAD_RETURN return 0
 
@@ -136,6 +582,15 @@ inline os_thread os_thread_do(os_thread_func func, void *param)
 	return result;
 }
 
+// Pins the calling thread to the core
+inline bool os_thread_pin(U32 core)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
 inline void os_startup()
 {
 }
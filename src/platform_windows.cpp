@@ -2,7 +2,9 @@
 #define NOMINMAX
 #include <WinSock2.h>
 #include <ws2tcpip.h>
+#include <MSWSock.h>
 #include <Windows.h>
+#include <io.h>
 
 typedef LARGE_INTEGER os_timer_mark;
 LARGE_INTEGER os_windows_performance_counter_freq;
@@ -22,6 +24,68 @@ float os_timer_delta_ms(os_timer_mark begin, os_timer_mark end)
 	return ms;
 }
 
+U64 os_timer_ns(os_timer_mark mark)
+{
+	U64 freq = (U64)os_windows_performance_counter_freq.QuadPart;
+	U64 counter = (U64)mark.QuadPart;
+	return counter / freq * 1000000000ull + counter % freq * 1000000000ull / freq;
+}
+
+// Wakes a thread up at a fixed rate on the monotonic clock, without drifting
+// however long the thread takes between the waits. The waitable timer only
+// has millisecond periods, the elapsed periods are counted on the
+// performance counter.
+struct os_ticker
+{
+	HANDLE timer;
+	U64 period_ns;
+	U64 start_ns;
+
+	// Periods elapsed up to the last wait
+	U64 periods;
+};
+
+bool os_ticker_start(os_ticker *ticker, U64 period_ns)
+{
+	ticker->timer = CreateWaitableTimerA(NULL, FALSE, NULL);
+	if (!ticker->timer)
+		return false;
+
+	ticker->period_ns = period_ns;
+	ticker->start_ns = os_timer_ns(os_get_timer());
+	ticker->periods = 0;
+
+	// Due time is relative in 100ns units when negative
+	LARGE_INTEGER due;
+	due.QuadPart = -(LONGLONG)(period_ns / 100);
+	LONG period_ms = (LONG)max(period_ns / 1000000, 1);
+	if (!SetWaitableTimer(ticker->timer, &due, period_ms, NULL, NULL, FALSE)) {
+		CloseHandle(ticker->timer);
+		return false;
+	}
+	return true;
+}
+
+// Blocks until the end of the next period. Returns the number of periods
+// that ended since the last wait, more than one if the thread missed some,
+// and how late the thread woke up after the end of the last one.
+U64 os_ticker_wait(os_ticker *ticker, U64 *lag_ns)
+{
+	U64 now;
+	U64 elapsed;
+	do {
+		if (WaitForSingleObject(ticker->timer, INFINITE) != WAIT_OBJECT_0)
+			return 0;
+		now = os_timer_ns(os_get_timer());
+		elapsed = (now - ticker->start_ns) / ticker->period_ns;
+	} while (elapsed <= ticker->periods);
+
+	U64 periods = elapsed - ticker->periods;
+	ticker->periods = elapsed;
+	*lag_ns = now - (ticker->start_ns + elapsed * ticker->period_ns);
+	return periods;
+}
+
 typedef SOCKET os_socket;
 
 inline bool os_valid_socket(os_socket sock)
@@ -50,19 +114,86 @@ int os_socket_send(os_socket sock, const char *data, int length)
 	return send(sock, data, length, 0);
 }
 
+int os_socket_recv(os_socket sock, char *data, int length)
+{
+	return recv(sock, data, length, 0);
+}
+
+// Returns true if the last failed send or recv would have blocked
+// on a non-blocking socket.
+bool os_socket_would_block()
+{
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+bool os_socket_set_nonblocking(os_socket sock)
+{
+	u_long mode = 1;
+	return ioctlsocket(sock, FIONBIO, &mode) == 0;
+}
+
+typedef WSABUF os_io_vec;
+
+inline os_io_vec os_io_vec_make(const char *data, size_t length)
+{
+	os_io_vec vec;
+	vec.buf = (char*)data;
+	vec.len = (ULONG)length;
+	return vec;
+}
+
+inline const char *os_io_vec_data(os_io_vec *vec)
+{
+	return (const char*)vec->buf;
+}
+
+inline size_t os_io_vec_length(os_io_vec *vec)
+{
+	return vec->len;
+}
+
+inline void os_io_vec_consume(os_io_vec *vec, size_t bytes)
+{
+	vec->buf += bytes;
+	vec->len -= (ULONG)bytes;
+}
+
+// Maximum number of buffers passed to one os_socket_send_vectored call
+#define OS_IO_VEC_MAX 64
+
+// Sends the buffers in order with one system call, returns the number of
+// bytes sent. `more` is only a hint, which is ignored on windows.
+int os_socket_send_vectored(os_socket sock, os_io_vec *vecs, int count,
+	bool more=false)
+{
+	DWORD sent = 0;
+	if (WSASend(sock, vecs, min(count, OS_IO_VEC_MAX), &sent, 0, NULL, NULL) != 0)
+		return -1;
+	return (int)sent;
+}
+
 bool os_socket_set_delayed(os_socket sock, bool delayed) {
 	BOOL flag = delayed ? FALSE : TRUE;
 	return setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
 		(const char*)&flag, sizeof(flag)) == 0;
 }
 
-int os_socket_send_and_flush(os_socket sock, const char *data, int length)
+// There is no equivalent of TCP_CORK, responses already leave in one
+// vectored write so Nagle's algorithm is all that holds partial segments.
+bool os_socket_set_corked(os_socket sock, bool corked)
+{
+	return false;
+}
+
+// Nothing is corked, so there is nothing to push
+void os_socket_push(os_socket sock)
 {
-	bool set = os_socket_set_delayed(sock, false);
-	int ret = os_socket_send(sock, data, length);
-	if (set) os_socket_set_delayed(sock, true);
+}
 
-	return ret;
+// There is no load balancing equivalent of SO_REUSEPORT
+bool os_socket_set_reuse_port(os_socket sock)
+{
+	return false;
 }
 
 bool os_socket_set_timeout(os_socket sock, int recv_sec, int send_sec)
@@ -78,6 +209,222 @@ bool os_socket_set_timeout(os_socket sock, int recv_sec, int send_sec)
 	return fail == 0;
 }
 
+// TODO: Event loop for windows (IOCP is completion based, so it does not map
+// directly to the readiness API), for now the server falls back to a thread
+// per connection.
+typedef int os_event_loop;
+
+enum os_event_flags
+{
+	OS_Event_Read = 0x1,
+	OS_Event_Write = 0x2,
+	OS_Event_Hangup = 0x4,
+};
+
+struct os_event
+{
+	void *user;
+	U32 flags;
+};
+
+inline bool os_valid_event_loop(os_event_loop loop)
+{
+	return loop != -1;
+}
+
+inline os_event_loop os_event_loop_create()
+{
+	return -1;
+}
+
+bool os_event_loop_add(os_event_loop loop, os_socket sock, void *user, U32 interest)
+{
+	return false;
+}
+
+bool os_event_loop_rearm(os_event_loop loop, os_socket sock, void *user, U32 interest)
+{
+	return false;
+}
+
+void os_event_loop_remove(os_event_loop loop, os_socket sock)
+{
+}
+
+int os_event_loop_wait(os_event_loop loop, os_event *events, int max_events,
+	int timeout_ms)
+{
+	return 0;
+}
+
+// Read-only view of a whole file
+struct os_mapped_file
+{
+	HANDLE file;
+	HANDLE mapping;
+	const char *data;
+	size_t size;
+};
+
+bool os_map_file(const char *path, os_mapped_file *file)
+{
+	file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file->file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file->file, &size)) {
+		CloseHandle(file->file);
+		return false;
+	}
+
+	file->size = (size_t)size.QuadPart;
+	file->mapping = NULL;
+	file->data = 0;
+	if (file->size > 0) {
+		file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (file->mapping)
+			file->data = (const char*)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!file->data) {
+			if (file->mapping) CloseHandle(file->mapping);
+			CloseHandle(file->file);
+			return false;
+		}
+	}
+	return true;
+}
+
+void os_unmap_file(os_mapped_file *file)
+{
+	if (file->data) UnmapViewOfFile(file->data);
+	if (file->mapping) CloseHandle(file->mapping);
+	CloseHandle(file->file);
+}
+
+// Read-write view of the first `size` bytes of a file, which is grown to
+// `size` if it's shorter. The file is created if it doesn't exist and
+// `create` is set. Writes go to the file, the view can be cast to writable.
+bool os_map_file_writable(const char *path, size_t size, bool create,
+	os_mapped_file *file)
+{
+	file->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+		create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file->file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Mapping more than the size of the file grows it
+	U64 size64 = (U64)size;
+	file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READWRITE,
+		(DWORD)(size64 >> 32), (DWORD)size64, NULL);
+	file->data = 0;
+	if (file->mapping)
+		file->data = (const char*)MapViewOfFile(file->mapping, FILE_MAP_WRITE, 0, 0, size);
+	if (!file->data) {
+		if (file->mapping) CloseHandle(file->mapping);
+		CloseHandle(file->file);
+		return false;
+	}
+	file->size = size;
+	return true;
+}
+
+// Succeeds if the directory exists afterwards
+bool os_create_directory(const char *path)
+{
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+// Writes out the buffered data of the file and waits until it is on disk
+bool os_sync_file(FILE *file)
+{
+	return fflush(file) == 0 && _commit(_fileno(file)) == 0;
+}
+
+// Atomically replaces `dest` with `src`
+bool os_replace_file(const char *src, const char *dest)
+{
+	return MoveFileExA(src, dest, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+// Sends at most `length` bytes of the file starting from `*offset` with
+// TransmitFile, which reads the file in the kernel. Advances `*offset` by the
+// amount sent and returns it, or -1 on error. The offset is passed through
+// the OVERLAPPED since the file handle is shared by every connection.
+int os_socket_send_file(os_socket sock, os_mapped_file *file, U64 *offset,
+	size_t length)
+{
+	DWORD chunk = (DWORD)min(length, (size_t)MB(1));
+
+	OVERLAPPED overlapped = { 0 };
+	overlapped.Offset = (DWORD)*offset;
+	overlapped.OffsetHigh = (DWORD)(*offset >> 32);
+	overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (!overlapped.hEvent)
+		return -1;
+
+	DWORD sent = 0;
+	bool ok = TransmitFile(sock, file->file, chunk, 0, &overlapped, NULL, 0) != 0;
+	if (ok || WSAGetLastError() == WSA_IO_PENDING) {
+		DWORD flags = 0;
+		ok = WSAGetOverlappedResult(sock, &overlapped, &sent, TRUE, &flags) != 0;
+	}
+	CloseHandle(overlapped.hEvent);
+
+	if (!ok)
+		return -1;
+	*offset += (U64)sent;
+	return (int)sent;
+}
+
+typedef void (*os_directory_callback)(const char *name, void *user);
+
+// Calls `callback` with the name of every regular file in the directory.
+bool os_list_directory(const char *path, os_directory_callback callback,
+	void *user)
+{
+	char pattern[512];
+	_snprintf(pattern, sizeof(pattern), "%s\\*", path);
+
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(pattern, &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return false;
+
+	do {
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			callback(data.cFileName, user);
+	} while (FindNextFileA(find, &data));
+
+	FindClose(find);
+	return true;
+}
+
+// Notifies about files being created, removed or changed in a directory.
+typedef HANDLE os_file_watch;
+
+inline bool os_valid_file_watch(os_file_watch watch)
+{
+	return watch != INVALID_HANDLE_VALUE;
+}
+
+os_file_watch os_watch_directory(const char *path)
+{
+	return FindFirstChangeNotificationA(path, FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE
+		| FILE_NOTIFY_CHANGE_SIZE);
+}
+
+// Blocks until something changes in the watched directory, returns false if
+// the watch failed.
+bool os_file_watch_wait(os_file_watch watch)
+{
+	if (WaitForSingleObject(watch, INFINITE) != WAIT_OBJECT_0)
+		return false;
+	return FindNextChangeNotification(watch) != 0;
+}
+
 typedef CRITICAL_SECTION os_mutex;
 
 inline void os_mutex_init(os_mutex *mutex)
@@ -95,11 +442,53 @@ inline void os_mutex_unlock(os_mutex *mutex)
 	LeaveCriticalSection(mutex);
 }
 
+typedef HANDLE os_semaphore;
+
+inline void os_semaphore_init(os_semaphore *semaphore, U32 initial_count)
+{
+	*semaphore = CreateSemaphore(NULL, initial_count, LONG_MAX, NULL);
+}
+
+inline void os_semaphore_signal(os_semaphore *semaphore)
+{
+	ReleaseSemaphore(*semaphore, 1, NULL);
+}
+
+inline void os_semaphore_wait(os_semaphore *semaphore)
+{
+	WaitForSingleObject(*semaphore, INFINITE);
+}
+
 inline void os_sleep_seconds(int seconds)
 {
 	Sleep(seconds * 1000);
 }
 
+inline bool os_cpu_has_avx2()
+{
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// The OS needs to save the YMM registers too
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+
+inline U32 os_cpu_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (U32)info.dwNumberOfProcessors : 1;
+}
+
 typedef volatile DWORD os_atomic_uint32;
 
 inline void os_atomic_increment(os_atomic_uint32 *value)
@@ -112,6 +501,27 @@ inline void os_atomic_decrement(os_atomic_uint32 *value)
 	InterlockedDecrement(value);
 }
 
+// Returns the value before the addition
+inline U32 os_atomic_add(os_atomic_uint32 *value, U32 amount)
+{
+	return (U32)InterlockedExchangeAdd(value, amount);
+}
+
+typedef void *volatile os_atomic_pointer;
+
+// Both are full barriers
+inline void *os_atomic_load_pointer(os_atomic_pointer *pointer)
+{
+	return InterlockedCompareExchangePointer(pointer, 0, 0);
+}
+
+inline void os_atomic_store_pointer(os_atomic_pointer *pointer, void *value)
+{
+	InterlockedExchangePointer(pointer, value);
+}
+
+#define os_thread_local __declspec(thread)
+
 #define OS_THREAD_ENTRY(function, param) DWORD WINAPI function(void *param)
 #define OS_THREAD_RETURN return 0
 typedef DWORD (WINAPI *os_thread_func)(void*);
@@ -128,6 +538,12 @@ inline os_thread os_thread_do(os_thread_func func, void *param)
 	result.handle = CreateThread(NULL, NULL, func, param, NULL, &result.id);
 	return result;
 }
+
+// Pins the calling thread to the core
+inline bool os_thread_pin(U32 core)
+{
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (core % 64)) != 0;
+}
 inline void os_startup()
 {
 	WSADATA wsadata;
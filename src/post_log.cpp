@@ -0,0 +1,137 @@
+
+// Append-only log of every post ever made. Posts are fixed-size records in
+// memory-mapped segment files under `posts/`, so the history survives
+// restarts and only the parts being read need to be in memory.
+//
+// Only the simulation thread appends. A record never changes once written,
+// so request handlers can read any record below a count published to them
+// without locking. Every record links to the previous post by the same
+// dwarf, which makes up the timeline of the dwarf with nothing in memory
+// but the last post of each dwarf.
+
+#define POST_LOG_DIRECTORY "posts"
+#define POST_LOG_SEGMENT_RECORDS 65536
+#define POST_LOG_MAX_SEGMENTS 4096
+
+struct Post_Record
+{
+	U64 tick;
+	U32 by_id;
+	U32 type;
+	U64 data;
+
+	// Sequence number plus one of the previous post by the same dwarf, zero
+	// if there is none
+	U64 previous;
+};
+
+struct Post_Log
+{
+	// Segments are mapped when first needed and stay mapped
+	Post_Record *segments[POST_LOG_MAX_SEGMENTS];
+	os_mapped_file files[POST_LOG_MAX_SEGMENTS];
+	U32 segment_count;
+
+	// Number of records written
+	U64 count;
+
+	// Set if the segments are backed by files, otherwise the log only lives
+	// in memory
+	bool persistent;
+
+	// Directory of the world the log is in
+	char directory[128];
+};
+
+bool post_log_map_segment(Post_Log *log, U32 index, bool create)
+{
+	size_t size = POST_LOG_SEGMENT_RECORDS * sizeof(Post_Record);
+	if (log->persistent) {
+		char path[256];
+		snprintf(path, sizeof(path), "%s/" POST_LOG_DIRECTORY "/%08u.log",
+			log->directory, index);
+		if (os_map_file_writable(path, size, create, &log->files[index])) {
+			log->segments[index] = (Post_Record*)log->files[index].data;
+			return true;
+		}
+		if (!create)
+			return false;
+		printf("Failed to map '%s', keeping new posts in memory only\n", path);
+		log->persistent = false;
+	}
+
+	if (!create)
+		return false;
+	log->segments[index] = (Post_Record*)calloc(1, size);
+	return log->segments[index] != 0;
+}
+
+// Maps the existing segments in `directory` and finds the end of the log.
+void post_log_open(Post_Log *log, const char *directory)
+{
+	log->segment_count = 0;
+	log->count = 0;
+	snprintf(log->directory, sizeof(log->directory), "%s", directory);
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/" POST_LOG_DIRECTORY, directory);
+	log->persistent = os_create_directory(path);
+	if (!log->persistent) {
+		printf("Failed to create '%s', keeping posts in memory only\n", path);
+		return;
+	}
+
+	while (log->segment_count < POST_LOG_MAX_SEGMENTS
+			&& post_log_map_segment(log, log->segment_count, false))
+		log->segment_count++;
+	if (log->segment_count == 0)
+		return;
+
+	// Records are written in order and ids are never zero, so the written
+	// records of the last segment can be found with a binary search.
+	Post_Record *last = log->segments[log->segment_count - 1];
+	U32 low = 0, high = POST_LOG_SEGMENT_RECORDS;
+	while (low < high) {
+		U32 middle = low + (high - low) / 2;
+		if (last[middle].by_id != 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	log->count = (U64)(log->segment_count - 1) * POST_LOG_SEGMENT_RECORDS + low;
+
+	printf("Opened post log of '%s' with %llu posts\n", directory,
+		(unsigned long long)log->count);
+}
+
+// Returns false if the log is full or out of memory.
+bool post_log_append(Post_Log *log, Post_Record *record, U64 *sequence)
+{
+	U64 index = log->count;
+	U32 segment = (U32)(index / POST_LOG_SEGMENT_RECORDS);
+	if (segment == log->segment_count) {
+		if (segment == POST_LOG_MAX_SEGMENTS || !post_log_map_segment(log, segment, true))
+			return false;
+		log->segment_count++;
+	}
+
+	log->segments[segment][index % POST_LOG_SEGMENT_RECORDS] = *record;
+	log->count = index + 1;
+	*sequence = index;
+	return true;
+}
+
+// The record must have been written
+inline Post_Record *post_log_get(Post_Log *log, U64 sequence)
+{
+	return &log->segments[sequence / POST_LOG_SEGMENT_RECORDS]
+		[sequence % POST_LOG_SEGMENT_RECORDS];
+}
+
+// Drops the records from `count` on, so they can be written again.
+void post_log_truncate(Post_Log *log, U64 count)
+{
+	for (U64 sequence = count; sequence < log->count; sequence++)
+		memset(post_log_get(log, sequence), 0, sizeof(Post_Record));
+	log->count = min(log->count, count);
+}
@@ -3,9 +3,29 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <assert.h>
+
+// SIMD code paths are only compiled for x86, other architectures use the
+// scalar fallbacks. AVX2 functions are compiled regardless of the compiler
+// flags and only called if the CPU supports them.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ARCH_SSE2 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef uint8_t U8;
+typedef uint16_t U16;
 typedef int32_t I32;
 typedef uint32_t U32;
 typedef int64_t I64;
@@ -22,5 +42,41 @@ typedef uint64_t U64;
 #define UINT32_MAX 0xFFFFFFFF
 #endif
 
+
+// Index of the lowest set bit, `value` must not be zero
+inline U32 count_trailing_zeros32(U32 value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return (U32)index;
+#else
+	return (U32)__builtin_ctz(value);
+#endif
+}
+
+inline U32 count_trailing_zeros64(U64 value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (U32)index;
+#else
+	return (U32)__builtin_ctzll(value);
+#endif
+}
+
+// Number of zero bits above the highest set bit, `value` must not be zero
+inline U32 count_leading_zeros64(U64 value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return 63 - (U32)index;
+#else
+	return (U32)__builtin_clzll(value);
+#endif
+}
+
 #endif
 
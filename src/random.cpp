@@ -1,38 +1,324 @@
 
+// Random number generation. `Random_Series` is a PCG64 generator (128-bit
+// LCG state with the XSL-RR output function) which can jump ahead any
+// number of steps in O(log n). Series keyed by an entity or a tick are
+// seeded with the counter-based Philox4x32-10 generator, which maps any
+// (key, counter) pair to random bits without any state, and also fills
+// bulk arrays of random numbers with SIMD.
+
+// 128-bit unsigned integer math
+
+struct U128
+{
+	U64 lo, hi;
+};
+
+inline U128 u128(U64 hi, U64 lo)
+{
+	U128 result;
+	result.lo = lo;
+	result.hi = hi;
+	return result;
+}
+
+inline U128 u128_add(U128 a, U128 b)
+{
+	U128 result;
+	result.lo = a.lo + b.lo;
+	result.hi = a.hi + b.hi + (result.lo < a.lo);
+	return result;
+}
+
+// Full 128-bit product of two 64-bit values
+inline U128 u128_mul64(U64 a, U64 b)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 product = (unsigned __int128)a * b;
+	return u128((U64)(product >> 64), (U64)product);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	U64 hi;
+	U64 lo = _umul128(a, b, &hi);
+	return u128(hi, lo);
+#else
+	U64 a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+	U64 b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+	U64 lo_lo = a_lo * b_lo;
+	U64 hi_lo = a_hi * b_lo;
+	U64 lo_hi = a_lo * b_hi;
+	U64 hi_hi = a_hi * b_hi;
+	U64 cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	return u128(hi_hi + (hi_lo >> 32) + (cross >> 32),
+		(cross << 32) | (lo_lo & 0xFFFFFFFF));
+#endif
+}
+
+// Product modulo 2^128
+inline U128 u128_mul(U128 a, U128 b)
+{
+	U128 result = u128_mul64(a.lo, b.lo);
+	result.hi += a.lo * b.hi + a.hi * b.lo;
+	return result;
+}
+
+// Philox4x32-10, see "Parallel Random Numbers: As Easy as 1, 2, 3" by
+// Salmon et al. Encrypts the 128-bit `counter` with the 64-bit `key`.
+
+#define PHILOX_M0 0xD2511F53
+#define PHILOX_M1 0xCD9E8D57
+#define PHILOX_W0 0x9E3779B9
+#define PHILOX_W1 0xBB67AE85
+
+void philox4x32(U32 counter[4], U64 key)
+{
+	U32 c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	U32 k0 = (U32)key, k1 = (U32)(key >> 32);
+
+	for (int round = 0; round < 10; round++) {
+		U64 p0 = (U64)PHILOX_M0 * c0;
+		U64 p1 = (U64)PHILOX_M1 * c2;
+		c0 = (U32)(p1 >> 32) ^ c1 ^ k0;
+		c1 = (U32)p1;
+		c2 = (U32)(p0 >> 32) ^ c3 ^ k1;
+		c3 = (U32)p0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	counter[0] = c0; counter[1] = c1; counter[2] = c2; counter[3] = c3;
+}
+
+// PCG64
+
 struct Random_Series
 {
-	U32 x, y, z, w;
+	U128 state;
+	U128 increment;
 };
 
+// 0x2360ED051FC65DA44385DF649FCCF645
+#define PCG_MULTIPLIER u128(0x2360ED051FC65DA4ULL, 0x4385DF649FCCF645ULL)
+
+// 0x5851F42D4C957F2D14057B7EF767814F
+#define PCG_DEFAULT_INCREMENT u128(0x5851F42D4C957F2DULL, 0x14057B7EF767814FULL)
+
+inline void series_step(Random_Series *series)
+{
+	series->state = u128_add(u128_mul(series->state, PCG_MULTIPLIER), series->increment);
+}
+
+// Create a random series starting from `state` on the stream selected by
+// `stream`, different streams never overlap.
+Random_Series series_from_state(U128 state, U128 stream)
+{
+	Random_Series series;
+	series.state = u128(0, 0);
+	series.increment = u128((stream.hi << 1) | (stream.lo >> 63), (stream.lo << 1) | 1);
+	series_step(&series);
+	series.state = u128_add(series.state, state);
+	series_step(&series);
+	return series;
+}
+
 // Create a random series with 32 bits of seed
 Random_Series series_from_seed32(U32 seed)
 {
-	Random_Series series = { 0 };
-	series.x = seed;
-	series.y = seed;
-	series.z = seed;
-	series.w = seed;
+	return series_from_state(u128(0, seed), u128(0, 0));
+}
+
+// Create a random series starting from a block of Philox output
+inline Random_Series series_from_block(const U32 block[4])
+{
+	Random_Series series;
+	series.state = u128(((U64)block[3] << 32) | block[2], ((U64)block[1] << 32) | block[0]);
+	series.increment = PCG_DEFAULT_INCREMENT;
 	return series;
 }
 
+// Create a random series determined by `key`, `counter` and `salt` only, so
+// that any number of independent series can be created in any order, eg.
+// one per entity per tick. Same as the series from the first block of
+// `random_fill(key, counter, &salt, ...)`.
+Random_Series series_from_key(U64 key, U64 counter, U32 salt)
+{
+	U32 block[4] = { (U32)counter, (U32)(counter >> 32), salt, 0 };
+	philox4x32(block, key);
+	return series_from_block(block);
+}
+
+// Moves the series `steps` numbers ahead in O(log steps), the same as
+// calling `next64` that many times.
+void series_advance(Random_Series *series, U64 steps)
+{
+	U128 multiplier = PCG_MULTIPLIER;
+	U128 increment = series->increment;
+	U128 total_multiplier = u128(0, 1);
+	U128 total_increment = u128(0, 0);
+
+	for (; steps; steps >>= 1) {
+		if (steps & 1) {
+			total_multiplier = u128_mul(total_multiplier, multiplier);
+			total_increment = u128_add(u128_mul(total_increment, multiplier), increment);
+		}
+		increment = u128_mul(u128_add(multiplier, u128(0, 1)), increment);
+		multiplier = u128_mul(multiplier, multiplier);
+	}
+
+	series->state = u128_add(u128_mul(total_multiplier, series->state), total_increment);
+}
+
+// Returns an uniform distribution in [0, 2^64)
+U64 next64(Random_Series *series)
+{
+	series_step(series);
+	U64 value = series->state.hi ^ series->state.lo;
+	U32 rotation = (U32)(series->state.hi >> 58);
+	return (value >> rotation) | (value << ((64 - rotation) & 63));
+}
+
 // Returns an uniform distribution in [0, 2^32)
 U32 next32(Random_Series *series)
 {
-	// XorShift algorithm
-	// Note: This may not be the best option, consider PCG
-	Random_Series s = *series;
-	U32 t = s.x ^ (s.x << 11);
-	s.x = s.y; s.y = s.z; s.z = s.w;
-	s.w = s.w ^ (s.w >> 19) ^ t ^ (t >> 8);
-	*series = s;
-	return s.w;
+	return (U32)(next64(series) >> 32);
 }
 
 // Returns true with the chance of 1 out of `inverse`
 // eg. next_one_in(series, 4) returns true 25% of the time.
-bool next_one_in(Random_Series *series, U32 inverse)
+bool next_one_in(Random_Series *series, U64 inverse)
+{
+	return next64(series) < UINT64_MAX / inverse;
+}
+
+// Returns true with `chance`, which has 64 bits of precision.
+bool next_chance(Random_Series *series, double chance)
+{
+	if (chance >= 1.0)
+		return true;
+	U64 threshold = (U64)(chance * 18446744073709551616.0);
+	return next64(series) < threshold;
+}
+
+// Returns an uniform distribution in (0, 1]
+double next_unit(Random_Series *series)
+{
+	return (double)((next64(series) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+// Returns the number of trials up to and including the first success when
+// every trial succeeds with `chance`, ie. a geometric distribution from 1.
+U64 next_geometric(Random_Series *series, double chance)
+{
+	double trials = floor(log(next_unit(series)) / log1p(-chance));
+	return trials < 1e18 ? 1 + (U64)trials : (U64)1e18;
+}
+
+// Bulk generation. `random_fill` writes `count` random numbers that only
+// depend on the arguments: the numbers [4n, 4n + 4) are the Philox block of
+// counter `counter + n` and salt `salts[n]`, or zero if `salts` is null.
+// Fills with the same key and salts should use counters `count / 4` apart
+// to not overlap.
+
+typedef void (*Random_Fill_Func)(U64 key, U64 counter, const U32 *salts,
+	U32 *dest, U32 count);
+
+void random_fill_scalar(U64 key, U64 counter, const U32 *salts, U32 *dest, U32 count)
+{
+	for (U32 i = 0; i < count; i += 4, counter++) {
+		U32 salt = salts ? salts[i / 4] : 0;
+		U32 block[4] = { (U32)counter, (U32)(counter >> 32), salt, 0 };
+		philox4x32(block, key);
+		for (U32 j = 0; j < 4 && i + j < count; j++)
+			dest[i + j] = block[j];
+	}
+}
+
+#if ARCH_SSE2
+
+// Philox rounds for 8 blocks at once, block `n` is in lane `n` of the words
+TARGET_AVX2
+void philox4x32_avx2(__m256i *c0, __m256i *c1, __m256i *c2, __m256i *c3, U64 key)
+{
+	__m256i m0 = _mm256_set1_epi32((int)PHILOX_M0);
+	__m256i m1 = _mm256_set1_epi32((int)PHILOX_M1);
+	__m256i k0 = _mm256_set1_epi32((int)(U32)key);
+	__m256i k1 = _mm256_set1_epi32((int)(U32)(key >> 32));
+	__m256i w0 = _mm256_set1_epi32((int)PHILOX_W0);
+	__m256i w1 = _mm256_set1_epi32((int)PHILOX_W1);
+	__m256i x0 = *c0, x1 = *c1, x2 = *c2, x3 = *c3;
+
+	for (int round = 0; round < 10; round++) {
+		// 32x32 -> 64-bit products of the even and odd lanes
+		__m256i p0_even = _mm256_mul_epu32(x0, m0);
+		__m256i p0_odd = _mm256_mul_epu32(_mm256_srli_epi64(x0, 32), m0);
+		__m256i p1_even = _mm256_mul_epu32(x2, m1);
+		__m256i p1_odd = _mm256_mul_epu32(_mm256_srli_epi64(x2, 32), m1);
+
+		__m256i lo0 = _mm256_blend_epi32(p0_even, _mm256_slli_epi64(p0_odd, 32), 0xAA);
+		__m256i hi0 = _mm256_blend_epi32(_mm256_srli_epi64(p0_even, 32), p0_odd, 0xAA);
+		__m256i lo1 = _mm256_blend_epi32(p1_even, _mm256_slli_epi64(p1_odd, 32), 0xAA);
+		__m256i hi1 = _mm256_blend_epi32(_mm256_srli_epi64(p1_even, 32), p1_odd, 0xAA);
+
+		x0 = _mm256_xor_si256(_mm256_xor_si256(hi1, x1), k0);
+		x1 = lo1;
+		x2 = _mm256_xor_si256(_mm256_xor_si256(hi0, x3), k1);
+		x3 = lo0;
+		k0 = _mm256_add_epi32(k0, w0);
+		k1 = _mm256_add_epi32(k1, w1);
+	}
+
+	*c0 = x0; *c1 = x1; *c2 = x2; *c3 = x3;
+}
+
+TARGET_AVX2
+void random_fill_avx2(U64 key, U64 counter, const U32 *salts, U32 *dest, U32 count)
 {
-	U32 val = next32(series);
-	return val < UINT32_MAX / inverse;
+	U32 i = 0;
+	for (; count - i >= 32; i += 32, counter += 8) {
+		U32 counter_lo[8], counter_hi[8];
+		for (U32 n = 0; n < 8; n++) {
+			counter_lo[n] = (U32)(counter + n);
+			counter_hi[n] = (U32)((counter + n) >> 32);
+		}
+
+		__m256i c0 = _mm256_loadu_si256((const __m256i*)counter_lo);
+		__m256i c1 = _mm256_loadu_si256((const __m256i*)counter_hi);
+		__m256i c2 = salts ? _mm256_loadu_si256((const __m256i*)(salts + i / 4))
+			: _mm256_setzero_si256();
+		__m256i c3 = _mm256_setzero_si256();
+		philox4x32_avx2(&c0, &c1, &c2, &c3, key);
+
+		// Transpose the words back to blocks, the unpacks work within the
+		// 128-bit halves so `b04` has block 0 in the low and 4 in the high half
+		__m256i c01_lo = _mm256_unpacklo_epi32(c0, c1);
+		__m256i c01_hi = _mm256_unpackhi_epi32(c0, c1);
+		__m256i c23_lo = _mm256_unpacklo_epi32(c2, c3);
+		__m256i c23_hi = _mm256_unpackhi_epi32(c2, c3);
+		__m256i b04 = _mm256_unpacklo_epi64(c01_lo, c23_lo);
+		__m256i b15 = _mm256_unpackhi_epi64(c01_lo, c23_lo);
+		__m256i b26 = _mm256_unpacklo_epi64(c01_hi, c23_hi);
+		__m256i b37 = _mm256_unpackhi_epi64(c01_hi, c23_hi);
+
+		__m256i *out = (__m256i*)(dest + i);
+		_mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(b04, b15, 0x20));
+		_mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(b26, b37, 0x20));
+		_mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(b04, b15, 0x31));
+		_mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(b26, b37, 0x31));
+	}
+
+	// Like `http_scan_avx2`, the scalar tail would run with dirty upper
+	// halves otherwise
+	_mm256_zeroupper();
+	random_fill_scalar(key, counter, salts ? salts + i / 4 : 0, dest + i, count - i);
 }
 
+#endif
+
+Random_Fill_Func random_fill = random_fill_scalar;
+
+// Picks the widest bulk generator the CPU supports.
+void random_init()
+{
+#if ARCH_SSE2
+	if (os_cpu_has_avx2())
+		random_fill = random_fill_avx2;
+#endif
+}
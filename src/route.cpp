@@ -0,0 +1,192 @@
+
+// URL routing. The route table is compiled into a byte trie at startup and
+// requests are matched by walking it, which costs O(path length) no matter
+// how many routes there are and doesn't allocate.
+//
+// Patterns are literal bytes with two kinds of placeholders:
+//   ":name"  captures a decimal U32 up to the next non-digit
+//   "*"      matches the rest of the path, only at the end of a pattern
+
+// Room for a few hundred routes
+#define ROUTE_MAX_NODES 4096
+#define ROUTE_MAX_CAPTURES 4
+
+enum Route_Kind
+{
+	Route_None,
+	Route_Static,
+	Route_Dwarves,
+	Route_Feed,
+	Route_Entity,
+	Route_Entity_Avatar,
+	Route_Entity_Feed,
+	Route_Locations,
+	Route_Location,
+	Route_Stats,
+};
+
+struct Route
+{
+	const char *pattern;
+	Route_Kind kind;
+};
+
+Route routes[] = {
+	{ "/static/*", Route_Static },
+	{ "/favicon.ico", Route_Static },
+	{ "/dwarves", Route_Dwarves },
+	{ "/feed", Route_Feed },
+	{ "/entities/:id", Route_Entity },
+	{ "/entities/:id/avatar.svg", Route_Entity_Avatar },
+	{ "/entities/:id/feed", Route_Entity_Feed },
+	{ "/locations", Route_Locations },
+	{ "/locations/:id", Route_Location },
+	{ "/stats", Route_Stats },
+};
+
+enum Route_Edge
+{
+	Route_Edge_Byte,
+	Route_Edge_Capture,
+	Route_Edge_Rest,
+};
+
+struct Route_Node
+{
+	U8 edge;
+	char byte;
+
+	// Route ending at this node, `Route_None` if none
+	U8 kind;
+
+	// Indices to `route_nodes`, zero terminates the list as the root can't
+	// be a child.
+	U16 first_child;
+	U16 next_sibling;
+};
+
+struct Route_Match
+{
+	Route_Kind kind;
+	U32 captures[ROUTE_MAX_CAPTURES];
+	int capture_count;
+
+	// The part of the path matched by "*"
+	const char *rest;
+};
+
+Route_Node route_nodes[ROUTE_MAX_NODES];
+U32 route_node_count = 1;
+
+U16 route_child(U16 parent, Route_Edge edge, char byte)
+{
+	Route_Node *node = &route_nodes[parent];
+	for (U16 child = node->first_child; child; child = route_nodes[child].next_sibling) {
+		if (route_nodes[child].edge == edge && route_nodes[child].byte == byte)
+			return child;
+	}
+
+	assert(route_node_count < ROUTE_MAX_NODES);
+	U16 child = (U16)route_node_count++;
+	route_nodes[child].edge = (U8)edge;
+	route_nodes[child].byte = byte;
+
+	// Captures and rest go after the literal bytes so those are tried first
+	U16 *link = &node->first_child;
+	if (edge == Route_Edge_Byte) {
+		route_nodes[child].next_sibling = *link;
+		*link = child;
+	} else {
+		while (*link)
+			link = &route_nodes[*link].next_sibling;
+		*link = child;
+	}
+	return child;
+}
+
+// Adds a pattern to the trie, the pattern isn't referenced afterwards
+void route_add(const char *pattern, Route_Kind kind)
+{
+	U16 node = 0;
+	int capture_count = 0;
+	for (const char *c = pattern; *c; c++) {
+		if (*c == ':') {
+			// The name is only documentation, captures are positional
+			while (c[1] && c[1] != '/' && c[1] != '.')
+				c++;
+			capture_count++;
+			node = route_child(node, Route_Edge_Capture, 0);
+		} else if (*c == '*') {
+			node = route_child(node, Route_Edge_Rest, 0);
+		} else {
+			node = route_child(node, Route_Edge_Byte, *c);
+		}
+	}
+	assert(capture_count <= ROUTE_MAX_CAPTURES);
+	assert(route_nodes[node].kind == Route_None);
+	route_nodes[node].kind = (U8)kind;
+}
+
+void route_init()
+{
+	for (U32 i = 0; i < Count(routes); i++)
+		route_add(routes[i].pattern, routes[i].kind);
+}
+
+// Parses a decimal U32 capture, returns the end of the digits or null if
+// there are none or the value overflows.
+const char *route_parse_u32(const char *path, U32 *value)
+{
+	if (*path < '0' || *path > '9')
+		return 0;
+
+	U64 result = 0;
+	for (; *path >= '0' && *path <= '9'; path++) {
+		result = result * 10 + (U32)(*path - '0');
+		if (result > 0xFFFFFFFF)
+			return 0;
+	}
+	*value = (U32)result;
+	return path;
+}
+
+bool route_match_node(U16 index, const char *path, Route_Match *match)
+{
+	Route_Node *node = &route_nodes[index];
+	if (*path == '\0' && node->kind != Route_None) {
+		match->kind = (Route_Kind)node->kind;
+		return true;
+	}
+
+	for (U16 child = node->first_child; child; child = route_nodes[child].next_sibling) {
+		Route_Node *edge = &route_nodes[child];
+		if (edge->edge == Route_Edge_Byte) {
+			if (edge->byte == *path && route_match_node(child, path + 1, match))
+				return true;
+		} else if (edge->edge == Route_Edge_Capture) {
+			U32 value;
+			const char *end = route_parse_u32(path, &value);
+			if (!end)
+				continue;
+			match->captures[match->capture_count++] = value;
+			if (route_match_node(child, end, match))
+				return true;
+			match->capture_count--;
+		} else {
+			match->kind = (Route_Kind)edge->kind;
+			match->rest = path;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Finds the route for `path`, returns `Route_None` if nothing matches.
+Route_Kind route_match(const char *path, Route_Match *match)
+{
+	match->kind = Route_None;
+	match->capture_count = 0;
+	match->rest = 0;
+	route_match_node(0, path, match);
+	return match->kind;
+}
@@ -0,0 +1,241 @@
+
+// Binary saves of the world, so it survives restarts. The save is written
+// from a published snapshot, which the simulation never touches, so saving
+// doesn't stop the ticking. The file is written next to the old save and
+// moved over it only once complete, so a crash while saving leaves the
+// previous save intact.
+//
+// The save is a header followed by the dwarf columns in `DWARF_COLUMNS`
+// order, the locations and the bytes of the name table, each padded to 8
+// bytes. Values are stored in the native layout of the machine,
+// `WORLD_SAVE_VERSION` needs to be bumped when any of them change. The random streams of the dwarves are derived from their seeds
+// and the tick, so there is no random state to store besides those.
+
+#define WORLD_SAVE_PATH "world.save"
+#define WORLD_SAVE_VERSION 1
+
+// Seconds between saves
+#define WORLD_SAVE_INTERVAL 60
+
+enum World_Save_Flags
+{
+	// Scheduled events of the dwarves are valid, ie. the world was saved
+	// while simulated with `world_advance`.
+	World_Save_Events = 0x1,
+};
+
+struct World_Save_Header
+{
+	char magic[8];
+	U32 format_version;
+	U32 flags;
+
+	// Wall clock time the world was last updated
+	U64 last_updated;
+
+	U64 tick;
+	U64 version;
+	U64 post_count;
+	U32 dwarf_count;
+	U32 location_count;
+	U32 names_end;
+	U32 reserved;
+};
+
+static const char world_save_magic[8] = { 'D', 'O', 'R', 'F', 'S', 'A', 'V', 'E' };
+
+// Writes `size` bytes padded to 8, returns false on failure
+bool save_write(FILE *file, const void *data, size_t size)
+{
+	static const char padding[8] = { 0 };
+	size_t padded = (size + 7) & ~(size_t)7;
+	return fwrite(data, 1, size, file) == size
+		&& fwrite(padding, 1, padded - size, file) == padded - size;
+}
+
+bool world_save(World *world, const char *path, U64 last_updated, U32 flags)
+{
+	char temp_path[256];
+	if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path))
+		return false;
+
+	FILE *file = fopen(temp_path, "wb");
+	if (!file)
+		return false;
+
+	World_Save_Header header = { { 0 } };
+	memcpy(header.magic, world_save_magic, sizeof(header.magic));
+	header.format_version = WORLD_SAVE_VERSION;
+	header.flags = flags;
+	header.last_updated = last_updated;
+	header.tick = world->tick;
+	header.version = world->version;
+	header.post_count = world->post_count;
+	header.dwarf_count = world->dwarves.count;
+	header.location_count = world->location_count;
+	header.names_end = world->names_end;
+
+	bool ok = save_write(file, &header, sizeof(header));
+
+#define DWARF_COLUMN_SAVE(type, name) \
+	ok = ok && save_write(file, world->dwarves.name, world->dwarves.count * sizeof(type));
+	DWARF_COLUMNS(DWARF_COLUMN_SAVE)
+#undef DWARF_COLUMN_SAVE
+
+	ok = ok && save_write(file, world->locations, world->location_count * sizeof(Location));
+
+	// Names below `names_end` never change. Blocks are a multiple of 8
+	// bytes, so only the last one needs padding.
+	Name_Table *names = world->names;
+	for (U32 offset = 0; ok && offset < world->names_end; offset += NAME_BLOCK_SIZE) {
+		U32 size = min(world->names_end - offset, NAME_BLOCK_SIZE);
+		ok = save_write(file, names->blocks[offset / NAME_BLOCK_SIZE], size);
+	}
+
+	// The data has to be on disk before the rename is, or a crash can leave
+	// an empty file in place of both saves
+	ok = ok && os_sync_file(file);
+	ok = (fclose(file) == 0) && ok;
+	if (ok)
+		ok = os_replace_file(temp_path, path);
+	if (!ok)
+		remove(temp_path);
+	return ok;
+}
+
+struct Save_Reader
+{
+	const char *data;
+	size_t size;
+	size_t offset;
+};
+
+// Returns the next `size` bytes, null if the file is too short. Once a read
+// fails all the following ones fail too.
+const void *save_read(Save_Reader *reader, size_t size)
+{
+	size_t padded = (size + 7) & ~(size_t)7;
+	if (padded > reader->size - reader->offset) {
+		reader->offset = reader->size;
+		return 0;
+	}
+	const void *data = reader->data + reader->offset;
+	reader->offset += padded;
+	return data;
+}
+
+// Loads the save at `path` into a world, replacing what was in it. The
+// simulation data that isn't saved is rebuilt, except for the event heap,
+// see `world_rebuild_events`. The save is mapped and the sections are
+// copied straight into the columns.
+bool world_load(World *world, const char *path, U64 *last_updated, U32 *flags)
+{
+	os_mapped_file file;
+	if (!os_map_file(path, &file))
+		return false;
+
+	Save_Reader reader = { file.data, file.size, 0 };
+	const World_Save_Header *header = (const World_Save_Header*)save_read(
+		&reader, sizeof(World_Save_Header));
+	if (!header || memcmp(header->magic, world_save_magic, sizeof(header->magic))
+			|| header->format_version != WORLD_SAVE_VERSION) {
+		printf("Ignoring '%s', not a save of this version\n", path);
+		os_unmap_file(&file);
+		return false;
+	}
+
+	U32 dwarf_count = header->dwarf_count;
+	U32 location_count = header->location_count;
+
+	// Find all the sections before touching the world
+#define DWARF_COLUMN_SECTION(type, name) \
+	const void *name = save_read(&reader, dwarf_count * sizeof(type));
+	DWARF_COLUMNS(DWARF_COLUMN_SECTION)
+#undef DWARF_COLUMN_SECTION
+
+	const Location *locations = (const Location*)save_read(&reader,
+		location_count * sizeof(Location));
+	const char *names = (const char*)save_read(&reader, header->names_end);
+
+	bool valid = names && dwarf_count <= DWARF_MAX_COUNT
+		&& header->names_end > 0
+		&& header->names_end <= NAME_MAX_BLOCKS * NAME_BLOCK_SIZE;
+	for (U32 i = 0; valid && i < location_count; i++)
+		valid = locations[i].id == i + 1;
+	U32 existing = 0;
+	for (U32 i = 0; valid && i < dwarf_count; i++) {
+		U32 dwarf_location = ((const U32*)location)[i];
+		valid = dwarf_location <= location_count
+			&& ((const U32*)name)[i] < header->names_end
+			&& (dwarf_location != 0 || !((const bool*)alive)[i])
+			&& ((const U8*)generation)[i] <= (0xFFFFFFFFu >> DWARF_INDEX_BITS);
+		existing += dwarf_location != 0;
+	}
+
+	// The resident lists are followed without checks, so every dwarf that
+	// exists has to be on the list of its location exactly once. A link back
+	// to an earlier dwarf fails the `resident_prev` check, so this ends.
+	U32 listed = 0;
+	for (U32 i = 0; valid && i < location_count; i++) {
+		U32 prev = 0;
+		U32 count = 0;
+		for (U32 r = locations[i].first_resident; valid && r;
+				r = ((const U32*)resident_next)[r - 1]) {
+			valid = r <= dwarf_count && ((const U32*)location)[r - 1] == i + 1
+				&& ((const U32*)resident_prev)[r - 1] == prev;
+			prev = r;
+			count++;
+		}
+		valid = valid && prev == locations[i].last_resident
+			&& count == locations[i].resident_count;
+		listed += count;
+	}
+	valid = valid && listed == existing;
+	if (!valid) {
+		printf("Ignoring '%s', it is truncated or corrupt\n", path);
+		os_unmap_file(&file);
+		return false;
+	}
+
+	world_reserve_dwarves(world, max(dwarf_count, 64));
+	world->dwarves.count = dwarf_count;
+#define DWARF_COLUMN_LOAD(type, name) \
+	memcpy((void*)world->dwarves.name, name, dwarf_count * sizeof(type));
+	DWARF_COLUMNS(DWARF_COLUMN_LOAD)
+#undef DWARF_COLUMN_LOAD
+
+	world_reserve_locations(world, max(location_count, 16));
+	world->location_count = location_count;
+	memcpy(world->locations, locations, location_count * sizeof(Location));
+	world->food_locations.count = 0;
+	world->bed_locations.count = 0;
+	for (U32 i = 0; i < location_count; i++)
+		world_index_location(world, &world->locations[i]);
+
+	// Copies of the world don't have the free list, the slots of removed
+	// dwarves are the ones without a location.
+	world->free_dwarf_count = 0;
+	for (U32 i = 0; i < dwarf_count; i++) {
+		if (dwarf_exists(world, i))
+			continue;
+		if (world->free_dwarf_count == world->free_dwarf_capacity) {
+			world->free_dwarf_capacity = max(world->free_dwarf_capacity * 2, 16);
+			world->free_dwarves = (U32*)realloc(world->free_dwarves,
+				world->free_dwarf_capacity * sizeof(U32));
+		}
+		world->free_dwarves[world->free_dwarf_count++] = i;
+	}
+
+	world_rebuild_burials(world);
+	name_table_load(world->names, names, header->names_end);
+
+	world->tick = header->tick;
+	world->version = header->version;
+	world->post_count = header->post_count;
+	world->events_active = false;
+	*last_updated = header->last_updated;
+	*flags = header->flags;
+
+	os_unmap_file(&file);
+	return true;
+}
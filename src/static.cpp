@@ -0,0 +1,206 @@
+
+// Static assets served from the `data/` directory. All the files are mapped
+// to memory when the directory is indexed, with their headers and ETags
+// computed up front. The directory is watched for changes and re-indexed
+// when files are added, removed or rewritten, so new assets can be deployed
+// without a restart.
+//
+// NOTE: Files should be replaced by moving a new file over the old one. A
+// file that is truncated in place may be sent short while it's being served.
+
+#define STATIC_DIRECTORY "data"
+
+struct Static_File
+{
+	char path[128];
+	const char *content_type;
+	os_mapped_file mapping;
+	char etag[24];
+
+	// Headers following the status line including the final empty line
+	char headers[256];
+	int headers_length;
+};
+
+// Immutable once published, replaced as a whole when the directory changes.
+struct Static_Index
+{
+	Static_File *files;
+	U32 count;
+	U32 capacity;
+
+	// Number of responses using the index, plus one while it's current
+	U32 ref_count;
+};
+
+struct Static_Alias
+{
+	const char *path;
+	const char *file_name;
+} static_aliases[] = {
+	{ "/favicon.ico", "icon.ico" },
+};
+
+struct Static_Content_Type
+{
+	const char *extension;
+	const char *content_type;
+} static_content_types[] = {
+	{ ".ico", "image/x-icon" },
+	{ ".png", "image/png" },
+	{ ".jpg", "image/jpeg" },
+	{ ".gif", "image/gif" },
+	{ ".svg", "image/svg+xml" },
+	{ ".html", "text/html" },
+	{ ".css", "text/css" },
+	{ ".js", "application/javascript" },
+	{ ".txt", "text/plain" },
+};
+
+os_mutex static_lock;
+Static_Index *static_current;
+
+const char *static_content_type(const char *name)
+{
+	const char *extension = strrchr(name, '.');
+	if (extension) {
+		for (U32 i = 0; i < Count(static_content_types); i++) {
+			if (!strcmp(extension, static_content_types[i].extension))
+				return static_content_types[i].content_type;
+		}
+	}
+	return "application/octet-stream";
+}
+
+// 64-bit FNV-1a
+U64 static_hash(const char *data, size_t length)
+{
+	U64 hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (U8)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+void static_index_file(const char *name, void *user)
+{
+	Static_Index *index = (Static_Index*)user;
+
+	if (index->count == index->capacity) {
+		index->capacity = max(index->capacity * 2, 16);
+		index->files = (Static_File*)realloc(index->files,
+			index->capacity * sizeof(Static_File));
+	}
+
+	Static_File *file = &index->files[index->count];
+	if ((size_t)snprintf(file->path, sizeof(file->path), "/static/%s", name)
+		>= sizeof(file->path))
+		return;
+
+	char file_path[256];
+	snprintf(file_path, sizeof(file_path), STATIC_DIRECTORY "/%s", name);
+	if (!os_map_file(file_path, &file->mapping))
+		return;
+
+	file->content_type = static_content_type(name);
+	snprintf(file->etag, sizeof(file->etag), "\"%016llx\"",
+		(unsigned long long)static_hash(file->mapping.data, file->mapping.size));
+	file->headers_length = snprintf(file->headers, sizeof(file->headers),
+		"Content-Length: %llu\r\nContent-Type: %s\r\nETag: %s\r\n\r\n",
+		(unsigned long long)file->mapping.size, file->content_type, file->etag);
+
+	index->count++;
+}
+
+void static_index_free(Static_Index *index)
+{
+	for (U32 i = 0; i < index->count; i++) {
+		os_unmap_file(&index->files[i].mapping);
+	}
+	free(index->files);
+	free(index);
+}
+
+// Drops a reference returned by `static_find`.
+void static_release(Static_Index *index)
+{
+	os_mutex_lock(&static_lock);
+	bool unused = --index->ref_count == 0;
+	os_mutex_unlock(&static_lock);
+
+	if (unused)
+		static_index_free(index);
+}
+
+// Indexes the directory again and publishes the new index.
+void static_reload()
+{
+	Static_Index *index = (Static_Index*)calloc(1, sizeof(Static_Index));
+	index->ref_count = 1;
+	if (!os_list_directory(STATIC_DIRECTORY, static_index_file, index)) {
+		printf("Failed to index static files in '%s'\n", STATIC_DIRECTORY);
+	}
+
+	os_mutex_lock(&static_lock);
+	Static_Index *old = static_current;
+	static_current = index;
+	os_mutex_unlock(&static_lock);
+
+	if (old)
+		static_release(old);
+
+	printf("Indexed %u static files\n", index->count);
+}
+
+// Looks up the file served at `path`. The file stays valid until the
+// returned index is released with `static_release`.
+Static_File *static_find(const char *path, Static_Index **index_ref)
+{
+	const char *file_name = 0;
+	for (U32 i = 0; i < Count(static_aliases); i++) {
+		if (!strcmp(path, static_aliases[i].path))
+			file_name = static_aliases[i].file_name;
+	}
+
+	os_mutex_lock(&static_lock);
+	Static_Index *index = static_current;
+	index->ref_count++;
+	os_mutex_unlock(&static_lock);
+
+	for (U32 i = 0; i < index->count; i++) {
+		Static_File *file = &index->files[i];
+		if (file_name ? !strcmp(file->path + sizeof("/static/") - 1, file_name)
+				: !strcmp(file->path, path)) {
+			*index_ref = index;
+			return file;
+		}
+	}
+
+	static_release(index);
+	return 0;
+}
+
+OS_THREAD_ENTRY(thread_static_watch, watch_ptr)
+{
+	os_file_watch watch = *(os_file_watch*)watch_ptr;
+	while (os_file_watch_wait(watch)) {
+		static_reload();
+	}
+
+	puts("Stopped watching static files for changes");
+	OS_THREAD_RETURN;
+}
+
+void static_init()
+{
+	os_mutex_init(&static_lock);
+	static_reload();
+
+	static os_file_watch watch;
+	watch = os_watch_directory(STATIC_DIRECTORY);
+	if (os_valid_file_watch(watch))
+		os_thread_do(thread_static_watch, &watch);
+	else
+		printf("Failed to watch '%s' for changes\n", STATIC_DIRECTORY);
+}
@@ -0,0 +1,935 @@
+// Tests of the parts of the server that run without sockets, built and run
+// by `./build.sh test`. Arguments select the tests whose names contain any
+// of them. A failed check is reported and the test goes on, the exit code
+// tells whether everything passed.
+
+#define DORF_NO_MAIN
+#include "build.cpp"
+
+U32 test_check_count;
+U32 test_failure_count;
+
+bool test_check(bool ok, const char *expression, const char *file, int line)
+{
+	test_check_count++;
+	if (!ok) {
+		test_failure_count++;
+		printf("  %s:%d: Check failed: %s\n", file, line, expression);
+	}
+	return ok;
+}
+
+#define Check(expression) test_check((expression), #expression, __FILE__, __LINE__)
+
+typedef void Test_Func();
+
+struct Test_Case
+{
+	const char *name;
+	Test_Func *func;
+};
+
+// Generates a world with its posts kept in memory
+World *test_world(int dwarf_count, U64 seed)
+{
+	Name_Table *names = (Name_Table*)malloc(sizeof(Name_Table));
+	name_table_init(names);
+	World *world = (World*)malloc(sizeof(World));
+	world_init(world, names);
+	generate_world(world, dwarf_count, seed);
+	world_attach_post_log(world, (Post_Log*)calloc(1, sizeof(Post_Log)));
+	return world;
+}
+
+// -- Formatting
+
+// Copies the output to `dest` as a string
+const char *test_output_string(Output *out, char *dest, size_t size)
+{
+	size_t length = 0;
+	for (Output_Chunk *chunk = out->first; chunk; chunk = chunk->next) {
+		size_t copy = min((size_t)chunk->length, size - 1 - length);
+		memcpy(dest + length, chunk->data, copy);
+		length += copy;
+	}
+	dest[length] = '\0';
+	return dest;
+}
+
+// Checks what `out` got against `expected` and starts it over
+bool test_check_output(Output *out, const char *expected)
+{
+	char text[256];
+	test_output_string(out, text, sizeof(text));
+	bool same = !strcmp(text, expected);
+	if (!Check(same))
+		printf("  Wrote '%s', expected '%s'\n", text, expected);
+	out_init(out, out->arena);
+	return same;
+}
+
+void test_format_integers()
+{
+	Memory_Arena *arena = arena_acquire();
+	Output out;
+	out_init(&out, arena);
+	char expected[64];
+
+	U64 values[] = { 0, 1, 9, 10, 99, 100, 101, 999, 1000, 4294967295ULL,
+		4294967296ULL, 9999999999999999999ULL, 10000000000000000000ULL, UINT64_MAX };
+	for (U32 i = 0; i < Count(values); i++) {
+		out_u64(&out, values[i]);
+		snprintf(expected, sizeof(expected), "%llu", (unsigned long long)values[i]);
+		test_check_output(&out, expected);
+
+		out_hex(&out, values[i], 16);
+		snprintf(expected, sizeof(expected), "%016llx", (unsigned long long)values[i]);
+		test_check_output(&out, expected);
+	}
+
+	Random_Series rs = series_from_seed32(25);
+	for (U32 i = 0; i < 10000; i++) {
+		U64 value = next64(&rs) >> (next32(&rs) % 64);
+		out_u64(&out, value);
+		snprintf(expected, sizeof(expected), "%llu", (unsigned long long)value);
+		if (!test_check_output(&out, expected))
+			break;
+	}
+
+	I32 signed_values[] = { INT32_MIN, INT32_MIN + 1, -100, -1, 0, 1, INT32_MAX };
+	for (U32 i = 0; i < Count(signed_values); i++) {
+		out_i32(&out, signed_values[i]);
+		snprintf(expected, sizeof(expected), "%d", signed_values[i]);
+		test_check_output(&out, expected);
+	}
+
+	out_hex(&out, 0, 0);
+	test_check_output(&out, "0");
+	out_hex(&out, 0xABC, 2);
+	test_check_output(&out, "abc");
+	arena_release(arena);
+}
+
+// `out_fixed` matches printf except that it rounds ties away from zero,
+// where printf rounds exact ties to even, and doesn't write negative zero
+void test_format_fixed()
+{
+	Memory_Arena *arena = arena_acquire();
+	Output out;
+	out_init(&out, arena);
+	char expected[64];
+
+	struct { double value; U32 decimals; } cases[] = {
+		{ 0.0, 0 }, { 0.0, 2 }, { 1.0, 0 }, { -1.0, 3 }, { 0.1, 1 }, { 0.05, 3 },
+		{ 123.456, 2 }, { -123.456, 2 }, { 0.999, 2 }, { -0.999, 2 },
+		{ 1e15, 2 }, { -2.0 / 3.0, 6 }, { 1234567.891, 9 }, { 42.0, 9 },
+	};
+	for (U32 i = 0; i < Count(cases); i++) {
+		out_fixed(&out, cases[i].value, cases[i].decimals);
+		snprintf(expected, sizeof(expected), "%.*f", (int)cases[i].decimals, cases[i].value);
+		test_check_output(&out, expected);
+	}
+
+	// Random values away from ties
+	Random_Series rs = series_from_seed32(26);
+	for (U32 i = 0; i < 10000; i++) {
+		double value = (double)((I64)(next64(&rs) % 2000000000000ULL) - 1000000000000LL) / 997.0;
+		U32 decimals = next32(&rs) % 7;
+		double scaled = fabs(value) * pow(10.0, decimals);
+		if (fabs(scaled - floor(scaled) - 0.5) < 1e-3 || scaled < 0.5)
+			continue;
+		out_fixed(&out, value, decimals);
+		snprintf(expected, sizeof(expected), "%.*f", (int)decimals, value);
+		if (!test_check_output(&out, expected))
+			break;
+	}
+
+	// Exact ties and values that round to zero
+	out_fixed(&out, 2.5, 0);
+	test_check_output(&out, "3");
+	out_fixed(&out, -2.5, 0);
+	test_check_output(&out, "-3");
+	out_fixed(&out, 0.125, 2);
+	test_check_output(&out, "0.13");
+	out_fixed(&out, -0.004, 2);
+	test_check_output(&out, "0.00");
+	out_fixed(&out, -0.0, 1);
+	test_check_output(&out, "0.0");
+	out_fixed(&out, 1e300, 2);
+	test_check_output(&out, "inf");
+	out_fixed(&out, -1e300, 2);
+	test_check_output(&out, "-inf");
+	arena_release(arena);
+}
+
+void test_format_html()
+{
+	Memory_Arena *arena = arena_acquire();
+	Output out;
+	out_init(&out, arena);
+
+	struct { const char *text; const char *escaped; } cases[] = {
+		{ "", "" },
+		{ "Urist McMiner", "Urist McMiner" },
+		{ "&", "&amp;" },
+		{ "<", "&lt;" },
+		{ ">", "&gt;" },
+		{ "\"", "&quot;" },
+		{ "'", "&#39;" },
+		{ "&&<<>>", "&amp;&amp;&lt;&lt;&gt;&gt;" },
+		{ "<a href=\"x\">Kogan's & co</a>",
+			"&lt;a href=&quot;x&quot;&gt;Kogan&#39;s &amp; co&lt;/a&gt;" },
+		{ "&amp;", "&amp;amp;" },
+		{ "trailing &", "trailing &amp;" },
+	};
+	for (U32 i = 0; i < Count(cases); i++) {
+		out_html(&out, cases[i].text);
+		test_check_output(&out, cases[i].escaped);
+	}
+
+	// Escapes across chunks end up the same
+	size_t length = 0;
+	for (U32 i = 0; i < 5000; i++) {
+		out_html(&out, "a<b&");
+		length += 11;
+	}
+	Check(out.length == length && out.first != out.last);
+	arena_release(arena);
+}
+
+// -- Request parsing
+
+// Parses a copy of `text`, as the parser writes into its buffer
+HTTP_Parse_Result test_parse(const char *text, int size, HTTP_Request *request,
+	char *buffer)
+{
+	memcpy(buffer, text, size);
+	return http_parse_request(buffer, size, request);
+}
+
+void test_parse_requests()
+{
+	static char buffer[KB(16)];
+	HTTP_Request request;
+
+	// Every prefix of a request is incomplete, wherever the receive split it
+	const char full[] =
+		"GET /entities/17/feed?at=1200 HTTP/1.1\r\n"
+		"Host: localhost\r\n"
+		"If-None-Match: \"abc\"\r\n"
+		"\r\n";
+	int full_size = (int)sizeof(full) - 1;
+	U32 split_failures = 0;
+	for (int size = 0; size < full_size; size++)
+		split_failures += test_parse(full, size, &request, buffer) != HTTP_Parse_Incomplete;
+	Check(split_failures == 0);
+	Check(test_parse(full, full_size, &request, buffer) == HTTP_Parse_Ok);
+	Check(request.length == full_size);
+	Check(!strcmp(request.method.data, "GET"));
+	Check(!strcmp(request.path.data, "/entities/17/feed"));
+	Check(!strcmp(request.query.data, "at=1200"));
+	Check(!strcmp(request.version.data, "HTTP/1.1"));
+	Check(request.if_none_match.length == 5 && !memcmp(request.if_none_match.data, "\"abc\"", 5));
+
+	// Pipelined requests, only the first one is parsed
+	char pipelined[sizeof(full) * 2];
+	snprintf(pipelined, sizeof(pipelined), "%s%s", full, full);
+	Check(test_parse(pipelined, full_size * 2, &request, buffer) == HTTP_Parse_Ok
+		&& request.length == full_size);
+
+	// Lines ending in a bare LF are accepted, a missing empty line keeps it
+	// incomplete
+	const char bare_lf[] = "GET / HTTP/1.1\nHost: x\n\n";
+	Check(test_parse(bare_lf, (int)sizeof(bare_lf) - 1, &request, buffer) == HTTP_Parse_Ok
+		&& !strcmp(request.path.data, "/"));
+	const char no_end[] = "GET / HTTP/1.1\r\nHost: x\r\n";
+	Check(test_parse(no_end, (int)sizeof(no_end) - 1, &request, buffer) == HTTP_Parse_Incomplete);
+
+	const char *malformed[] = {
+		"GET\r\n\r\n",
+		"GET /\r\n\r\n",
+		" / HTTP/1.1\r\n\r\n",
+		"GET / HTTP/1.1 extra\r\n\r\n",
+		"GET / HTTP/1.1\r\nNo colon here\r\n\r\n",
+		"GET / HTTP/1.1\r\n: empty name\r\n\r\n",
+	};
+	for (U32 i = 0; i < Count(malformed); i++) {
+		int size = (int)strlen(malformed[i]);
+		if (!Check(test_parse(malformed[i], size, &request, buffer) == HTTP_Parse_Error))
+			printf("  Accepted '%s'\n", malformed[i]);
+	}
+	const char null_byte[] = "GET /a\0b HTTP/1.1\r\n\r\n";
+	Check(test_parse(null_byte, (int)sizeof(null_byte) - 1, &request, buffer) == HTTP_Parse_Error);
+
+	// A header that never ends is refused once it reaches the maximum size
+	Socket_Buffer oversized = { 0 };
+	oversized.data = buffer;
+	oversized.data_size = sizeof(buffer);
+	int prefix = snprintf(buffer, sizeof(buffer), "GET / HTTP/1.1\r\nCookie: ");
+	memset(buffer + prefix, 'a', HTTP_MAX_REQUEST_SIZE);
+	oversized.size = HTTP_MAX_REQUEST_SIZE - 1;
+	Check(buffer_parse_request(&oversized, &request) == HTTP_Parse_Incomplete);
+	oversized.size = HTTP_MAX_REQUEST_SIZE;
+	Check(buffer_parse_request(&oversized, &request) == HTTP_Parse_Error);
+	memcpy(buffer + KB(12), "\r\n\r\n", 4);
+	oversized.size = KB(12) + 4;
+	Check(buffer_parse_request(&oversized, &request) == HTTP_Parse_Error);
+}
+
+// Header names are matched in any case, keep-alive follows the version
+// unless the Connection header says otherwise
+void test_parse_keep_alive()
+{
+	static char buffer[KB(1)];
+	struct { const char *text; bool keep_alive; } cases[] = {
+		{ "GET / HTTP/1.1\r\n\r\n", true },
+		{ "GET / HTTP/1.0\r\n\r\n", false },
+		{ "GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", true },
+		{ "GET / HTTP/1.0\r\nCONNECTION:Keep-Alive\r\n\r\n", true },
+		{ "GET / HTTP/1.1\r\nconnection: close\r\n\r\n", false },
+		{ "GET / HTTP/1.1\r\nConnection:  Upgrade, Close \r\n\r\n", false },
+		{ "GET / HTTP/1.1\r\nConnection: upgrade\r\n\r\n", true },
+		{ "GET / HTTP/1.0\r\nX-Connection: keep-alive\r\n\r\n", false },
+	};
+	for (U32 i = 0; i < Count(cases); i++) {
+		HTTP_Request request;
+		int size = (int)strlen(cases[i].text);
+		bool parsed = test_parse(cases[i].text, size, &request, buffer) == HTTP_Parse_Ok;
+		if (!Check(parsed && http_keep_alive(&request) == cases[i].keep_alive))
+			printf("  Wrong keep-alive for case %u\n", i);
+	}
+
+	HTTP_Request request;
+	const char mixed[] = "GET / HTTP/1.1\r\nIF-NONE-MATCH: \"x\"\r\naccept-ENCODING: gzip\r\n\r\n";
+	Check(test_parse(mixed, (int)sizeof(mixed) - 1, &request, buffer) == HTTP_Parse_Ok);
+	Check(request.if_none_match.length == 3 && request.accept_encoding.length == 4);
+}
+
+// Runs the parser tests with every line scanner the CPU supports
+void test_parse_scanners(Test_Func *test)
+{
+	HTTP_Scan_Func previous = http_scan;
+	HTTP_Scan_Func scanners[3] = { http_scan_scalar };
+	U32 scanner_count = 1;
+#if ARCH_SSE2
+	scanners[scanner_count++] = http_scan_sse2;
+	if (os_cpu_has_avx2())
+		scanners[scanner_count++] = http_scan_avx2;
+#endif
+	for (U32 i = 0; i < scanner_count; i++) {
+		http_scan = scanners[i];
+		test();
+	}
+	http_scan = previous;
+}
+
+void test_parse_requests_all()
+{
+	test_parse_scanners(test_parse_requests);
+}
+
+void test_parse_keep_alive_all()
+{
+	test_parse_scanners(test_parse_keep_alive);
+}
+
+// -- Simulation modes
+
+// Event mode and tick-by-tick follow the same rules and draw activities
+// from the same streams, only deaths are sampled differently. So every
+// dwarf that is alive in both worlds has to be in the same state and have
+// made the same activity posts at the same ticks.
+void test_modes_agree()
+{
+	const int dwarf_count = 2000;
+	World *ticked = test_world(dwarf_count, 0xD02F);
+	World *advanced = test_world(dwarf_count, 0xD02F);
+
+	for (int i = 0; i < 3000; i++)
+		world_tick(ticked, &work_pool);
+
+	// Uneven slices, catching up in one go or tick by tick has to agree
+	world_start_events(advanced);
+	for (U64 ticks = 1; advanced->tick < 3000; ticks = ticks * 3 + 1)
+		world_advance(advanced, min(ticks, 3000 - advanced->tick));
+	Check(ticked->tick == advanced->tick);
+
+	U32 survivors = 0;
+	for (U32 i = 0; i < (U32)dwarf_count; i++) {
+		if (!ticked->dwarves.alive[i] || !advanced->dwarves.alive[i])
+			continue;
+		survivors++;
+		Check(ticked->dwarves.hunger[i] == advanced->dwarves.hunger[i]);
+		Check(ticked->dwarves.sleep[i] == advanced->dwarves.sleep[i]);
+		Check(ticked->dwarves.activity[i] == advanced->dwarves.activity[i]);
+		Check(ticked->dwarves.location[i] == advanced->dwarves.location[i]);
+	}
+	Check(survivors > (U32)dwarf_count * 9 / 10);
+
+	// Activity posts of the survivors, in the order they were made
+	Post_Log *logs[2] = { ticked->post_log, advanced->post_log };
+	U64 positions[2] = { 0, 0 };
+	U32 compared = 0;
+	for (;;) {
+		Post_Record *records[2] = { 0, 0 };
+		for (int side = 0; side < 2; side++) {
+			for (; positions[side] < logs[side]->count; positions[side]++) {
+				Post_Record *record = post_log_get(logs[side], positions[side]);
+				U32 index;
+				if (record->type == Post_Activity && find_dwarf(ticked, record->by_id, &index)
+						&& ticked->dwarves.alive[index] && advanced->dwarves.alive[index]) {
+					records[side] = record;
+					positions[side]++;
+					break;
+				}
+			}
+		}
+		if (!records[0] || !records[1]) {
+			Check(!records[0] && !records[1]);
+			break;
+		}
+		bool same = records[0]->tick == records[1]->tick
+			&& records[0]->by_id == records[1]->by_id
+			&& records[0]->data == records[1]->data;
+		compared++;
+		if (!Check(same))
+			break;
+	}
+	Check(compared > 1000);
+}
+
+// -- Dwarves
+
+// Slots of removed dwarves are reused under a new id, the old one must not
+// find whoever took the slot
+void test_remove_dwarf()
+{
+	World *world = test_world(100, 3);
+	U32 index = 42;
+	U32 old_id = dwarf_id(world, index);
+	U32 location = world->dwarves.location[index];
+
+	world->dwarves.alive[index] = false;
+	world->dwarves.death_tick[index] = world->tick;
+	world_remove_dwarf(world, index);
+	U32 found;
+	Check(!find_dwarf(world, old_id, &found));
+	for (U32 r = world->locations[location - 1].first_resident; r;
+			r = world->dwarves.resident_next[r - 1])
+		Check(r - 1 != index);
+
+	// Added while the events run, so it has to join them
+	world_start_events(world);
+	U32 new_id = world_add_dwarf(world, "Urist", location, 0, 0, 7);
+	Check(find_dwarf(world, new_id, &found) && found == index);
+	Check(new_id != old_id);
+	Check(!find_dwarf(world, old_id, &found));
+	Check(world->dwarves.death_tick[index] != UINT64_MAX);
+	Check(world->dwarves.next_event_tick[index] != UINT64_MAX);
+	world_advance(world, 100);
+	Check(world->dwarves.state_tick[index] > 0);
+}
+
+// Dead dwarves are due for removal in order of death, once they have been
+// dead for `DWARF_BURIAL_TICKS`
+void test_burials()
+{
+	World *world = test_world(100, 5);
+	U32 dead[] = { 10, 3, 77 };
+	for (U32 i = 0; i < Count(dead); i++) {
+		world->dwarves.alive[dead[i]] = false;
+		world->dwarves.death_tick[dead[i]] = world->tick + i;
+		world_queue_burial(world, dwarf_id(world, dead[i]));
+	}
+
+	// Removed by someone else in the meantime
+	world_remove_dwarf(world, 3);
+
+	U32 index;
+	world->tick += DWARF_BURIAL_TICKS - 1;
+	Check(!world_next_burial(world, &index));
+	world->tick++;
+	Check(world_next_burial(world, &index) && index == 10);
+	Check(!world_next_burial(world, &index));
+	world->tick += 2;
+	Check(world_next_burial(world, &index) && index == 77);
+	Check(!world_next_burial(world, &index));
+}
+
+// -- Saves
+
+bool test_load(const char *path)
+{
+	Name_Table *names = (Name_Table*)malloc(sizeof(Name_Table));
+	name_table_init(names);
+	World *world = (World*)malloc(sizeof(World));
+	world_init(world, names);
+	U64 last_updated;
+	U32 flags;
+	return world_load(world, path, &last_updated, &flags);
+}
+
+// A world loads back as it was saved, one with broken resident lists or
+// generations out of range is refused
+void test_save_load()
+{
+	const char *path = "test.save";
+	World *world = test_world(500, 9);
+	world->dwarves.alive[7] = false;
+	world_remove_dwarf(world, 7);
+	for (int i = 0; i < 10; i++)
+		world_tick(world, &work_pool);
+
+	// Saves are written from snapshots, which know how far the names go
+	world->names_end = world->names->end;
+	Check(world_save(world, path, 1234, 0));
+
+	Name_Table names;
+	name_table_init(&names);
+	World loaded;
+	world_init(&loaded, &names);
+	U64 last_updated = 0;
+	U32 flags = 1;
+	Check(world_load(&loaded, path, &last_updated, &flags));
+	Check(last_updated == 1234 && flags == 0);
+	Check(loaded.tick == world->tick && loaded.dwarves.count == world->dwarves.count);
+	U32 index;
+	Check(!find_dwarf(&loaded, dwarf_id(world, 7) - (1u << DWARF_INDEX_BITS), &index));
+	for (U32 i = 0; i < world->dwarves.count; i++) {
+		Check(loaded.dwarves.hunger[i] == world->dwarves.hunger[i]
+			&& loaded.dwarves.generation[i] == world->dwarves.generation[i]
+			&& loaded.dwarves.resident_next[i] == world->dwarves.resident_next[i]);
+	}
+
+	// A dwarf linked into the list of a location it isn't at
+	Dwarves *dwarves = &world->dwarves;
+	U32 first = world->locations[0].first_resident;
+	U32 stray = 0;
+	for (U32 i = 0; i < dwarves->count && !stray; i++) {
+		if (dwarves->location[i] > 1)
+			stray = i + 1;
+	}
+	U32 saved_next = dwarves->resident_next[first - 1];
+	dwarves->resident_next[first - 1] = stray;
+	Check(world_save(world, path, 0, 0));
+	Check(!test_load(path));
+	dwarves->resident_next[first - 1] = saved_next;
+
+	// A cycle
+	dwarves->resident_next[first - 1] = first;
+	Check(world_save(world, path, 0, 0));
+	Check(!test_load(path));
+	dwarves->resident_next[first - 1] = saved_next;
+
+	// A removed slot that is still alive
+	dwarves->alive[7] = true;
+	Check(world_save(world, path, 0, 0));
+	Check(!test_load(path));
+	dwarves->alive[7] = false;
+
+	Check(world_save(world, path, 0, 0));
+	Check(test_load(path));
+	remove(path);
+}
+
+// -- Journal
+
+// Entries only needed by deleted checkpoints are dropped, from memory and
+// from the file, and what is left reads back the same
+void test_journal_compact()
+{
+	const char *directory = "test_journal";
+	os_create_directory(directory);
+	Journal *journal = (Journal*)malloc(sizeof(Journal));
+	journal_open(journal, directory, 0, false);
+
+	U64 tick = 0;
+	U32 most = 0;
+	for (U32 i = 0; i < (CHECKPOINT_LIMIT + 10) * 4; i++) {
+		for (U32 j = 0; j < 60; j++, tick += 10)
+			journal_advance(journal, tick, 10, false);
+		Journal_Entry checkpoint = { Journal_Checkpoint, 0, tick, 0 };
+		journal_append(journal, &checkpoint);
+		most = max(most, journal->count);
+	}
+	Check(journal->checkpoint_count - journal->first_checkpoint == CHECKPOINT_LIMIT);
+	Check(most <= (CHECKPOINT_LIMIT + 1) * 61 * 2);
+
+	// The oldest checkpoint kept can still be replayed from
+	U64 start = journal->checkpoints[journal->first_checkpoint];
+	bool reaches = false;
+	for (U32 i = 0; i < journal->count; i++) {
+		Journal_Entry *entry = &journal->entries[i];
+		reaches = reaches || (entry->type == Journal_Advance && entry->tick == start);
+	}
+	Check(reaches);
+
+	Journal *reopened = (Journal*)malloc(sizeof(Journal));
+	journal_open(reopened, directory, tick, true);
+	Check(reopened->count == journal->count);
+	Check(!memcmp(reopened->entries, journal->entries, journal->count * sizeof(Journal_Entry)));
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/" JOURNAL_PATH, directory);
+	fclose(journal->file);
+	fclose(reopened->file);
+	remove(path);
+}
+
+// -- Random numbers
+
+// Known answers from the Random123 distribution (kat_vectors)
+void test_philox_known_answers()
+{
+	struct { U32 counter[4]; U64 key; U32 expected[4]; } vectors[] = {
+		{ { 0, 0, 0, 0 }, 0,
+			{ 0x6627E8D5, 0xE169C58D, 0xBC57AC4C, 0x9B00DBD8 } },
+		{ { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF }, 0xFFFFFFFFFFFFFFFFULL,
+			{ 0x408F276D, 0x41C83B0E, 0xA20BC7C6, 0x6D5451FD } },
+		{ { 0x243F6A88, 0x85A308D3, 0x13198A2E, 0x03707344 }, 0x299F31D0A4093822ULL,
+			{ 0xD16CFE09, 0x94FDCCEB, 0x5001E420, 0x24126EA1 } },
+	};
+	for (U32 v = 0; v < Count(vectors); v++) {
+		U32 block[4];
+		memcpy(block, vectors[v].counter, sizeof(block));
+		philox4x32(block, vectors[v].key);
+		Check(!memcmp(block, vectors[v].expected, sizeof(block)));
+	}
+}
+
+// Known answers of pcg64 seeded with state 42 and stream 54, from the
+// check-pcg64 output of the PCG reference implementation
+void test_pcg64_known_answers()
+{
+	U64 expected[] = {
+		0x86B1DA1D72062B68ULL, 0x1304AA46C9853D39ULL, 0xA3670E9E0DD50358ULL,
+		0xF9090E529A7DAE00ULL, 0xC85B9FD837996F2CULL, 0x606121F8E3919196ULL,
+	};
+	Random_Series series = series_from_state(u128(0, 42), u128(0, 54));
+	for (U32 i = 0; i < Count(expected); i++)
+		Check(next64(&series) == expected[i]);
+}
+
+void test_series_advance()
+{
+	U64 distances[] = { 0, 1, 2, 3, 63, 64, 1000, 4097 };
+	for (U32 d = 0; d < Count(distances); d++) {
+		Random_Series stepped = series_from_key(7, d, 11);
+		Random_Series jumped = stepped;
+		for (U64 i = 0; i < distances[d]; i++)
+			next64(&stepped);
+		series_advance(&jumped, distances[d]);
+		Check(next64(&stepped) == next64(&jumped));
+	}
+}
+
+// Fills with AVX2 have to match the scalar ones for any count, and the
+// series of a key has to match the first block of its fill
+void test_random_fill()
+{
+	U32 salts[64];
+	Random_Series rs = series_from_seed32(5);
+	for (U32 i = 0; i < Count(salts); i++)
+		salts[i] = next32(&rs);
+
+	U32 block[4];
+	random_fill_scalar(99, 1234, salts, block, 4);
+	Random_Series from_fill = series_from_block(block);
+	Random_Series from_key = series_from_key(99, 1234, salts[0]);
+	Check(next64(&from_fill) == next64(&from_key));
+
+#if ARCH_SSE2
+	if (!os_cpu_has_avx2()) {
+		puts("  Skipped the AVX2 fills, the CPU doesn't support AVX2");
+		return;
+	}
+
+	U32 counts[] = { 0, 1, 3, 4, 31, 32, 33, 64, 100, 255, 256 };
+	for (U32 c = 0; c < Count(counts); c++) {
+		for (int salted = 0; salted < 2; salted++) {
+			U32 scalar[256], avx2[256];
+			memset(scalar, 0xAA, sizeof(scalar));
+			memset(avx2, 0xAA, sizeof(avx2));
+			U64 counter = 0xFFFFFFFEULL + c;
+			random_fill_scalar(0xD02F, counter, salted ? salts : 0, scalar, counts[c]);
+			random_fill_avx2(0xD02F, counter, salted ? salts : 0, avx2, counts[c]);
+			if (!Check(!memcmp(scalar, avx2, sizeof(scalar))))
+				printf("  Fills of %u numbers differ\n", counts[c]);
+		}
+	}
+#endif
+}
+
+// Statistical sanity of the distributions. The seeds are fixed, so these
+// can't fail by chance, the tolerances of 6 standard deviations only leave
+// room for changing the seeds.
+
+// Checks that `observed` successes out of `trials` fit the chance
+bool test_check_rate(U64 observed, U64 trials, double chance, const char *what)
+{
+	double expected = (double)trials * chance;
+	double deviation = sqrt(expected * (1.0 - chance));
+	bool ok = fabs((double)observed - expected) <= 6.0 * deviation + 1.0;
+	if (!Check(ok)) {
+		printf("  %s: %llu of %llu, expected %.1f\n", what, (unsigned long long)observed,
+			(unsigned long long)trials, expected);
+	}
+	return ok;
+}
+
+// Chi-square of counts in 256 equally likely buckets, 255 degrees of
+// freedom. Values far below the mean are as suspicious as ones far above.
+bool test_check_buckets(const U32 counts[256], U64 samples, const char *what)
+{
+	double expected = (double)samples / 256.0;
+	double chi_square = 0.0;
+	for (U32 i = 0; i < 256; i++) {
+		double difference = (double)counts[i] - expected;
+		chi_square += difference * difference / expected;
+	}
+	double deviation = sqrt(2.0 * 255.0);
+	bool ok = fabs(chi_square - 255.0) <= 6.0 * deviation;
+	if (!Check(ok))
+		printf("  %s: chi-square %.1f with 255 degrees of freedom\n", what, chi_square);
+	return ok;
+}
+
+// The high and low bytes of the numbers fall evenly into buckets and every
+// bit is set half of the time
+void test_random_uniform()
+{
+	const U32 samples = 1 << 20;
+	static U32 high[256], low[256], fill_high[256], fill_low[256], keyed[256];
+	static U32 bits[64];
+	memset(high, 0, sizeof(high));
+	memset(low, 0, sizeof(low));
+	memset(fill_high, 0, sizeof(fill_high));
+	memset(fill_low, 0, sizeof(fill_low));
+	memset(keyed, 0, sizeof(keyed));
+	memset(bits, 0, sizeof(bits));
+
+	Random_Series rs = series_from_seed32(0x5EED);
+	for (U32 i = 0; i < samples; i++) {
+		U64 value = next64(&rs);
+		high[value >> 56]++;
+		low[value & 0xFF]++;
+		for (U32 bit = 0; bit < 64; bit++)
+			bits[bit] += (U32)(value >> bit) & 1;
+	}
+	test_check_buckets(high, samples, "next64 high byte");
+	test_check_buckets(low, samples, "next64 low byte");
+	for (U32 bit = 0; bit < 64; bit++) {
+		if (!test_check_rate(bits[bit], samples, 0.5, "next64 bit"))
+			printf("  Bit %u\n", bit);
+	}
+
+	// Consecutive counters, as the tick gives them to the dwarves
+	static U32 numbers[4096];
+	for (U32 batch = 0; batch < samples / Count(numbers); batch++) {
+		random_fill(0xD02F, (U64)batch * Count(numbers) / 4, 0, numbers, Count(numbers));
+		for (U32 i = 0; i < Count(numbers); i++) {
+			fill_high[numbers[i] >> 24]++;
+			fill_low[numbers[i] & 0xFF]++;
+		}
+	}
+	test_check_buckets(fill_high, samples, "random_fill high byte");
+	test_check_buckets(fill_low, samples, "random_fill low byte");
+
+	// First numbers of the series of neighbouring dwarves
+	for (U32 i = 0; i < samples; i++) {
+		Random_Series series = series_from_key(0xD02F, 1000, i);
+		keyed[next64(&series) >> 56]++;
+	}
+	test_check_buckets(keyed, samples, "series_from_key");
+}
+
+void test_random_rates()
+{
+	Random_Series rs = series_from_seed32(0xC4A7);
+	U64 inverses[] = { 2, 3, 10, 1000 };
+	for (U32 i = 0; i < Count(inverses); i++) {
+		const U64 trials = 1 << 22;
+		U64 hits = 0;
+		for (U64 t = 0; t < trials; t++)
+			hits += next_one_in(&rs, inverses[i]);
+		test_check_rate(hits, trials, 1.0 / (double)inverses[i], "next_one_in");
+	}
+
+	double chances[] = { 0.5, 0.1, 0.001 };
+	for (U32 i = 0; i < Count(chances); i++) {
+		const U64 trials = 1 << 22;
+		U64 hits = 0;
+		for (U64 t = 0; t < trials; t++)
+			hits += next_chance(&rs, chances[i]);
+		test_check_rate(hits, trials, chances[i], "next_chance");
+	}
+
+	// One in a million, the chance of a dwarf dying each tick
+	const U64 rare_trials = 100000000;
+	U64 one_in = 0, chance = 0;
+	for (U64 t = 0; t < rare_trials; t++) {
+		one_in += next_one_in(&rs, 1000000);
+		chance += next_chance(&rs, DWARF_DEATH_CHANCE);
+	}
+	test_check_rate(one_in, rare_trials, 1e-6, "next_one_in a million");
+	test_check_rate(chance, rare_trials, DWARF_DEATH_CHANCE, "next_chance a million");
+
+	U32 never = 0, always = 0;
+	for (U32 t = 0; t < 100000; t++) {
+		never += next_chance(&rs, 0.0);
+		always += next_chance(&rs, 1.0);
+	}
+	Check(never == 0 && always == 100000);
+}
+
+// The mean of a geometric distribution from 1 is one over the chance
+void test_random_geometric()
+{
+	Random_Series rs = series_from_seed32(0x6E0);
+	double chances[] = { 0.5, 0.01, DWARF_DEATH_CHANCE };
+	for (U32 i = 0; i < Count(chances); i++) {
+		const U32 samples = 200000;
+		double sum = 0.0;
+		U64 smallest = UINT64_MAX;
+		for (U32 s = 0; s < samples; s++) {
+			U64 trials = next_geometric(&rs, chances[i]);
+			sum += (double)trials;
+			smallest = min(smallest, trials);
+		}
+		double mean = sum / samples;
+		double expected = 1.0 / chances[i];
+		double deviation = sqrt(1.0 - chances[i]) / chances[i] / sqrt((double)samples);
+		if (!Check(fabs(mean - expected) <= 6.0 * deviation))
+			printf("  Mean %.2f for chance %g, expected %.2f\n", mean, chances[i], expected);
+		Check(smallest >= 1);
+	}
+	Check(next_geometric(&rs, 1.0) == 1);
+}
+
+// -- Tick kernels
+
+#if ARCH_SSE2
+
+// Fills the hot columns with values around every threshold of the rules
+void test_randomize_dwarves(World *world, Random_Series *rs)
+{
+	Dwarves *dwarves = &world->dwarves;
+	for (U32 i = 0; i < dwarves->count; i++) {
+		dwarves->hunger[i] = (I32)(next32(rs) % 80) - 10;
+		dwarves->sleep[i] = (I32)(next32(rs) % 80) - 10;
+		dwarves->activity[i] = (U8)(next32(rs) % 3);
+		dwarves->alive[i] = next32(rs) % 8 != 0;
+		dwarves->location[i] = 1 + next32(rs) % world->location_count;
+	}
+}
+
+// The AVX2 kernel has to write exactly what the scalar one does, for any
+// range of dwarves including ones that don't fill the last 8 lanes
+void test_tick_kernels_agree()
+{
+	if (!os_cpu_has_avx2()) {
+		puts("  Skipped, the CPU doesn't support AVX2");
+		return;
+	}
+
+	const int dwarf_count = 1000;
+	World *scalar = test_world(dwarf_count, 1);
+	World *avx2 = test_world(dwarf_count, 1);
+
+	U32 ranges[][2] = {
+		{ 0, 0 }, { 0, 1 }, { 0, 7 }, { 0, 8 }, { 0, 9 }, { 3, 20 },
+		{ 5, 13 }, { 17, 17 }, { 0, 1000 }, { 1, 1000 }, { 333, 999 },
+	};
+	for (U32 r = 0; r < Count(ranges); r++) {
+		Random_Series rs_scalar = series_from_seed32(r + 1);
+		Random_Series rs_avx2 = series_from_seed32(r + 1);
+		test_randomize_dwarves(scalar, &rs_scalar);
+		test_randomize_dwarves(avx2, &rs_avx2);
+		memset(scalar->tick_flags, 0xFF, dwarf_count);
+		memset(avx2->tick_flags, 0xFF, dwarf_count);
+
+		U32 begin = ranges[r][0], end = ranges[r][1];
+		tick_kernel_scalar(scalar, begin, end);
+		tick_kernel_avx2(avx2, begin, end);
+
+		Dwarves *a = &scalar->dwarves, *b = &avx2->dwarves;
+		U32 mismatches = 0;
+		for (U32 i = 0; i < (U32)dwarf_count; i++) {
+			if (a->hunger[i] != b->hunger[i] || a->sleep[i] != b->sleep[i]
+					|| a->activity[i] != b->activity[i] || a->alive[i] != b->alive[i]
+					|| a->location[i] != b->location[i]
+					|| scalar->tick_flags[i] != avx2->tick_flags[i])
+				mismatches++;
+		}
+		if (!Check(mismatches == 0))
+			printf("  %u dwarves differ ticking [%u, %u)\n", mismatches, begin, end);
+	}
+}
+
+#endif
+
+Test_Case test_cases[] = {
+	{ "random/philox", test_philox_known_answers },
+	{ "random/pcg64", test_pcg64_known_answers },
+	{ "random/advance", test_series_advance },
+	{ "random/fill", test_random_fill },
+	{ "random/uniform", test_random_uniform },
+	{ "random/rates", test_random_rates },
+	{ "random/geometric", test_random_geometric },
+	{ "format/integers", test_format_integers },
+	{ "format/fixed", test_format_fixed },
+	{ "format/html", test_format_html },
+	{ "http/parse", test_parse_requests_all },
+	{ "http/keep_alive", test_parse_keep_alive_all },
+	{ "modes/agree", test_modes_agree },
+	{ "dwarves/remove", test_remove_dwarf },
+	{ "dwarves/burials", test_burials },
+	{ "save/load", test_save_load },
+	{ "journal/compact", test_journal_compact },
+#if ARCH_SSE2
+	{ "tick/kernels_agree", test_tick_kernels_agree },
+#endif
+};
+
+bool test_selected(const char *name, int argc, char **argv)
+{
+	if (argc <= 1)
+		return true;
+	for (int i = 1; i < argc; i++) {
+		if (strstr(name, argv[i]))
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	os_startup();
+	arena_pool_init();
+	http_init();
+	random_init();
+	route_init();
+	world_tick_init();
+	http_status_lines_init();
+	work_pool_start(&work_pool, (int)os_cpu_count());
+
+	U32 test_count = 0;
+	U32 failed_tests = 0;
+	for (U32 i = 0; i < Count(test_cases); i++) {
+		Test_Case *test_case = &test_cases[i];
+		if (!test_selected(test_case->name, argc, argv))
+			continue;
+
+		test_count++;
+		U32 failures_before = test_failure_count;
+		test_case->func();
+		bool passed = test_failure_count == failures_before;
+		if (!passed)
+			failed_tests++;
+		printf("%-24s %s\n", test_case->name, passed ? "ok" : "FAILED");
+	}
+
+	printf("%u of %u tests failed, %u of %u checks\n", failed_tests, test_count,
+		test_failure_count, test_check_count);
+	return failed_tests == 0 ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+
+// Fixed pool of worker threads. Every worker owns a deque of tasks: the
+// owner pushes and pops at the bottom, while idle workers steal the oldest
+// tasks from the top of the others' deques.
+
+typedef void (*Work_Func)(void *param);
+
+struct Work_Task
+{
+	Work_Func func;
+	void *param;
+};
+
+struct Work_Deque
+{
+	os_mutex lock;
+	Work_Task *tasks;
+	U32 capacity;
+
+	// Indices grow forever, the task slot is `index % capacity`
+	U32 top, bottom;
+};
+
+struct Work_Pool;
+
+struct Work_Worker
+{
+	Work_Pool *pool;
+	U32 index;
+	Work_Deque deque;
+	Random_Series random_series;
+};
+
+struct Work_Pool
+{
+	Work_Worker *workers;
+	U32 worker_count;
+
+	// Signaled once per submitted task
+	os_semaphore wake;
+
+	os_atomic_uint32 busy_count;
+	os_atomic_uint32 queued_count;
+	os_atomic_uint32 steal_count;
+	os_atomic_uint32 task_count;
+	os_atomic_uint32 next_submit;
+};
+
+// Set for the threads of the pool so tasks submitted from a worker go to
+// its own deque.
+os_thread_local Work_Worker *work_current_worker;
+
+void deque_init(Work_Deque *deque, U32 capacity)
+{
+	os_mutex_init(&deque->lock);
+	deque->tasks = (Work_Task*)malloc(capacity * sizeof(Work_Task));
+	deque->capacity = capacity;
+	deque->top = 0;
+	deque->bottom = 0;
+}
+
+void deque_push(Work_Deque *deque, Work_Task task)
+{
+	os_mutex_lock(&deque->lock);
+
+	if (deque->bottom - deque->top == deque->capacity) {
+		U32 new_capacity = deque->capacity * 2;
+		Work_Task *tasks = (Work_Task*)malloc(new_capacity * sizeof(Work_Task));
+		for (U32 i = deque->top; i != deque->bottom; i++) {
+			tasks[i % new_capacity] = deque->tasks[i % deque->capacity];
+		}
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->capacity = new_capacity;
+	}
+
+	deque->tasks[deque->bottom % deque->capacity] = task;
+	deque->bottom++;
+
+	os_mutex_unlock(&deque->lock);
+}
+
+// Takes the newest task, used by the owner of the deque.
+bool deque_pop(Work_Deque *deque, Work_Task *task)
+{
+	bool found = false;
+	os_mutex_lock(&deque->lock);
+	if (deque->bottom != deque->top) {
+		deque->bottom--;
+		*task = deque->tasks[deque->bottom % deque->capacity];
+		found = true;
+	}
+	os_mutex_unlock(&deque->lock);
+	return found;
+}
+
+// Takes the oldest task, used by the other workers.
+bool deque_steal(Work_Deque *deque, Work_Task *task)
+{
+	bool found = false;
+	os_mutex_lock(&deque->lock);
+	if (deque->bottom != deque->top) {
+		*task = deque->tasks[deque->top % deque->capacity];
+		deque->top++;
+		found = true;
+	}
+	os_mutex_unlock(&deque->lock);
+	return found;
+}
+
+bool work_find_task(Work_Worker *worker, Work_Task *task)
+{
+	Work_Pool *pool = worker->pool;
+	if (deque_pop(&worker->deque, task))
+		return true;
+
+	// Start stealing from a random worker so thieves don't pile on one deque
+	U32 start = next32(&worker->random_series) % pool->worker_count;
+	for (U32 i = 0; i < pool->worker_count; i++) {
+		Work_Worker *victim = &pool->workers[(start + i) % pool->worker_count];
+		if (victim == worker)
+			continue;
+		if (deque_steal(&victim->deque, task)) {
+			os_atomic_increment(&pool->steal_count);
+			return true;
+		}
+	}
+	return false;
+}
+
+OS_THREAD_ENTRY(thread_work_worker, work_worker)
+{
+	Work_Worker *worker = (Work_Worker*)work_worker;
+	Work_Pool *pool = worker->pool;
+	work_current_worker = worker;
+
+	for (;;) {
+		os_semaphore_wait(&pool->wake);
+
+		// The task this signal was for may already have been taken by a busy
+		// worker, in which case this just goes back to sleep.
+		Work_Task task;
+		while (work_find_task(worker, &task)) {
+			os_atomic_decrement(&pool->queued_count);
+			os_atomic_increment(&pool->busy_count);
+			task.func(task.param);
+			os_atomic_decrement(&pool->busy_count);
+			os_atomic_increment(&pool->task_count);
+		}
+	}
+
+	OS_THREAD_RETURN;
+}
+
+void work_pool_start(Work_Pool *pool, U32 worker_count)
+{
+	pool->worker_count = max(worker_count, 1);
+	pool->workers = (Work_Worker*)calloc(pool->worker_count, sizeof(Work_Worker));
+	os_semaphore_init(&pool->wake, 0);
+
+	for (U32 i = 0; i < pool->worker_count; i++) {
+		Work_Worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->index = i;
+		worker->random_series = series_from_seed32(0x5EED + i);
+		deque_init(&worker->deque, 64);
+	}
+
+	for (U32 i = 0; i < pool->worker_count; i++) {
+		os_thread_do(thread_work_worker, &pool->workers[i]);
+	}
+}
+
+// Queues `func(param)` to be run by some worker of the pool. Can be called
+// from any thread.
+void work_submit(Work_Pool *pool, Work_Func func, void *param)
+{
+	Work_Task task;
+	task.func = func;
+	task.param = param;
+
+	Work_Worker *worker = work_current_worker;
+	if (!worker || worker->pool != pool) {
+		U32 index = os_atomic_add(&pool->next_submit, 1) % pool->worker_count;
+		worker = &pool->workers[index];
+	}
+
+	os_atomic_increment(&pool->queued_count);
+	deque_push(&worker->deque, task);
+	os_semaphore_signal(&pool->wake);
+}
+
+// Splitting a loop over the workers of the pool
+
+typedef void (*Work_Range_Func)(void *param, U32 begin, U32 end);
+
+struct Work_Group;
+
+struct Work_Range_Task
+{
+	Work_Range_Func func;
+	void *param;
+	U32 begin, end;
+	Work_Group *group;
+};
+
+// Tracks the tasks of one `work_parallel_for` call, can be reused by
+// consecutive calls.
+struct Work_Group
+{
+	os_atomic_uint32 remaining;
+	os_semaphore done;
+
+	Work_Range_Task *tasks;
+	U32 task_capacity;
+};
+
+void work_group_init(Work_Group *group)
+{
+	group->remaining = 0;
+	os_semaphore_init(&group->done, 0);
+	group->tasks = 0;
+	group->task_capacity = 0;
+}
+
+void work_run_range(void *param)
+{
+	Work_Range_Task *task = (Work_Range_Task*)param;
+	Work_Group *group = task->group;
+	task->func(task->param, task->begin, task->end);
+
+	if (os_atomic_add(&group->remaining, (U32)-1) == 1)
+		os_semaphore_signal(&group->done);
+}
+
+// Calls `func` for ranges of at most `grain` items covering [0, count) on the
+// workers of the pool and waits for all of them to return. The ranges don't
+// depend on the number of workers. Must not be called from a worker of the
+// pool, as it could end up waiting for itself. Without a pool the ranges run
+// on the calling thread, which workers can do.
+void work_parallel_for(Work_Pool *pool, Work_Group *group, U32 count, U32 grain,
+	Work_Range_Func func, void *param)
+{
+	U32 range_count = (count + grain - 1) / grain;
+	if (!pool || range_count <= 1) {
+		for (U32 begin = 0; begin < count; begin += grain)
+			func(param, begin, min(begin + grain, count));
+		return;
+	}
+	assert(!work_current_worker || work_current_worker->pool != pool);
+
+	if (group->task_capacity < range_count) {
+		group->task_capacity = range_count;
+		group->tasks = (Work_Range_Task*)realloc(group->tasks,
+			range_count * sizeof(Work_Range_Task));
+	}
+
+	group->remaining = range_count;
+	for (U32 i = 0; i < range_count; i++) {
+		Work_Range_Task *task = &group->tasks[i];
+		task->func = func;
+		task->param = param;
+		task->begin = i * grain;
+		task->end = min(task->begin + grain, count);
+		task->group = group;
+		work_submit(pool, work_run_range, task);
+	}
+
+	os_semaphore_wait(&group->done);
+}